@@ -0,0 +1,68 @@
+#ifndef TWAMP_LIGHT_BINARY_LOG_H
+#define TWAMP_LIGHT_BINARY_LOG_H
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+constexpr char BINARY_LOG_MAGIC[8] = {'T', 'W', 'L', 'B', 'L', 'O', 'G', '\0'};
+constexpr uint32_t BINARY_LOG_VERSION = 1;
+
+/**
+ * File layout of --log-format binary: one header followed by fixed-width records, all little-endian.
+ * Header and records are the same size, so record i starts at (i + 1) * sizeof(BinaryLogRecord) and a file
+ * can be mapped and indexed as an array.
+ */
+struct BinaryLogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t start_time; // Nanoseconds since the epoch when the file was created
+    uint8_t reserved[40];
+};
+
+/* One reflected packet. The columns are those of the text output, kept as integers. */
+struct BinaryLogRecord {
+    uint64_t send_time;         // Sender timestamp, nanoseconds since the epoch (Time)
+    int64_t internal_delay;     // Reflector send minus receive, nanoseconds (IntD)
+    int64_t forward_delay;      // Reflector receive minus sender timestamp, nanoseconds (FWD)
+    uint8_t address[16];        // Sender address; the first 4 bytes for IPv4 (IP)
+    uint32_t sender_seq_number; // Snd#
+    uint32_t seq_number;        // Rcv#
+    uint16_t sending_port;      // SndPort
+    uint16_t receiving_port;    // RscPort
+    uint16_t payload_length;    // PLEN
+    uint8_t ttl;                // FW_TTL
+    uint8_t sender_tos;         // SndTOS
+    uint8_t fw_tos;             // FW_TOS
+    uint8_t ip_version;
+    uint8_t reserved[6];
+};
+static_assert(sizeof(BinaryLogHeader) == 64);
+static_assert(sizeof(BinaryLogRecord) == 64);
+static_assert(sizeof(BinaryLogHeader) == sizeof(BinaryLogRecord), "The header takes the first record slot");
+
+/* Converts the multi-byte fields of a record between host and file (little-endian) order, both ways */
+void binary_log_byte_order(BinaryLogRecord *record);
+
+/**
+ * @brief Appends records to a binary log file.
+ *
+ * The file is opened O_APPEND and every append is a single write of whole records, so the servers of one
+ * process can share a writer without a lock. Use shared() to get the writer of a path.
+ */
+class BinaryLogWriter {
+  public:
+    explicit BinaryLogWriter(const std::string &path);
+    BinaryLogWriter(const BinaryLogWriter &other) = delete;
+    auto operator=(const BinaryLogWriter &other) -> BinaryLogWriter & = delete;
+    ~BinaryLogWriter();
+    /* The writer of path, shared by every server of the process that logs to it. Creating it truncates the file. */
+    static auto shared(const std::string &path) -> std::shared_ptr<BinaryLogWriter>;
+    /* Returns false if the records could not all be written */
+    auto append(const BinaryLogRecord *records, size_t count) -> bool;
+
+  private:
+    int fd;
+};
+#endif // TWAMP_LIGHT_BINARY_LOG_H
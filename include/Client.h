@@ -3,9 +3,16 @@
 //
 #include "utils.hpp"
 #include "packetlist.h"
+#include "capacity.h"
+#include "pacer.h"
+#include "schedule.h"
+#include "sequence_table.h"
+#include "timer_wheel.h"
+#include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <semaphore.h>
 #include <string>
@@ -26,6 +33,9 @@ constexpr int16_t PAYLOAD_LEN_1250 = 1250;
 constexpr int16_t PAYLOAD_LEN_1400 = 1400;
 
 constexpr uint32_t DEFAULT_MEAN_INTER_PACKET_DELAY = 200;
+constexpr uint32_t DEFAULT_TXTIME_WINDOW_MICROSECONDS = 500;
+constexpr uint16_t DEFAULT_RECEIVE_BATCH_SIZE = 1;
+constexpr uint16_t MAX_RECEIVE_BATCH_SIZE = 1024;
 
 struct Args {
     std::vector<std::string> remote_hosts{};
@@ -53,6 +63,14 @@ struct Args {
     bool print_RTT_only = false;
     bool print_lost_packets = false;
     bool constant_inter_packet_delay = false;
+    bool txtime = false;
+    uint32_t txtime_window_us = DEFAULT_TXTIME_WINDOW_MICROSECONDS;
+    clockid_t txtime_clock = CLOCK_MONOTONIC;
+    uint32_t train_length = 0;
+    uint16_t train_size = PAYLOAD_LEN_1400;
+    bool share_local_port = false;
+    uint16_t batch_size = DEFAULT_RECEIVE_BATCH_SIZE;
+    uint32_t reorder_window_ms = 0;
     std::string print_format = "legacy";
     std::string json_output_file{};
 };
@@ -68,6 +86,7 @@ class RawData {
     uint64_t client_receive_epoch_nanoseconds = 0;
 
   public:
+    RawData() = default;
     RawData(uint64_t added_at_epoch_nanoseconds,
             uint32_t packet_id,
             uint16_t payload_len,
@@ -137,42 +156,18 @@ class RawData {
     }
 };
 
-class RawDataList {
-  private:
-    std::deque<std::shared_ptr<RawData>> observations;
-    std::mutex mutex;
-
-  public:
-    void addObservation(const std::shared_ptr<RawData> &observation)
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-        observations.push_back(observation);
-    }
+/* A packet in the collation table. The table releases packets in sequence order, so a packet printed ahead of an
+ * earlier one stays behind as Emitted until that one is done. */
+struct CollationEntry {
+    enum class State { Outstanding, Ready, Emitted };
+    RawData raw_data;
+    State state = State::Outstanding; // Ready: complete or lost, and waiting for the packets ahead of it
+};
 
-    auto popObservation() -> std::shared_ptr<RawData>
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-        auto observation = observations.front();
-        observations.pop_front();
-        return observation;
-    }
-    // Iterate over the deque
-    auto begin() -> decltype(observations.begin())
-    {
-        return observations.begin();
-    }
-    auto end() -> decltype(observations.end())
-    {
-        return observations.end();
-    }
-    auto getOldestEntry() -> std::shared_ptr<RawData>
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-        if (observations.empty()) {
-            return nullptr;
-        }
-        return observations.front();
-    }
+struct CollatorTimer {
+    enum class Kind : uint8_t { Loss, Reorder };
+    uint32_t packet_id = 0;
+    Kind kind = Kind::Loss;
 };
 
 struct MetricData {
@@ -191,6 +186,14 @@ struct MetricData {
     IPHeader ipHeader;
 };
 
+struct ReceiveBuffers;
+
+/**
+ * @brief A measurement session against one reflector.
+ *
+ * The session has its own socket connected to the reflector, its own sequence numbers, collation table and
+ * statistics, so one process can measure several reflectors side by side.
+ */
 class Client {
   public:
     explicit Client(const Args &args);
@@ -203,17 +206,19 @@ class Client {
     Client(Client &&) = delete;
     auto operator=(Client &&) -> Client & = delete;
 
-    auto sendPacket(uint32_t idx, size_t payload_len) -> Timestamp;
+    /* A launch_time (CLOCK_MONOTONIC nanoseconds) other than 0 has the qdisc release the packet then, see --txtime */
+    auto sendPacket(uint32_t idx, size_t payload_len, uint64_t launch_time = 0) -> Timestamp;
     auto awaitAndHandleResponse() -> bool;
     void printStats(int packets_sent);
+    void printCapacity(std::ostream &os) const;
     void printRawDataHeader() const;
-    void aggregateRawData(const std::shared_ptr<RawData> &oldest_raw_dat);
+    void aggregateRawData(const RawData &oldest_raw_data);
     void runSenderThread();
     void runReceiverThread();
     void runCollatorThread();
-    void enqueue_observation(const std::shared_ptr<QEDObservation> &obs);
-    void process_observation(const std::shared_ptr<QEDObservation> &obs);
-    void check_if_oldest_packet_should_be_processed();
+    void process_observation(const QEDObservation &obs);
+    void expire_timer(const CollatorTimer &timer);
+    void release_oldest_packets();
     void print_lost_packet(uint32_t packet_id, uint64_t initial_send_time, uint16_t payload_len) const;
     [[nodiscard]] auto getSentPackets() const -> int;
     void printHeader() const;
@@ -224,26 +229,51 @@ class Client {
     int sent_packets = 0;
     int received_packets = 0;
     int32_t last_received_packet_id = -1;
-    uint64_t sending_completed = 0;
+    // Shared between the sender, receiver and collator threads
+    std::atomic<uint64_t> sending_completed{0};
     uint64_t start_time = 0;
-    int collator_started = 0;
-    int collator_finished = 0;
+    std::atomic<bool> collator_started{false};
+    std::atomic<bool> collator_finished{false};
     bool header_printed = false;
-    pthread_mutex_t observation_list_mutex = PTHREAD_MUTEX_INITIALIZER;
-    ObservationList observation_list = {};
+    ObservationQueue observation_queue;
+    // Signalled by the producers while the collator sleeps
+    int collator_event_fd = -1;
+    std::atomic<bool> collator_sleeping{false};
     std::vector<struct addrinfo *> remote_address_info = {};
     struct addrinfo *local_address_info = {};
     struct sqa_stats *stats_RTT;
     struct sqa_stats *stats_internal;
     struct sqa_stats *stats_client_server;
     struct sqa_stats *stats_server_client;
-    RawDataList raw_data_list;
+    // Used by the collator only
+    SequenceTable<CollationEntry> raw_data_table;
+    TimerWheel<CollatorTimer> collator_timers;
+    CapacityEstimator capacity;
     uint64_t first_packet_sent_epoch_nanoseconds = 0;
     uint64_t last_packet_sent_epoch_nanoseconds = 0;
     uint64_t last_packet_received_epoch_nanoseconds = 0;
+    // Used by the sender thread only, and read once it has finished
+    ProbeSchedule schedule;
+    Pacer pacer;
+    enum class TxtimeState { Off, Probing, Active };
+    TxtimeState txtime_state = TxtimeState::Off;
+    std::vector<uint64_t> txtime_probe_launches{}; // Realtime launch of every datagram sent while probing
+    uint64_t txtime_errors = 0;
+    // Used by the receiver thread only
+    std::unique_ptr<ReceiveBuffers> receive_buffers;
     Args args;
+    // Held while a line goes to stdout, which the sessions of a process share
+    inline static std::mutex output_mutex;
     static auto craftSenderPacket(uint32_t idx) -> ClientPacket;
     void printStat(const char *statName, sqa_stats *statType);
+    void printPacing(std::ostream &os) const;
+    void finishTxtimeProbe();
+    void enqueueSent(const QEDObservation &obs);
+    void enqueueReceived(const QEDObservation &obs);
+    void emit_packet(const RawData &raw_data);
+    void wakeCollator();
+    void waitForCollatorWork();
+    auto receiveBatch() -> bool;
 
     void handleReflectorPacket(ReflectorPacket *reflectorPacket,
                                msghdr msghdr,
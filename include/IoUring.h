@@ -0,0 +1,70 @@
+#ifndef TWAMP_LIGHT_IO_URING_H
+#define TWAMP_LIGHT_IO_URING_H
+#ifdef TWAMP_IO_URING
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <linux/io_uring.h>
+#include <vector>
+
+/**
+ * @brief Minimal io_uring instance driven through the raw syscalls, so no liburing is needed.
+ *
+ * Holds the submission and completion rings plus one provided buffer ring, which is what the
+ * reflector needs for multishot receives. Throws std::runtime_error if the kernel lacks a feature.
+ */
+class IoUring {
+  public:
+    IoUring(unsigned int entries, unsigned int num_buffers, size_t buffer_size, uint16_t buffer_group);
+    ~IoUring();
+    IoUring(const IoUring &) = delete;
+    auto operator=(const IoUring &) -> IoUring & = delete;
+    IoUring(IoUring &&) = delete;
+    auto operator=(IoUring &&) -> IoUring & = delete;
+
+    /* Returns a zeroed submission entry, or nullptr if the submission queue is full */
+    auto getSqe() -> io_uring_sqe *;
+    /* Submits the queued entries and waits for at least wait_nr completions or the timeout.
+     * Returns the number of submitted entries, or -errno (-ETIME when the timeout expired). */
+    auto submitAndWait(unsigned int wait_nr, const struct timespec *timeout) -> int;
+    /* Returns the next completion, or nullptr if there is none. Call cqeSeen() once it is handled. */
+    auto peekCqe() -> io_uring_cqe *;
+    void cqeSeen();
+
+    [[nodiscard]] auto getBufferGroup() const -> uint16_t;
+    [[nodiscard]] auto getBuffer(uint16_t buffer_id) -> uint8_t *;
+    /* Hands a provided buffer back to the kernel once its contents have been consumed */
+    void recycleBuffer(uint16_t buffer_id);
+
+  private:
+    void setup(unsigned int entries, unsigned int num_buffers);
+    void release();
+
+    int ring_fd = -1;
+    struct io_uring_params params {};
+    void *sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    void *cq_ring = nullptr;
+    size_t cq_ring_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+    unsigned int *sq_head = nullptr;
+    unsigned int *sq_tail = nullptr;
+    unsigned int *sq_array = nullptr;
+    unsigned int sq_mask = 0;
+    unsigned int sq_local_tail = 0;
+    unsigned int *cq_head = nullptr;
+    unsigned int *cq_tail = nullptr;
+    unsigned int cq_mask = 0;
+    io_uring_cqe *cqes = nullptr;
+
+    io_uring_buf *buffer_ring = nullptr;
+    uint16_t *buffer_ring_tail = nullptr;
+    size_t buffer_ring_size = 0;
+    unsigned int buffer_ring_mask = 0;
+    uint16_t buffer_group = 0;
+    size_t buffer_size = 0;
+    std::vector<uint8_t> buffers;
+};
+#endif // TWAMP_IO_URING
+#endif // TWAMP_LIGHT_IO_URING_H
@@ -0,0 +1,55 @@
+#ifndef TWAMP_LIGHT_LOAD_TEST_H
+#define TWAMP_LIGHT_LOAD_TEST_H
+#include "Server.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr uint16_t DEFAULT_LOAD_PAYLOAD_SIZE = 128;
+constexpr uint16_t DEFAULT_LOAD_DURATION = 5;
+constexpr uint32_t DEFAULT_LOAD_WINDOW = 256;
+
+struct LoadTestArgs {
+    // Reflector to load. Without a host an in-process reflector is started from the reflector args.
+    std::string target_host;
+    uint16_t target_port = 0;
+    uint8_t ip_version = 4;
+    uint16_t threads = 1;
+    double rate = 0; // Packets per second per sender thread, 0 sends as fast as the window allows
+    uint16_t payload_size = DEFAULT_LOAD_PAYLOAD_SIZE;
+    uint16_t duration = DEFAULT_LOAD_DURATION;
+    uint32_t window = DEFAULT_LOAD_WINDOW; // Most packets a sender thread has in flight without a rate
+    Args reflector;
+};
+
+/* What one sender thread saw */
+struct SenderResult {
+    uint64_t sent = 0;
+    uint64_t send_errors = 0;
+    uint64_t received = 0;
+    std::vector<int64_t> internal_delays; // Reflector send time minus reflector receive time, in nanoseconds
+    std::vector<int64_t> round_trips;     // Reply arrival minus the sender timestamp, in nanoseconds
+};
+
+/**
+ * @brief Drives a reflector with TWAMP test packets from several sender threads and reports its capacity.
+ *
+ * The senders build ClientPackets and set up their sockets the way the client does, and the in-process
+ * reflector is the production Server or WorkerPool, so the numbers are those of the real reflection path.
+ * The internal delays are read from the reflected packets, so they are available for a remote reflector too.
+ */
+class LoadTest {
+  public:
+    explicit LoadTest(LoadTestArgs args);
+    auto run() -> int;
+
+  private:
+    LoadTestArgs args;
+    struct sockaddr_storage target {};
+    socklen_t target_len = 0;
+
+    void resolveTarget(const std::string &host, uint16_t port);
+    void runSender(SenderResult *result);
+    void report(std::vector<SenderResult> &results) const;
+};
+#endif // TWAMP_LIGHT_LOAD_TEST_H
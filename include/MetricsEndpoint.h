@@ -0,0 +1,35 @@
+#ifndef TWAMP_LIGHT_METRICS_ENDPOINT_H
+#define TWAMP_LIGHT_METRICS_ENDPOINT_H
+#include "Server.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Renders the summed counters and internal delay histogram of the reflectors in the Prometheus text format */
+auto format_prometheus_metrics(const ServerCounters &counters, const DelayHistogram &histogram) -> std::string;
+
+/* Serves the metrics of a set of reflectors on a Unix socket from its own thread. Every connection gets one
+ * HTTP response, so `curl --unix-socket PATH http://localhost/metrics` scrapes it. The counters are only read,
+ * so scraping never touches the reflection path. The servers must outlive the endpoint. */
+class MetricsEndpoint {
+  public:
+    MetricsEndpoint(std::string path, std::vector<const Server *> servers);
+    MetricsEndpoint(const MetricsEndpoint &) = delete;
+    auto operator=(const MetricsEndpoint &) -> MetricsEndpoint & = delete;
+    MetricsEndpoint(MetricsEndpoint &&) = delete;
+    auto operator=(MetricsEndpoint &&) -> MetricsEndpoint & = delete;
+    ~MetricsEndpoint();
+
+  private:
+    std::string path;
+    std::vector<const Server *> servers;
+    int fd = -1;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+
+    void run();
+    void serve(int client_fd) const;
+    [[nodiscard]] auto render() const -> std::string;
+};
+#endif // TWAMP_LIGHT_METRICS_ENDPOINT_H
@@ -0,0 +1,37 @@
+#ifndef TWAMP_LIGHT_MULTI_SERVER_H
+#define TWAMP_LIGHT_MULTI_SERVER_H
+#include "Server.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+constexpr size_t MAX_LISTEN_SOCKETS = 1024;
+
+/* Parses ADDRESS:PORT or ADDRESS:FIRST-LAST. IPv6 addresses may be put in brackets and select an IPv6 socket. */
+auto parse_listen_address(const std::string &input, ListenAddress &address) -> bool;
+
+/* Serves every socket of args.listen_addresses from one thread. Each socket has its own Server, so its own
+ * address family, cmsg parsing and counters, and an epoll loop hands it the datagrams whenever it is readable. */
+class MultiServer {
+  public:
+    explicit MultiServer(const Args &args);
+    MultiServer(const MultiServer &) = delete;
+    auto operator=(const MultiServer &) -> MultiServer & = delete;
+    MultiServer(MultiServer &&) = delete;
+    auto operator=(MultiServer &&) -> MultiServer & = delete;
+    ~MultiServer();
+
+    auto run() -> int;
+    void printCounters() const;
+    [[nodiscard]] auto getServers() const -> std::vector<const Server *>;
+
+  private:
+    Args args;
+    // Shared num_samples budget, so the process stops after num_samples in total rather than per socket
+    std::atomic<uint32_t> sample_counter{0};
+    std::vector<std::unique_ptr<Server>> servers;
+    std::vector<std::string> labels;
+    int epoll_fd = -1;
+};
+#endif // TWAMP_LIGHT_MULTI_SERVER_H
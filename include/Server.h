@@ -1,9 +1,45 @@
 //
 // Created by vladim0105 on 12/17/21.
 //
+#ifndef TWAMP_LIGHT_SERVER_H
+#define TWAMP_LIGHT_SERVER_H
+#include "BinaryLog.h"
+#include "Session.h"
+#include "TextLog.h"
+#include "flat_hash_map.h"
+#include "metrics.h"
+#include "ring_buffer.h"
 #include "utils.hpp"
+#include <atomic>
+#include <memory>
+#include <netinet/in.h>
+#include <ostream>
 #include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
 
+constexpr uint16_t DEFAULT_BATCH_SIZE = 1;
+constexpr uint16_t MAX_BATCH_SIZE = 1024;
+constexpr size_t LOG_RING_CAPACITY = 4096;
+constexpr uint16_t DEFAULT_SESSION_TIMEOUT = 60;
+// Longest a record waits in the binary log buffer, also while no packets come in
+constexpr uint64_t BINARY_LOG_FLUSH_INTERVAL_USEC = 1000000;
+constexpr double DEFAULT_RATE_BURST = 10;
+// With --steer-cpu, packets admitted between two SO_INCOMING_CPU samples
+constexpr size_t CPU_SAMPLE_INTERVAL = 1024;
+
+enum class LogFormat {
+    Text,  // A CSV line per packet on stdout
+    Binary // A BinaryLogRecord per packet in Args::log_file
+};
+/* One --listen entry: an address and a range of ports to bind on it */
+struct ListenAddress {
+    std::string host;
+    uint16_t first_port = 0;
+    uint16_t last_port = 0;
+    uint8_t ip_version = 4;
+};
 struct Args {
     std::string local_host;
     std::string local_port = "443";
@@ -11,35 +47,179 @@ struct Args {
     uint8_t timeout = 0;
     uint8_t snd_tos = 0;
     uint8_t ip_version = 4;
+    uint16_t batch_size = DEFAULT_BATCH_SIZE;
+    uint16_t workers = 1;
+    bool reuse_port = false;
+    bool io_uring = false;
+    bool async_log = false;
+    bool tx_timestamp = false;
+    bool stateful = false;
+    uint16_t session_timeout = DEFAULT_SESSION_TIMEOUT;
+    double rate_limit = 0; // Packets per second per source address, 0 disables the limit
+    double rate_burst = DEFAULT_RATE_BURST;
+    // Sockets served by one event loop, replacing local_host, local_port and ip_version when not empty
+    std::vector<ListenAddress> listen_addresses;
+    bool v6_only = false;
+    std::string metrics_socket;
+    uint32_t busy_poll = 0;    // SO_BUSY_POLL budget in microseconds; non-zero also spins on non-blocking receives
+    int cpu = -1;              // CPU the reflecting thread is pinned to, -1 leaves it to the scheduler
+    bool steer_cpu = false;    // Workers serve the datagrams received on their own CPU
+    int realtime_priority = 0; // SCHED_FIFO priority of the reflecting thread, 0 keeps the default policy
+    bool lock_memory = false;
+    bool print_packets = true; // Per-packet output lines; the counters and metrics are kept either way
+    LogFormat log_format = LogFormat::Text;
+    std::string log_file;
     char sep = ',';
 };
-struct MetricData {
-    std::string ip;
-    uint16_t sending_port = 0;
-    uint16_t receiving_port = 0;
-    uint16_t payload_length = 0;
-    int64_t client_server_delay_nanoseconds = 0;
-    int64_t internal_delay_nanoseconds = 0;
-    uint64_t initial_send_time = 0;
-    ReflectorPacket packet;
+/* Fixed-size copy of what printMetrics needs, cheap enough to take on the reflection path: the header fields of the
+ * reply, in network byte order, but not its padding */
+struct LogRecord {
+    uint32_t seq_number;
+    uint32_t sender_seq_number;
+    Timestamp send_timestamp;
+    Timestamp receive_timestamp;
+    Timestamp sender_timestamp;
+    uint8_t sender_ttl;
+    uint8_t sender_tos;
+    uint16_t payload_length;
+    struct sockaddr_in6 addr;
 };
+/* Written by the reflecting thread only, and safe to read from the metrics endpoint while it runs */
+struct ServerCounters {
+    RelaxedCounter received_packets;
+    RelaxedCounter reflected_packets;
+    RelaxedCounter truncated_packets;
+    RelaxedCounter send_errors;
+    RelaxedCounter receive_calls;
+    RelaxedCounter send_calls;
+    RelaxedCounter dropped_log_records;
+    RelaxedCounter missed_tx_timestamps;
+    RelaxedCounter rate_limited_packets;
+    // With args.steer_cpu: SO_INCOMING_CPU samples, one per CPU_SAMPLE_INTERVAL packets, by whether the sampled
+    // packet arrived on the reflector's CPU
+    RelaxedCounter own_cpu_samples;
+    RelaxedCounter other_cpu_samples;
+
+    auto operator+=(const ServerCounters &other) -> ServerCounters &
+    {
+        received_packets += other.received_packets;
+        reflected_packets += other.reflected_packets;
+        truncated_packets += other.truncated_packets;
+        send_errors += other.send_errors;
+        receive_calls += other.receive_calls;
+        send_calls += other.send_calls;
+        dropped_log_records += other.dropped_log_records;
+        missed_tx_timestamps += other.missed_tx_timestamps;
+        rate_limited_packets += other.rate_limited_packets;
+        own_cpu_samples += other.own_cpu_samples;
+        other_cpu_samples += other.other_cpu_samples;
+        return *this;
+    }
+};
+enum class ReceiveStatus {
+    Received,   // Datagrams were handled and more may be queued
+    WouldBlock, // Nothing queued, or the receive timed out
+    Done,       // The num_samples budget is used up or the server was stopped
+    Failed
+};
+struct BatchBuffers;
 class Server {
   public:
     explicit Server(const Args &args);
-    Server(const Server &other) = default;
-    auto operator=(const Server &other) -> Server & = default;
-    Server(Server &&other) noexcept = default;
-    auto operator=(Server &&other) noexcept -> Server & = default;
+    // The server owns its socket, so it can be neither copied nor moved
+    Server(const Server &other) = delete;
+    auto operator=(const Server &other) -> Server & = delete;
+    Server(Server &&other) = delete;
+    auto operator=(Server &&other) -> Server & = delete;
     auto listen() -> int;
+    /* For an external event loop: startListening() once, drainSocket() whenever the socket is readable,
+     * flushIdleLog() at least once every BINARY_LOG_FLUSH_INTERVAL_USEC, and finishListening() once at the end.
+     * drainSocket() never blocks. */
+    void startListening();
+    auto drainSocket() -> ReceiveStatus;
+    void flushIdleLog();
+    void finishListening();
+    /* Pins the calling thread to args.cpu and raises it to args.realtime_priority. Call it on the reflecting thread
+     * after startListening(), so the log writer keeps the default placement and policy. */
+    void tuneReflectorThread();
+    void stop();
+    void shareSampleCounter(std::atomic<uint32_t> *shared_counter);
+    [[nodiscard]] auto getSocket() const -> int;
+    [[nodiscard]] auto getCounters() const -> const ServerCounters &;
+    [[nodiscard]] auto getDelayHistogram() const -> const DelayHistogram &;
+    static void printCounters(const ServerCounters &counters, const std::string &label = "");
+    static void printDelayHistogram(const DelayHistogram &histogram, const std::string &label = "");
     ~Server();
 
   private:
     int fd;
-    bool header_printed = false;
+    ServerCounters counters;
+    DelayHistogram delay_histogram;
+    std::atomic<bool> stopping{false};
+    // Counts the samples received towards args.num_samples, possibly shared between workers
+    std::atomic<uint32_t> local_sample_counter{0};
+    std::atomic<uint32_t> *sample_counter = &local_sample_counter;
 
     Args args;
-    void handleTestPacket(ClientPacket *packet, msghdr sender_msg, ssize_t payload_len, timespec *incoming_timestamp);
+    uint16_t local_port = 0;
+    std::unique_ptr<BatchBuffers> batch;
+    // With args.async_log the reflection path only queues records, and log_writer formats and prints them
+    std::unique_ptr<SpscRing<LogRecord>> log_ring;
+    std::thread log_writer;
+    std::atomic<bool> log_writer_stopping{false};
+    // With LogFormat::Binary: records are collected here and appended to the file a buffer at a time
+    std::shared_ptr<BinaryLogWriter> binary_log;
+    std::vector<BinaryLogRecord> binary_log_buffer;
+    uint64_t last_binary_log_flush_usec = 0;
+    uint64_t unwritten_log_records = 0; // Counted by the log writer thread
+    // With args.tx_timestamp: error queue id of the next datagram sent, and the stamps of the last send call
+    uint32_t next_tx_id = 0;
+    std::vector<timespec> tx_timestamps;
+    // With args.stateful: one entry per 5-tuple, dropped after args.session_timeout seconds without packets
+    FlatHashMap<SessionKey, Session, SessionKeyHash> sessions;
+    uint64_t last_session_sweep_usec = 0;
+    // With args.rate_limit: one token bucket per source address, in the same table layout as the sessions
+    FlatHashMap<SessionKey, TokenBucket, SessionKeyHash> rate_limits;
+    uint64_t last_rate_limit_sweep_usec = 0;
+    // With args.steer_cpu: when to read SO_INCOMING_CPU next
+    PacketSampler incoming_cpu_sampler{CPU_SAMPLE_INTERVAL};
+
+    // Whether the reflecting thread buffers binary log records, which flushIdleLog writes out while no packets come
+    [[nodiscard]] auto flushesLogWhenIdle() const -> bool
+    {
+        return binary_log && !args.async_log;
+    }
+    auto countSample() -> bool;
+    [[nodiscard]] auto samplesRemaining() const -> uint32_t;
+    void countIncomingCpu(size_t packets);
+    void sampleIncomingCpu();
+    auto listenBlocking() -> int;
+    auto receive(int flags) -> ReceiveStatus;
+    auto receiveSingle(int flags) -> ReceiveStatus;
+    auto receiveBatch(int flags) -> ReceiveStatus;
+    auto listenIoUring() -> int;
+    void handleTestPacket(ReflectorPacket *packet, msghdr sender_msg, ssize_t payload_len, timespec *incoming_timestamp);
+    auto admitPacket(const sockaddr *src_addr) -> bool;
+    void evictIdleRateLimits(uint64_t now_usec);
+    void printRateLimits();
+    static void printRateLimit(const SessionKey &key, const TokenBucket &bucket, const std::string &label);
+    void trackSession(ReflectorPacket &reflector_packet, const msghdr &sender_msg);
+    void sessionReflected(const msghdr &sender_msg);
+    void evictIdleSessions(uint64_t now_usec);
+    void printSessions();
+    static void printSession(const SessionKey &key, const Session &session, const std::string &label);
+    void collectTxTimestamps(size_t count);
+    void applyTxTimestamp(ReflectorPacket &reflector_packet, const timespec &tx_timestamp);
+    void recordMetrics(const ReflectorPacket &reflector_packet, msghdr sender_msg, ssize_t payload_len);
+    void startLogWriter();
+    void stopLogWriter();
+    void runLogWriter();
+    [[nodiscard]] auto makeMetricData(const LogRecord &record) const -> MetricData;
+    [[nodiscard]] auto makeBinaryLogRecord(const LogRecord &record) const -> BinaryLogRecord;
+    void logBinary(const LogRecord &record);
+    auto flushBinaryLog() -> size_t;
     void printMetrics(const MetricData &data);
-    static auto craftReflectorPacket(ClientPacket *clientPacket, msghdr sender_msg, timespec *incoming_timestamp)
-        -> ReflectorPacket;
-};
\ No newline at end of file
+    void printHeader() const;
+    static void reflectPacket(ReflectorPacket *packet, const msghdr &sender_msg, timespec *incoming_timestamp);
+};
+#endif // TWAMP_LIGHT_SERVER_H
@@ -0,0 +1,120 @@
+#ifndef TWAMP_LIGHT_SESSION_H
+#define TWAMP_LIGHT_SESSION_H
+#include "flat_hash_map.h"
+#include <arpa/inet.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* Identifies a test session. The protocol is always UDP and the destination is the reflector's own socket, so
+ * the source address and port plus the local port make up the 5-tuple. IPv4 addresses are stored v4-mapped. */
+struct SessionKey {
+    std::array<uint8_t, 16> address;
+    uint16_t port;       // Network byte order
+    uint16_t local_port; // Host byte order
+};
+
+using SessionKeyHash = BytewiseHash<SessionKey>;
+
+inline auto make_session_key(const struct sockaddr *addr, uint16_t local_port) -> SessionKey
+{
+    SessionKey key{};
+    key.local_port = local_port;
+    if (addr->sa_family == AF_INET6) {
+        const auto *addr6 = reinterpret_cast<const struct sockaddr_in6 *>(addr);
+        memcpy(key.address.data(), &addr6->sin6_addr, sizeof(addr6->sin6_addr));
+        key.port = addr6->sin6_port;
+    } else {
+        const auto *addr4 = reinterpret_cast<const struct sockaddr_in *>(addr);
+        key.address[10] = 0xff;
+        key.address[11] = 0xff;
+        memcpy(&key.address[12], &addr4->sin_addr, sizeof(addr4->sin_addr));
+        key.port = addr4->sin_port;
+    }
+    return key;
+}
+
+/* Writes the key's address to host, which must hold INET6_ADDRSTRLEN characters. v4-mapped keys print as IPv4. */
+inline void format_key_address(const SessionKey &key, char *host)
+{
+    static const std::array<uint8_t, 12> v4_mapped_prefix = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if (memcmp(key.address.data(), v4_mapped_prefix.data(), v4_mapped_prefix.size()) == 0) {
+        inet_ntop(AF_INET, &key.address[v4_mapped_prefix.size()], host, INET6_ADDRSTRLEN);
+    } else {
+        inet_ntop(AF_INET6, key.address.data(), host, INET6_ADDRSTRLEN);
+    }
+}
+
+/* Keys per-source state on the source address alone, in the same table layout as the sessions */
+inline auto make_source_key(const struct sockaddr *addr) -> SessionKey
+{
+    SessionKey key = make_session_key(addr, 0);
+    key.port = 0;
+    return key;
+}
+
+/* Per-session state of the reflector */
+struct Session {
+    uint32_t reflector_seq = 0; // Next sequence number reflected in stateful mode (RFC 5357 4.2.1)
+    uint32_t highest_sender_seq = 0;
+    uint64_t received = 0;
+    uint64_t reflected = 0;
+    uint64_t lost = 0; // Sender sequence numbers skipped and not seen late since
+    uint64_t reordered = 0;
+    uint64_t duplicated = 0;
+    uint64_t last_seen_usec = 0;
+
+    /* Accounts for a test packet carrying the sender's sequence number seq */
+    void recordSenderSeq(uint32_t seq)
+    {
+        received++;
+        if (received == 1) {
+            // Nothing is known about packets sent before the session was first seen
+            highest_sender_seq = seq;
+            return;
+        }
+        // Serial number arithmetic, so the comparison survives the sequence number wrapping around
+        auto distance = (int32_t) (seq - highest_sender_seq);
+        if (distance > 0) {
+            lost += (uint32_t) distance - 1;
+            highest_sender_seq = seq;
+        } else if (distance == 0) {
+            duplicated++;
+        } else {
+            reordered++;
+            if (lost > 0) {
+                lost--;
+            }
+        }
+    }
+};
+
+/* Per-source token bucket: rate tokens per second refill it up to burst, and every packet takes one */
+struct TokenBucket {
+    double tokens = 0;
+    uint64_t last_refill_usec = 0;
+    uint64_t passed = 0;
+    uint64_t dropped = 0;
+
+    auto tryConsume(uint64_t now_usec, double rate, double burst) -> bool
+    {
+        constexpr double MICROSECONDS_PER_SECOND = 1e6;
+        if (now_usec > last_refill_usec) {
+            tokens += (double) (now_usec - last_refill_usec) * rate / MICROSECONDS_PER_SECOND;
+            if (tokens > burst) {
+                tokens = burst;
+            }
+            last_refill_usec = now_usec;
+        }
+        if (tokens >= 1) {
+            tokens -= 1;
+            passed++;
+            return true;
+        }
+        dropped++;
+        return false;
+    }
+};
+#endif // TWAMP_LIGHT_SESSION_H
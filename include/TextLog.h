@@ -0,0 +1,25 @@
+#ifndef TWAMP_LIGHT_TEXT_LOG_H
+#define TWAMP_LIGHT_TEXT_LOG_H
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/* One reflected packet as the text output prints it, with the sequence numbers in host byte order */
+struct MetricData {
+    std::string ip;
+    uint16_t sending_port = 0;
+    uint16_t receiving_port = 0;
+    uint16_t payload_length = 0;
+    int64_t client_server_delay_nanoseconds = 0;
+    int64_t internal_delay_nanoseconds = 0;
+    uint64_t initial_send_time = 0;
+    uint32_t sender_seq_number = 0;
+    uint32_t seq_number = 0;
+    uint8_t sender_ttl = 0;
+    uint8_t sender_tos = 0;
+};
+
+/* The reflector's CSV output, shared by the server and the binary log decoder */
+void write_text_log_header(std::ostream &os, char sep);
+void write_text_log_line(std::ostream &os, const MetricData &data, char sep);
+#endif // TWAMP_LIGHT_TEXT_LOG_H
@@ -0,0 +1,33 @@
+#ifndef TWAMP_LIGHT_WORKER_POOL_H
+#define TWAMP_LIGHT_WORKER_POOL_H
+#include "Server.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/* Runs several reflector loops on the same local port. Every worker owns a SO_REUSEPORT socket,
+ * so the kernel spreads the incoming flows between them, and runs on a thread pinned to its own CPU. */
+class WorkerPool {
+  public:
+    explicit WorkerPool(const Args &args);
+    WorkerPool(const WorkerPool &) = delete;
+    auto operator=(const WorkerPool &) -> WorkerPool & = delete;
+    WorkerPool(WorkerPool &&) = delete;
+    auto operator=(WorkerPool &&) -> WorkerPool & = delete;
+    ~WorkerPool() = default;
+
+    auto run() -> int;
+    void stop();
+    void printCounters() const;
+    [[nodiscard]] auto getServers() const -> std::vector<const Server *>;
+
+  private:
+    Args args;
+    // Shared num_samples budget, so the pool stops after num_samples in total rather than per worker
+    std::atomic<uint32_t> sample_counter{0};
+    std::vector<std::unique_ptr<Server>> servers;
+    std::vector<int> cpus;
+
+    void runWorker(size_t worker_id, int *result);
+};
+#endif // TWAMP_LIGHT_WORKER_POOL_H
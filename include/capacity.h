@@ -0,0 +1,103 @@
+#ifndef TWAMP_LIGHT_CAPACITY_H
+#define TWAMP_LIGHT_CAPACITY_H
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Estimates bottleneck capacity from the dispersion of packet trains.
+ *
+ * A train is train_length packets sent back to back, so the packets of train k have the ids k * train_length
+ * onwards. Past the bottleneck they are spaced by the time it takes to serialize one of them. The capacity of a
+ * direction is therefore the bits of all but the first received packet over the time between the first and the
+ * last arrival. Packets lost inside the train still count, because they were sent between the two.
+ * add() takes the packets of a train in order of id, with an arrival of 0 where the direction has none.
+ */
+class CapacityEstimator {
+  public:
+    /* header_bytes is the UDP and IP overhead added to every payload */
+    CapacityEstimator(uint32_t train_length, uint32_t header_bytes)
+        : train_length(train_length), header_bytes(header_bytes)
+    {
+    }
+
+    void add(uint32_t packet_id, uint16_t payload_len, uint64_t forward_arrival, uint64_t backward_arrival)
+    {
+        uint32_t train = packet_id / train_length;
+        if (train != current_train) {
+            finish();
+            current_train = train;
+        }
+        forward.add(packet_id, payload_len + header_bytes, forward_arrival);
+        backward.add(packet_id, payload_len + header_bytes, backward_arrival);
+    }
+    /* Closes the train in progress; call it after the last packet */
+    void finish()
+    {
+        forward.finish();
+        backward.finish();
+    }
+    /* Bits per second of every train that had two packets arrive in the direction, in train order */
+    [[nodiscard]] auto getForward() const -> const std::vector<double> &
+    {
+        return forward.estimates;
+    }
+    [[nodiscard]] auto getBackward() const -> const std::vector<double> &
+    {
+        return backward.estimates;
+    }
+    /* The median of estimates, or 0 if there are none */
+    static auto median(std::vector<double> estimates) -> double
+    {
+        if (estimates.empty()) {
+            return 0;
+        }
+        auto middle = estimates.begin() + (long) (estimates.size() / 2);
+        std::nth_element(estimates.begin(), middle, estimates.end());
+        return *middle;
+    }
+
+  private:
+    static constexpr double NANOSECONDS_IN_SECOND = 1e9;
+    static constexpr uint32_t BITS_IN_BYTE = 8;
+
+    /* The first and last arrival of the current train in one direction */
+    struct Direction {
+        std::vector<double> estimates;
+        uint32_t first_id = 0;
+        uint32_t last_id = 0;
+        uint64_t first_arrival = 0;
+        uint64_t last_arrival = 0;
+        uint32_t bytes = 0;
+
+        void add(uint32_t id, uint32_t packet_bytes, uint64_t arrival)
+        {
+            if (arrival == 0) {
+                return;
+            }
+            if (first_arrival == 0) {
+                first_id = id;
+                first_arrival = arrival;
+            }
+            last_id = id;
+            last_arrival = arrival;
+            bytes = packet_bytes;
+        }
+        void finish()
+        {
+            if (first_arrival != 0 && last_id > first_id && last_arrival > first_arrival) {
+                double bits = (double) (last_id - first_id) * bytes * BITS_IN_BYTE;
+                estimates.push_back(bits * NANOSECONDS_IN_SECOND / (double) (last_arrival - first_arrival));
+            }
+            first_arrival = 0;
+            last_arrival = 0;
+        }
+    };
+
+    uint32_t train_length;
+    uint32_t header_bytes;
+    uint32_t current_train = 0;
+    Direction forward;
+    Direction backward;
+};
+#endif // TWAMP_LIGHT_CAPACITY_H
@@ -0,0 +1,182 @@
+#ifndef TWAMP_LIGHT_FLAT_HASH_MAP_H
+#define TWAMP_LIGHT_FLAT_HASH_MAP_H
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/* FNV-1a over the raw bytes of a key without padding */
+template <typename Key> struct BytewiseHash {
+    auto operator()(const Key &key) const -> size_t
+    {
+        constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+        constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+        const auto *bytes = reinterpret_cast<const uint8_t *>(&key);
+        uint64_t hash = FNV_OFFSET_BASIS;
+        for (size_t i = 0; i < sizeof(Key); i++) {
+            hash = (hash ^ bytes[i]) * FNV_PRIME;
+        }
+        return (size_t) hash;
+    }
+};
+
+/**
+ * @brief Open-addressed hash map with linear probing, stored in one flat array.
+ *
+ * Lookups touch consecutive slots instead of chasing list nodes, and erasing shifts the following entries
+ * back instead of leaving tombstones, so probe lengths stay short however many entries come and go. The
+ * table doubles once it is half full. Keys are compared with memcmp and must have no padding.
+ */
+template <typename Key, typename Value, typename Hash> class FlatHashMap {
+    static_assert(std::has_unique_object_representations<Key>::value, "FlatHashMap keys are compared bytewise");
+
+  public:
+    explicit FlatHashMap(size_t min_capacity = 16)
+    {
+        size_t capacity = 16;
+        while (capacity < min_capacity) {
+            capacity <<= 1;
+        }
+        slots.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    /* Returns the value stored for key, or nullptr. The pointer is valid until the next insert or erase. */
+    auto find(const Key &key) -> Value *
+    {
+        size_t index = hash(key) & mask;
+        while (slots[index].used) {
+            if (memcmp(&slots[index].key, &key, sizeof(Key)) == 0) {
+                return &slots[index].value;
+            }
+            index = (index + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    /* Returns the value stored for key, adding a value-initialised one first if there is none */
+    auto findOrInsert(const Key &key, bool *inserted = nullptr) -> Value &
+    {
+        if ((count + 1) * 2 > slots.size()) {
+            grow();
+        }
+        size_t index = hash(key) & mask;
+        while (slots[index].used) {
+            if (memcmp(&slots[index].key, &key, sizeof(Key)) == 0) {
+                if (inserted != nullptr) {
+                    *inserted = false;
+                }
+                return slots[index].value;
+            }
+            index = (index + 1) & mask;
+        }
+        slots[index].key = key;
+        slots[index].value = Value{};
+        slots[index].used = true;
+        count++;
+        if (inserted != nullptr) {
+            *inserted = true;
+        }
+        return slots[index].value;
+    }
+
+    auto erase(const Key &key) -> bool
+    {
+        size_t index = hash(key) & mask;
+        while (slots[index].used) {
+            if (memcmp(&slots[index].key, &key, sizeof(Key)) == 0) {
+                eraseAt(index);
+                return true;
+            }
+            index = (index + 1) & mask;
+        }
+        return false;
+    }
+
+    /* Erases every entry for which pred(key, value) is true and returns how many were erased.
+     * pred may see an entry twice when erasing shifts it, so it must not count the entries it keeps. */
+    template <typename Pred> auto eraseIf(Pred pred) -> size_t
+    {
+        size_t erased = 0;
+        size_t index = 0;
+        while (index < slots.size()) {
+            if (slots[index].used && pred(slots[index].key, slots[index].value)) {
+                // The next entry of the cluster may have shifted into this slot, so look at it again
+                eraseAt(index);
+                erased++;
+                continue;
+            }
+            index++;
+        }
+        return erased;
+    }
+
+    template <typename Fn> void forEach(Fn fn)
+    {
+        for (auto &slot : slots) {
+            if (slot.used) {
+                fn(slot.key, slot.value);
+            }
+        }
+    }
+
+    [[nodiscard]] auto size() const -> size_t
+    {
+        return count;
+    }
+
+    [[nodiscard]] auto capacity() const -> size_t
+    {
+        return slots.size();
+    }
+
+  private:
+    struct Slot {
+        Key key{};
+        Value value{};
+        bool used = false;
+    };
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t count = 0;
+    Hash hash;
+
+    /* Backward shift deletion: pull later entries of the cluster into the hole if that keeps them reachable */
+    void eraseAt(size_t hole)
+    {
+        size_t index = hole;
+        while (true) {
+            index = (index + 1) & mask;
+            if (!slots[index].used) {
+                break;
+            }
+            size_t home = hash(slots[index].key) & mask;
+            // The entry may move into the hole only if its home slot is not between the hole and itself
+            if (((index - home) & mask) >= ((index - hole) & mask)) {
+                slots[hole] = slots[index];
+                hole = index;
+            }
+        }
+        slots[hole].used = false;
+        count--;
+    }
+
+    void grow()
+    {
+        std::vector<Slot> old_slots(slots.size() * 2);
+        old_slots.swap(slots);
+        mask = slots.size() - 1;
+        for (auto &slot : old_slots) {
+            if (!slot.used) {
+                continue;
+            }
+            size_t index = hash(slot.key) & mask;
+            while (slots[index].used) {
+                index = (index + 1) & mask;
+            }
+            slots[index] = slot;
+        }
+    }
+};
+#endif // TWAMP_LIGHT_FLAT_HASH_MAP_H
@@ -0,0 +1,200 @@
+#ifndef TWAMP_LIGHT_METRICS_H
+#define TWAMP_LIGHT_METRICS_H
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+/**
+ * @brief Counter written by one thread and read by any number of others.
+ *
+ * With a single writer an increment needs no read-modify-write instruction: a relaxed load and store keep the
+ * data path free of locked instructions, and readers still never see a torn value.
+ */
+class RelaxedCounter {
+  public:
+    RelaxedCounter() = default;
+    RelaxedCounter(const RelaxedCounter &other) : value(other.load()) {}
+    auto operator=(const RelaxedCounter &other) -> RelaxedCounter &
+    {
+        value.store(other.load(), std::memory_order_relaxed);
+        return *this;
+    }
+    ~RelaxedCounter() = default;
+
+    auto operator+=(uint64_t amount) -> RelaxedCounter &
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        return *this;
+    }
+    auto operator++() -> RelaxedCounter &
+    {
+        return *this += 1;
+    }
+    void operator++(int)
+    {
+        *this += 1;
+    }
+    [[nodiscard]] auto load() const -> uint64_t
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+    operator uint64_t() const // NOLINT(google-explicit-constructor): reads like the plain counter it replaces
+    {
+        return load();
+    }
+
+  private:
+    std::atomic<uint64_t> value{0};
+};
+
+/**
+ * @brief Paces reads of a packet property that costs a system call, such as SO_INCOMING_CPU.
+ *
+ * A sample is due once every interval packets, and once more at the end for the packets left over. Each sample is
+ * one reading of the latest packet, not a count of the packets it stands for.
+ */
+class PacketSampler {
+  public:
+    explicit PacketSampler(size_t interval) : interval(interval) {}
+
+    /* Counts packets; returns true when a sample is due */
+    auto count(size_t packets) -> bool
+    {
+        unsampled += packets;
+        if (unsampled < interval) {
+            return false;
+        }
+        unsampled = 0;
+        return true;
+    }
+    /* Returns true when packets were counted since the last sample, for a last one at the end */
+    auto finish() -> bool
+    {
+        bool due = unsampled > 0;
+        unsampled = 0;
+        return due;
+    }
+
+  private:
+    size_t interval;
+    size_t unsampled = 0;
+};
+
+// Upper bounds of the internal delay buckets in nanoseconds, from 1 us to 10 ms
+constexpr std::array<uint64_t, 13> DELAY_BUCKET_BOUNDS_NSEC = {1000,    2000,    5000,    10000,   20000,
+                                                                50000,   100000,  200000,  500000,  1000000,
+                                                                2000000, 5000000, 10000000};
+
+/* Histogram of the reflector's internal delay with the same single-writer counters */
+struct DelayHistogram {
+    // One count per bound, plus the delays above the last one
+    std::array<RelaxedCounter, DELAY_BUCKET_BOUNDS_NSEC.size() + 1> buckets;
+    RelaxedCounter sum_nanoseconds;
+
+    void observe(int64_t delay_nanoseconds)
+    {
+        // A clock step between the two timestamps can make the delay negative
+        uint64_t delay = delay_nanoseconds < 0 ? 0 : (uint64_t) delay_nanoseconds;
+        size_t bucket = 0;
+        while (bucket < DELAY_BUCKET_BOUNDS_NSEC.size() && delay > DELAY_BUCKET_BOUNDS_NSEC[bucket]) {
+            bucket++;
+        }
+        buckets[bucket]++;
+        sum_nanoseconds += delay;
+    }
+
+    [[nodiscard]] auto count() const -> uint64_t
+    {
+        uint64_t total = 0;
+        for (const auto &bucket : buckets) {
+            total += bucket;
+        }
+        return total;
+    }
+
+    /* Upper bound of the bucket holding the given quantile of the delays, UINT64_MAX when above the last bound */
+    [[nodiscard]] auto quantileBound(double quantile) const -> uint64_t
+    {
+        auto rank = (uint64_t) std::ceil(quantile * (double) count());
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < DELAY_BUCKET_BOUNDS_NSEC.size(); i++) {
+            cumulative += buckets[i];
+            if (cumulative >= rank) {
+                return DELAY_BUCKET_BOUNDS_NSEC[i];
+            }
+        }
+        return UINT64_MAX;
+    }
+
+    auto operator+=(const DelayHistogram &other) -> DelayHistogram &
+    {
+        for (size_t i = 0; i < buckets.size(); i++) {
+            buckets[i] += other.buckets[i];
+        }
+        sum_nanoseconds += other.sum_nanoseconds;
+        return *this;
+    }
+};
+
+/* Writes the summary line and the bucket counts of a histogram, each line starting with name */
+inline void write_delay_histogram(std::ostream &os, const DelayHistogram &histogram, const std::string &name)
+{
+    constexpr uint64_t NANOSECONDS_IN_MICROSECOND = 1000;
+    uint64_t count = histogram.count();
+    os << name << " of " << count << " packets";
+    if (count == 0) {
+        os << std::endl;
+        return;
+    }
+    auto format_bound = [](uint64_t bound) {
+        if (bound == UINT64_MAX) {
+            return "> " + std::to_string(DELAY_BUCKET_BOUNDS_NSEC.back() / NANOSECONDS_IN_MICROSECOND) + " us";
+        }
+        return "<= " + std::to_string(bound / NANOSECONDS_IN_MICROSECOND) + " us";
+    };
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os << ": mean " << std::fixed << std::setprecision(2)
+       << (double) histogram.sum_nanoseconds / (double) count / (double) NANOSECONDS_IN_MICROSECOND << " us, p50 "
+       << format_bound(histogram.quantileBound(0.5)) << ", p99 " << format_bound(histogram.quantileBound(0.99))
+       << ", p99.9 " << format_bound(histogram.quantileBound(0.999)) << std::endl;
+    os.flags(flags);
+    os.precision(precision);
+    os << name << " buckets:";
+    for (size_t i = 0; i < histogram.buckets.size(); i++) {
+        uint64_t bound = i < DELAY_BUCKET_BOUNDS_NSEC.size() ? DELAY_BUCKET_BOUNDS_NSEC[i] : UINT64_MAX;
+        os << (i == 0 ? " " : ", ") << format_bound(bound) << ": " << histogram.buckets[i];
+    }
+    os << std::endl;
+}
+
+/* Appends one metric in the Prometheus text exposition format */
+inline void write_prometheus_counter(std::ostream &os, const char *name, const char *help, uint64_t value)
+{
+    os << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n" << name << " " << value << "\n";
+}
+
+inline void write_prometheus_histogram(std::ostream &os, const char *name, const char *help,
+                                       const DelayHistogram &histogram)
+{
+    constexpr double NANOSECONDS_IN_SECOND = 1e9;
+    os << "# HELP " << name << " " << help << "\n# TYPE " << name << " histogram\n";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < DELAY_BUCKET_BOUNDS_NSEC.size(); i++) {
+        cumulative += histogram.buckets[i];
+        // Every bound is a whole number of microseconds, so six decimals print it exactly
+        os << name << "_bucket{le=\"" << std::fixed << std::setprecision(6)
+           << (double) DELAY_BUCKET_BOUNDS_NSEC[i] / NANOSECONDS_IN_SECOND << "\"} " << cumulative << "\n";
+    }
+    cumulative += histogram.buckets.back();
+    os << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+    os << name << "_sum " << std::setprecision(9) << (double) histogram.sum_nanoseconds / NANOSECONDS_IN_SECOND
+       << "\n";
+    os << name << "_count " << cumulative << "\n";
+}
+#endif // TWAMP_LIGHT_METRICS_H
@@ -0,0 +1,104 @@
+#ifndef TWAMP_LIGHT_PACER_H
+#define TWAMP_LIGHT_PACER_H
+#include "metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+
+// The pacer sleeps until this long before a deadline and spins the rest, which sleep wake-up latency would overshoot
+constexpr uint64_t PACER_SPIN_NANOSECONDS = 100000;
+// A pacer this far behind its schedule (e.g. after the process was stopped) starts a new one instead of catching up
+constexpr uint64_t PACER_MAX_LAG_NANOSECONDS = 1000000000;
+
+inline auto monotonic_nanoseconds() -> uint64_t
+{
+    constexpr uint64_t NANOSECONDS_IN_SECOND = 1000000000;
+    struct timespec now {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NANOSECONDS_IN_SECOND + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * @brief Paces sends on absolute CLOCK_MONOTONIC deadlines.
+ *
+ * Each deadline is the previous deadline plus the gap, never the previous wake-up plus the gap, so oversleeping
+ * and the time spent sending delay one packet without shifting the ones after it. The achieved rate therefore
+ * follows the drawn gaps. The lateness of every wake-up is kept in a histogram.
+ */
+class Pacer {
+  public:
+    explicit Pacer(uint64_t spin_nanoseconds = PACER_SPIN_NANOSECONDS) : spin_nanoseconds(spin_nanoseconds) {}
+
+    /* Waits until gap_nanoseconds after the previous deadline, or after now for the first call. Returns how late
+     * the wake-up was. A lead wakes up that long before the deadline, for a caller that hands the deadline on to
+     * something that keeps it more precisely, such as SO_TXTIME. */
+    auto wait(uint64_t gap_nanoseconds, uint64_t lead_nanoseconds = 0) -> int64_t
+    {
+        uint64_t now = monotonic_nanoseconds();
+        if (waits == 0 || now > deadline + PACER_MAX_LAG_NANOSECONDS) {
+            deadline = now;
+            schedule_restarts += waits == 0 ? 0 : 1;
+        }
+        deadline += gap_nanoseconds;
+        if (waits > 0) {
+            scheduled_span += gap_nanoseconds;
+        }
+        uint64_t wake = deadline - std::min(lead_nanoseconds, deadline);
+        if (wake > now + spin_nanoseconds) {
+            struct timespec sleep_until = {(time_t) ((wake - spin_nanoseconds) / NANOSECONDS_IN_SECOND),
+                                           (long) ((wake - spin_nanoseconds) % NANOSECONDS_IN_SECOND)};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sleep_until, nullptr) == EINTR) {
+            }
+        }
+        while ((now = monotonic_nanoseconds()) < wake) {
+        }
+        auto lateness = (int64_t) (now - wake);
+        schedule_errors.observe(lateness);
+        if (waits == 0) {
+            first_wake = now;
+        }
+        last_wake = now;
+        waits++;
+        return lateness;
+    }
+
+    /* The CLOCK_MONOTONIC deadline of the last wait, in nanoseconds */
+    [[nodiscard]] auto getDeadline() const -> uint64_t
+    {
+        return deadline;
+    }
+    [[nodiscard]] auto getScheduleErrors() const -> const DelayHistogram &
+    {
+        return schedule_errors;
+    }
+    /* Wake-ups per second between the first and the last one, 0 before there are two */
+    [[nodiscard]] auto achievedRate() const -> double
+    {
+        return waits < 2 || last_wake == first_wake
+                   ? 0
+                   : (double) (waits - 1) * NANOSECONDS_IN_SECOND / (double) (last_wake - first_wake);
+    }
+    /* Deadlines per second of the schedule the wake-ups were meant to follow */
+    [[nodiscard]] auto scheduledRate() const -> double
+    {
+        return waits < 2 || scheduled_span == 0 ? 0
+                                                : (double) (waits - 1) * NANOSECONDS_IN_SECOND / (double) scheduled_span;
+    }
+    [[nodiscard]] auto getScheduleRestarts() const -> uint64_t
+    {
+        return schedule_restarts;
+    }
+
+  private:
+    static constexpr uint64_t NANOSECONDS_IN_SECOND = 1000000000;
+    uint64_t spin_nanoseconds;
+    uint64_t deadline = 0;
+    uint64_t scheduled_span = 0; // Sum of the gaps between the first deadline and the last
+    uint64_t first_wake = 0;
+    uint64_t last_wake = 0;
+    uint64_t waits = 0;
+    uint64_t schedule_restarts = 0;
+    DelayHistogram schedule_errors;
+};
+#endif // TWAMP_LIGHT_PACER_H
@@ -1,18 +1,23 @@
-#include <condition_variable>
+#ifndef TWAMP_LIGHT_PACKETLIST_H
+#define TWAMP_LIGHT_PACKETLIST_H
+#include "ring_buffer.h"
+#include <algorithm>
 #include <cstdint>
-#include <deque>
-#include <memory>
+#include <type_traits>
+#include <vector>
 
 enum class ObservationPoints { CLIENT_SEND, SERVER_RECEIVE, SERVER_SEND, CLIENT_RECEIVE, NUM_OBSERVATION_POINTS };
 
+/* One timestamp of one packet. Plain data, so it is passed by value through the observation rings. */
 class QEDObservation {
   private:
-    ObservationPoints observation_point;
-    uint64_t epoch_nanoseconds;
-    uint32_t packet_id;
-    uint16_t payload_len;
+    ObservationPoints observation_point = ObservationPoints::CLIENT_SEND;
+    uint64_t epoch_nanoseconds = 0;
+    uint32_t packet_id = 0;
+    uint16_t payload_len = 0;
 
   public:
+    QEDObservation() = default;
     QEDObservation(ObservationPoints observation_point,
                    uint64_t epoch_nanoseconds,
                    uint32_t packet_id,
@@ -40,60 +45,76 @@ class QEDObservation {
     }
 };
 
-class ObservationList {
-  private:
-    std::deque<std::shared_ptr<QEDObservation>> observations;
-    std::mutex mutex;
+static_assert(std::is_trivially_copyable<QEDObservation>::value, "Observations are copied through the rings");
 
+/**
+ * @brief Carries the observations of the sender and the receiver threads to the collator.
+ *
+ * Each producer has its own SpscRing, so adding an observation takes no lock, allocation or reference count. The
+ * collator needs a packet's send before any reply to a later packet, or the collation table would take the earlier
+ * packet as already done. A reply only exists once every earlier packet was sent, so popBatch takes a batch of
+ * replies first and then drains the sends before handing the replies out.
+ */
+class ObservationQueue {
   public:
-    ObservationList() = default;
-    ~ObservationList() = default;
-    ObservationList(const ObservationList &) = delete;
-    auto operator=(const ObservationList &) -> ObservationList & = delete;
-    ObservationList(ObservationList &&) = delete;
-    auto operator=(ObservationList &&) -> ObservationList & = delete;
-
-    [[nodiscard]] auto getObservations() const -> const std::deque<std::shared_ptr<QEDObservation>> &
+    explicit ObservationQueue(size_t capacity)
+        : sent(capacity), received(capacity), pending(std::min(capacity, PENDING_BATCH_SIZE))
     {
-        return observations;
     }
+    ~ObservationQueue() = default;
+    ObservationQueue(const ObservationQueue &) = delete;
+    auto operator=(const ObservationQueue &) -> ObservationQueue & = delete;
+    ObservationQueue(ObservationQueue &&) = delete;
+    auto operator=(ObservationQueue &&) -> ObservationQueue & = delete;
 
-    [[nodiscard]] auto isEmpty() const -> bool
+    /* Sender thread side. Returns false if the ring is full. */
+    auto tryPushSent(const QEDObservation &observation) -> bool
     {
-        return observations.empty();
+        return sent.tryPush(observation);
     }
-    void addObservation(const std::shared_ptr<QEDObservation> &observation)
+    /* Receiver thread side. Returns false if the ring is full. */
+    auto tryPushReceived(const QEDObservation &observation) -> bool
     {
-        std::unique_lock<std::mutex> lock(mutex);
-        observations.push_back(observation);
+        return received.tryPush(observation);
     }
 
-    auto popObservation() -> std::shared_ptr<QEDObservation>
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-        auto observation = observations.front();
-        observations.pop_front();
-        return observation;
-    }
-    [[nodiscard]] auto getOldestEntry() -> std::shared_ptr<QEDObservation>
+    /* Collator side. Moves up to max_observations into out and returns how many were taken. */
+    auto popBatch(QEDObservation *out, size_t max_observations) -> size_t
     {
-        std::unique_lock<std::mutex> lock(mutex);
-        if (observations.empty()) {
-            return nullptr;
+        if (pending_taken == pending_count) {
+            pending_count = received.popBatch(pending.data(), pending.size());
+            pending_taken = 0;
         }
-        return observations.front();
-    }
-    [[nodiscard]] auto getSize() -> size_t
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-        return observations.size();
+        size_t count = sent.popBatch(out, max_observations);
+        if (count == max_observations) {
+            // Sends from before the pending replies may still be queued
+            return count;
+        }
+        size_t replies = std::min(max_observations - count, pending_count - pending_taken);
+        std::copy_n(pending.begin() + (long) pending_taken, replies, out + count);
+        pending_taken += replies;
+        return count + replies;
     }
-    [[nodiscard]] auto begin() -> decltype(observations.begin())
+
+    /* Collator side. Whether popBatch would come back empty. */
+    [[nodiscard]] auto empty() const -> bool
     {
-        return observations.begin();
+        return pending_taken == pending_count && sent.empty() && received.empty();
     }
-    [[nodiscard]] auto end() -> decltype(observations.end())
+
+    [[nodiscard]] auto capacity() const -> size_t
     {
-        return observations.end();
+        return sent.capacity();
     }
-};
\ No newline at end of file
+
+  private:
+    static constexpr size_t PENDING_BATCH_SIZE = 256;
+
+    SpscRing<QEDObservation> sent;
+    SpscRing<QEDObservation> received;
+    // Used by the collator only: replies taken from the ring but not yet handed out
+    std::vector<QEDObservation> pending;
+    size_t pending_count = 0;
+    size_t pending_taken = 0;
+};
+#endif // TWAMP_LIGHT_PACKETLIST_H
@@ -0,0 +1,42 @@
+#ifndef TWAMP_LIGHT_REFLECT_H
+#define TWAMP_LIGHT_REFLECT_H
+#include "packets.h"
+#include "utils.hpp"
+#include <arpa/inet.h>
+#include <cstddef>
+
+constexpr uint16_t ERROR_ESTIMATE_DEFAULT_BITMAP = 0x8001; // Sync = 1, Multiplier = 1
+
+// The reflector header starts with the sender's fields at the same offsets, which reflect_in_place relies on
+static_assert(sizeof(ClientPacket) == sizeof(ReflectorPacket), "Test packets are reflected in the same buffer");
+static_assert(offsetof(ClientPacket, seq_number) == offsetof(ReflectorPacket, seq_number));
+static_assert(offsetof(ClientPacket, timestamp) == offsetof(ReflectorPacket, timestamp));
+static_assert(offsetof(ClientPacket, timestamp_error_estimate) == offsetof(ReflectorPacket, timestamp_error_estimate));
+
+/**
+ * @brief Turns the Session-Sender packet received into packet into the Session-Reflector reply (RFC 5357 4.2.1).
+ *
+ * The sender's fields are read out before the reflector header overlays them. The bytes after the reflector
+ * header are sent back as the sender sent them, so nothing beyond the 42 header bytes is written or copied.
+ * The reflector sequence number is left equal to the sender's, as a stateless reflector does.
+ */
+inline void reflect_in_place(ReflectorPacket *packet, const Timestamp &receive_timestamp, const IPHeader &ip_header)
+{
+    uint32_t sender_seq_number = packet->seq_number;
+    Timestamp sender_timestamp = packet->timestamp;
+    uint16_t sender_error_estimate = packet->timestamp_error_estimate;
+
+    packet->sender_seq_number = sender_seq_number;
+    packet->sender_timestamp = sender_timestamp;
+    packet->sender_error_estimate = sender_error_estimate;
+    packet->sender_ttl = ip_header.ttl;
+    packet->sender_tos = ip_header.tos;
+    // These overlay the sender's padding, which need not be zero
+    packet->mbz1 = {};
+    packet->mbz2 = {};
+    packet->receive_timestamp = htonts(receive_timestamp);
+    packet->timestamp_error_estimate = htons(ERROR_ESTIMATE_DEFAULT_BITMAP);
+    // Taken last, as close to the send as possible
+    packet->timestamp = htonts(get_timestamp());
+}
+#endif // TWAMP_LIGHT_REFLECT_H
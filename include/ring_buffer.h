@@ -0,0 +1,89 @@
+#ifndef TWAMP_LIGHT_RING_BUFFER_H
+#define TWAMP_LIGHT_RING_BUFFER_H
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * @brief Bounded lock-free queue for exactly one producer thread and one consumer thread.
+ *
+ * The capacity is rounded up to a power of two. Pushing never blocks or allocates, so it can be done from a
+ * packet loop: when the queue is full the element is rejected and the producer decides what to drop.
+ */
+template <typename T> class SpscRing {
+    static_assert(std::is_trivially_copyable<T>::value, "SpscRing elements are copied with plain stores");
+
+  public:
+    explicit SpscRing(size_t min_capacity)
+    {
+        size_t capacity = 1;
+        while (capacity < min_capacity) {
+            capacity <<= 1;
+        }
+        slots.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    /* Producer side. Returns false if the queue is full. */
+    auto tryPush(const T &item) -> bool
+    {
+        size_t tail = write_index.load(std::memory_order_relaxed);
+        if (tail - cached_read_index > mask) {
+            cached_read_index = read_index.load(std::memory_order_acquire);
+            if (tail - cached_read_index > mask) {
+                return false;
+            }
+        }
+        slots[tail & mask] = item;
+        write_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Consumer side. Moves up to max_items into out and returns how many were taken. */
+    auto popBatch(T *out, size_t max_items) -> size_t
+    {
+        size_t head = read_index.load(std::memory_order_relaxed);
+        if (cached_write_index == head) {
+            cached_write_index = write_index.load(std::memory_order_acquire);
+        }
+        size_t count = cached_write_index - head;
+        if (count > max_items) {
+            count = max_items;
+        }
+        for (size_t i = 0; i < count; i++) {
+            out[i] = slots[(head + i) & mask];
+        }
+        read_index.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    auto tryPop(T &item) -> bool
+    {
+        return popBatch(&item, 1) == 1;
+    }
+
+    /* Consumer side. Whether there is nothing left to pop. */
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return read_index.load(std::memory_order_relaxed) == write_index.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] auto capacity() const -> size_t
+    {
+        return mask + 1;
+    }
+
+  private:
+    std::vector<T> slots;
+    size_t mask = 0;
+    // Each side keeps its own index and a stale copy of the other one on separate cache lines,
+    // so the shared indices are only read when the cached copy says the queue looks full or empty.
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> write_index{0};
+    size_t cached_read_index = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> read_index{0};
+    size_t cached_write_index = 0;
+};
+#endif // TWAMP_LIGHT_RING_BUFFER_H
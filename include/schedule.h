@@ -0,0 +1,139 @@
+#ifndef TWAMP_LIGHT_SCHEDULE_H
+#define TWAMP_LIGHT_SCHEDULE_H
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Entries the schedule keeps drawn ahead of the sender, and how many it draws at a time
+constexpr size_t SCHEDULE_RING_SIZE = 1024;
+constexpr size_t SCHEDULE_BATCH_SIZE = 256;
+// Longest gap drawn from the exponential distribution
+constexpr uint64_t SCHEDULE_MAX_GAP_NANOSECONDS = 10000000000;
+
+/**
+ * @brief xoshiro256** pseudo-random generator, seeded through splitmix64.
+ *
+ * A few shifts and multiplies per draw and 32 bytes of state, so every session can have its own. Not suitable
+ * for anything that needs to be unpredictable.
+ */
+class Xoshiro256 {
+  public:
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(uint64_t seed)
+    {
+        for (auto &word : state) {
+            seed += 0x9e3779b97f4a7c15;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    auto operator()() -> uint64_t
+    {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+    /* Uniform in [0, 1), from the top 53 bits */
+    auto uniform() -> double
+    {
+        constexpr double TWO_TO_MINUS_53 = 1.0 / 9007199254740992.0;
+        return (double) ((*this)() >> 11) * TWO_TO_MINUS_53;
+    }
+    /* Uniform in [0, n), by multiplying instead of dividing */
+    auto below(uint32_t n) -> uint32_t
+    {
+        return (uint32_t) (((*this)() >> 32) * n >> 32);
+    }
+    static constexpr auto min() -> uint64_t
+    {
+        return 0;
+    }
+    static constexpr auto max() -> uint64_t
+    {
+        return UINT64_MAX;
+    }
+
+  private:
+    std::array<uint64_t, 4> state{};
+    static auto rotl(uint64_t x, int k) -> uint64_t
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+struct ScheduledProbe {
+    uint64_t gap_nanoseconds; // From the previous probe's deadline
+    uint16_t payload_len;
+};
+
+/**
+ * @brief The gaps and payload lengths of a session's probes, drawn ahead of the send loop.
+ *
+ * Gaps are exponential with the given mean (a Poisson process), or all equal to it. Payload lengths are picked
+ * uniformly from the list. A non-zero seed gives the same schedule on every run. Entries are drawn a batch at a
+ * time into a ring, so taking one is a load and an increment; refill() tops the ring up and is meant for the
+ * slack after a send.
+ */
+class ProbeSchedule {
+  public:
+    ProbeSchedule(uint64_t mean_gap_nanoseconds,
+                  bool constant_gaps,
+                  std::vector<uint16_t> payload_lens,
+                  uint32_t seed)
+        : mean_gap_nanoseconds(mean_gap_nanoseconds), constant_gaps(constant_gaps),
+          payload_lens(std::move(payload_lens)), generator(seed != 0 ? seed : std::random_device{}())
+    {
+        refill();
+    }
+
+    auto next() -> ScheduledProbe
+    {
+        if (taken == drawn) {
+            refill();
+        }
+        return ring[taken++ % SCHEDULE_RING_SIZE];
+    }
+    /* Draws whole batches while at least one fits in the ring */
+    void refill()
+    {
+        while (drawn - taken + SCHEDULE_BATCH_SIZE <= SCHEDULE_RING_SIZE) {
+            for (size_t i = 0; i < SCHEDULE_BATCH_SIZE; i++) {
+                ring[drawn++ % SCHEDULE_RING_SIZE] = draw();
+            }
+        }
+    }
+
+  private:
+    uint64_t mean_gap_nanoseconds;
+    bool constant_gaps;
+    std::vector<uint16_t> payload_lens;
+    Xoshiro256 generator;
+    std::array<ScheduledProbe, SCHEDULE_RING_SIZE> ring{};
+    uint64_t drawn = 0;
+    uint64_t taken = 0;
+
+    auto draw() -> ScheduledProbe
+    {
+        ScheduledProbe probe{mean_gap_nanoseconds, payload_lens[generator.below((uint32_t) payload_lens.size())]};
+        if (!constant_gaps) {
+            double gap = -std::log1p(-generator.uniform()) * (double) mean_gap_nanoseconds;
+            probe.gap_nanoseconds = gap < (double) SCHEDULE_MAX_GAP_NANOSECONDS ? (uint64_t) gap
+                                                                               : SCHEDULE_MAX_GAP_NANOSECONDS;
+        }
+        return probe;
+    }
+};
+#endif // TWAMP_LIGHT_SCHEDULE_H
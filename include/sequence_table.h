@@ -0,0 +1,167 @@
+#ifndef TWAMP_LIGHT_SEQUENCE_TABLE_H
+#define TWAMP_LIGHT_SEQUENCE_TABLE_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Table of the packets in flight, indexed by sequence number.
+ *
+ * Entries live in a ring of preallocated slots at seq modulo the capacity, so finding, adding and releasing one is
+ * O(1). Entries are released oldest first, in sequence order, from the head of the ring. Distances from the head are
+ * taken modulo 2^32, so the table keeps working when the 32-bit sequence number wraps around. A sequence number up
+ * to 2^31 behind the head has already been released and is not taken back.
+ * The ring doubles when a sequence number falls beyond it, so a low capacity estimate costs a copy but never an entry.
+ * It never grows past max_capacity: a sequence number that far ahead of the head is taken for a stray and not added.
+ * Not thread-safe: the table belongs to the collator.
+ */
+template <typename T> class SequenceTable {
+  public:
+    SequenceTable(size_t min_capacity, size_t max_capacity)
+    {
+        size_t capacity = 1;
+        while (capacity < min_capacity) {
+            capacity <<= 1;
+        }
+        slots.resize(capacity);
+        mask = capacity - 1;
+        max_slots = capacity;
+        while (max_slots < max_capacity) {
+            max_slots <<= 1;
+        }
+    }
+
+    /* The entry of seq, or nullptr if it is not held */
+    auto find(uint32_t seq) -> T *
+    {
+        if (count == 0 || distance(seq) >= span) {
+            return nullptr;
+        }
+        Slot &slot = slots[seq & mask];
+        return slot.used && slot.seq == seq ? &slot.value : nullptr;
+    }
+
+    /* The entry of seq, value-initialised and flagged through inserted if it is new. nullptr if seq was released, or
+     * is too far ahead to fit in max_capacity. */
+    auto findOrInsert(uint32_t seq, bool &inserted) -> T *
+    {
+        inserted = false;
+        if (!started) {
+            started = true;
+            head = seq;
+        }
+        uint32_t offset = distance(seq);
+        if (offset >= HALF_SEQUENCE_SPACE) {
+            return nullptr;
+        }
+        if (count == 0) {
+            // Nothing is held, so the head moves up instead of the ring growing over the gap
+            head = seq;
+            span = 0;
+            offset = 0;
+        }
+        if (offset >= max_slots) {
+            return nullptr;
+        }
+        if (offset >= slots.size()) {
+            grow(offset);
+        }
+        Slot &slot = slots[seq & mask];
+        if (slot.used) {
+            return &slot.value;
+        }
+        slot.value = T{};
+        slot.seq = seq;
+        slot.used = true;
+        count++;
+        if (offset >= span) {
+            span = offset + 1;
+        }
+        inserted = true;
+        return &slot.value;
+    }
+
+    /* The entry with the lowest sequence number, or nullptr if the table is empty */
+    auto oldest() -> T *
+    {
+        if (count == 0) {
+            return nullptr;
+        }
+        // Sequence numbers that were never added leave holes, which are skipped
+        while (!slots[head & mask].used) {
+            advance();
+        }
+        return &slots[head & mask].value;
+    }
+
+    /* Releases the entry returned by oldest() */
+    void popOldest()
+    {
+        if (oldest() == nullptr) {
+            return;
+        }
+        slots[head & mask].used = false;
+        count--;
+        advance();
+    }
+
+    [[nodiscard]] auto size() const -> size_t
+    {
+        return count;
+    }
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return count == 0;
+    }
+    [[nodiscard]] auto capacity() const -> size_t
+    {
+        return slots.size();
+    }
+
+  private:
+    static constexpr uint32_t HALF_SEQUENCE_SPACE = 1U << 31;
+
+    struct Slot {
+        T value{};
+        uint32_t seq = 0;
+        bool used = false;
+    };
+
+    [[nodiscard]] auto distance(uint32_t seq) const -> uint32_t
+    {
+        return seq - head;
+    }
+
+    void advance()
+    {
+        head++;
+        span--;
+    }
+
+    /* Doubles the ring until offset fits, moving every entry to its slot in the new ring */
+    void grow(uint32_t offset)
+    {
+        size_t capacity = slots.size();
+        while (capacity <= offset) {
+            capacity <<= 1;
+        }
+        std::vector<Slot> grown(capacity);
+        for (uint32_t i = 0; i < span; i++) {
+            Slot &slot = slots[(head + i) & mask];
+            if (slot.used) {
+                grown[(head + i) & (capacity - 1)] = std::move(slot);
+            }
+        }
+        slots = std::move(grown);
+        mask = capacity - 1;
+    }
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t max_slots = 0;
+    bool started = false;
+    uint32_t head = 0;  // The lowest sequence number that may still be held
+    uint32_t span = 0;  // One past the highest held sequence number, counted from head
+    size_t count = 0;
+};
+#endif // TWAMP_LIGHT_SEQUENCE_TABLE_H
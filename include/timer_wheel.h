@@ -0,0 +1,157 @@
+#ifndef TWAMP_LIGHT_TIMER_WHEEL_H
+#define TWAMP_LIGHT_TIMER_WHEEL_H
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Hierarchical timer wheel, for timers that mostly expire a bounded time after they are set.
+ *
+ * Time is counted in ticks of tick_nanoseconds. The first level has a slot for each of the next 256 ticks, and
+ * every further level has a slot for each of the next 256 blocks of the level below it, so four levels reach 2^32
+ * ticks ahead. Setting a timer appends it to one slot. When time enters a block of a higher level, the timers of
+ * that block move down a level, and those of the first level fire when their tick is reached. Each timer is moved
+ * at most once per level, so the cost per timer stays constant however many are pending.
+ * A timer never fires before its expiry, and at most one tick after it once advance() is called.
+ * Timers are not cancelled: the caller ignores a timer whose subject has gone when it fires.
+ * Not thread-safe: the wheel belongs to the collator.
+ */
+template <typename T> class TimerWheel {
+  public:
+    TimerWheel(uint64_t tick_nanoseconds, uint64_t now_nanoseconds)
+        : tick_nanoseconds(tick_nanoseconds), current_tick(now_nanoseconds / tick_nanoseconds)
+    {
+    }
+
+    /* Sets a timer for expiry_nanoseconds, on the same clock as the times passed to advance() */
+    void schedule(uint64_t expiry_nanoseconds, const T &value)
+    {
+        // Rounded up, so the timer cannot fire early
+        uint64_t tick = (expiry_nanoseconds + tick_nanoseconds - 1) / tick_nanoseconds;
+        place(Timer{tick, value});
+        count++;
+    }
+
+    /* Fires every timer that has expired by now_nanoseconds, calling fire(value) for each in order of expiry tick.
+     * fire may set new timers. */
+    template <typename Func> void advance(uint64_t now_nanoseconds, Func fire)
+    {
+        uint64_t now_tick = now_nanoseconds / tick_nanoseconds;
+        while (current_tick <= now_tick) {
+            // Higher levels first, as their timers may land in the lower blocks that start at this tick
+            for (size_t level = LEVELS - 1; level > 0; level--) {
+                if ((current_tick & (levelSpan(level) - 1)) == 0) {
+                    cascade(level);
+                }
+            }
+            std::vector<Timer> &slot = slots[0][current_tick & SLOT_MASK];
+            current_tick++;
+            if (!slot.empty()) {
+                firing.swap(slot);
+                count -= firing.size();
+                for (const Timer &timer : firing) {
+                    fire(timer.value);
+                }
+                firing.clear();
+            } else {
+                // Nothing fires or moves down before the next tick with work, so the ticks up to it are skipped
+                current_tick = std::min(nextTick(), now_tick + 1);
+            }
+        }
+    }
+
+    /* A time at or before the earliest expiry, or 0 if no timer is set. It is the exact tick of the earliest timer
+     * when that one is due within the next 256 ticks, and otherwise the time its block moves down a level. */
+    [[nodiscard]] auto nextExpiry() const -> uint64_t
+    {
+        return count == 0 ? 0 : nextTick() * tick_nanoseconds;
+    }
+
+    [[nodiscard]] auto size() const -> size_t
+    {
+        return count;
+    }
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return count == 0;
+    }
+
+  private:
+    static constexpr size_t LEVELS = 4;
+    static constexpr uint64_t SLOT_BITS = 8;
+    static constexpr uint64_t SLOTS = 1 << SLOT_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+
+    struct Timer {
+        uint64_t tick;
+        T value;
+    };
+
+    /* Ticks covered by one slot of the level */
+    static constexpr auto levelSpan(size_t level) -> uint64_t
+    {
+        return (uint64_t) 1 << (level * SLOT_BITS);
+    }
+
+    /* The next tick at which a timer fires or a block moves down, or UINT64_MAX if no timer is set */
+    [[nodiscard]] auto nextTick() const -> uint64_t
+    {
+        uint64_t earliest = UINT64_MAX;
+        if (count == 0) {
+            return earliest;
+        }
+        for (size_t level = 0; level < LEVELS; level++) {
+            uint64_t block = current_tick >> (level * SLOT_BITS);
+            // Once time is past the start of the current block, that block has moved down and its slot belongs to
+            // the next rotation
+            bool moved_down = level > 0 && (current_tick & (levelSpan(level) - 1)) != 0;
+            for (uint64_t step = moved_down ? 1 : 0; step <= SLOTS; step++) {
+                if (!slots[level][(block + step) & SLOT_MASK].empty()) {
+                    earliest = std::min(earliest, (block + step) << (level * SLOT_BITS));
+                    break;
+                }
+            }
+        }
+        return earliest;
+    }
+
+    void place(const Timer &timer)
+    {
+        // An expired timer fires at the next advance
+        uint64_t tick = std::max(timer.tick, current_tick);
+        uint64_t delta = tick - current_tick;
+        size_t level = 0;
+        while (level < LEVELS - 1 && delta >= levelSpan(level + 1)) {
+            level++;
+        }
+        if (delta >= levelSpan(LEVELS)) {
+            // Beyond the wheel: parked in the farthest slot, and placed again when that slot moves down
+            tick = current_tick + levelSpan(LEVELS) - 1;
+        }
+        slots[level][(tick >> (level * SLOT_BITS)) & SLOT_MASK].push_back(timer);
+    }
+
+    void cascade(size_t level)
+    {
+        std::vector<Timer> &slot = slots[level][(current_tick >> (level * SLOT_BITS)) & SLOT_MASK];
+        if (slot.empty()) {
+            return;
+        }
+        moving.swap(slot);
+        for (const Timer &timer : moving) {
+            place(timer);
+        }
+        moving.clear();
+    }
+
+    uint64_t tick_nanoseconds;
+    uint64_t current_tick; // The next tick to fire; every earlier one has fired
+    size_t count = 0;
+    std::array<std::array<std::vector<Timer>, SLOTS>, LEVELS> slots{};
+    // Reused between calls, so steady-state firing and cascading do not allocate
+    std::vector<Timer> firing;
+    std::vector<Timer> moving;
+};
+#endif // TWAMP_LIGHT_TIMER_WHEEL_H
@@ -60,6 +60,19 @@ auto get_timestamp() -> Timestamp;
 auto get_ip_header(msghdr hdr) -> IPHeader;
 void set_socket_options(int socket, uint8_t ip_ttl, uint8_t timeout_secs);
 void set_socket_tos(int socket, uint8_t ip_tos);
+/* Returns the port a socket ended up bound to, or 0 if it cannot be queried */
+auto get_bound_port(int socket) -> uint16_t;
+/* Asks the kernel to report a software timestamp on the error queue for every datagram sent on the socket */
+auto enable_tx_timestamping(int socket) -> bool;
+/* Reads one TX timestamp from the error queue without blocking. id is the datagram's index since
+ * enable_tx_timestamping, counting from 0. Returns false if the queue holds no timestamp. */
+auto read_tx_timestamp(int socket, uint32_t *id, struct timespec *tx_timestamp) -> bool;
+/* Lets datagrams sent with an SCM_TXTIME control message carry their launch time on clock, and has the qdisc report
+ * the ones it drops on the error queue. Only a fq or etf qdisc on the egress device holds packets until then. */
+auto enable_txtime(int socket, clockid_t clock) -> bool;
+/* Empties the error queue without blocking. Returns how many datagrams were dropped for a missed or invalid launch
+ * time. */
+auto drain_txtime_errors(int socket) -> uint64_t;
 void get_kernel_timestamp(struct msghdr incoming_msg, struct timespec *incoming_timestamp);
 auto isWithinEpsilon(double a, double b, double percentEpsilon) -> bool;
 template <class T> auto vectorToString(std::vector<T> vec, const std::string &sep) -> std::string
@@ -76,13 +89,6 @@ auto select_randomly(Iter start, Iter end, RandomGenerator &g) -> Iter
     std::advance(start, dis(g));
     return start;
 }
-
-template <typename Iter> auto select_randomly(Iter start, Iter end, uint32_t seed = 0) -> Iter
-{
-    static std::random_device rd;
-    static std::mt19937 gen(seed == 0 ? rd() : seed);
-    return select_randomly(start, end, gen);
-}
 auto ntohts(Timestamp ts) -> Timestamp;
 auto htonts(Timestamp ts) -> Timestamp;
 auto parseIPPort(const std::string &input, std::string &ip, uint16_t &port) -> bool;
@@ -5,6 +5,7 @@
 #include "Client.h"
 #include <nlohmann/json.hpp>
 #include "utils.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <chrono>
 #include <cstdint>
@@ -16,10 +17,15 @@
 #include <iostream>
 #include <memory>
 #include <netdb.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
 
-constexpr int COLLATOR_SLEEP_DURATION_MICROSECONDS = 100;
+// Observations each producer can queue ahead of the collator; a reply takes three
+constexpr size_t OBSERVATION_QUEUE_CAPACITY = 16384;
+constexpr size_t COLLATOR_BATCH_SIZE = 256;
 constexpr double NANOSECONDS_TO_MILLISECONDS = 1e-6;
 constexpr double SYNC_DELAY_EPSILON_THRESHOLD = 0.01; // Threshold for comparison
 constexpr int64_t MICROSECONDS_IN_MILLISECOND = 1000;
@@ -27,11 +33,86 @@ constexpr int64_t MILLISECONDS_IN_SECOND = 1000;
 constexpr int64_t NANOSECONDS_IN_MICROSECOND = 1000;
 constexpr int64_t NANOSECONDS_IN_SECOND = 1000000000;
 constexpr int64_t MAXINT64 = std::numeric_limits<int64_t>::max();
+constexpr uint32_t UDP_HEADER_SIZE = 8;
+constexpr uint32_t IPV4_HEADER_SIZE = 20;
+constexpr uint32_t IPV6_HEADER_SIZE = 40;
+constexpr double BITS_TO_MEGABITS = 1e-6;
+// --txtime checks the TX timestamps of this many datagrams before it relies on the qdisc keeping launch times
+constexpr size_t TXTIME_PROBE_PACKETS = 4;
+constexpr uint64_t TXTIME_PROBE_TIMEOUT_NANOSECONDS = 100000000;
+// How many packets go by between reads of the launch times the qdisc reported dropping
+constexpr uint32_t TXTIME_ERROR_DRAIN_INTERVAL = 64;
+constexpr size_t CONTROL_BUFFER_SIZE = 2048;
+// Bounds on the initial size of the collation table; the upper one also caps its growth
+constexpr uint64_t MIN_COLLATION_TABLE_SIZE = 64;
+constexpr uint64_t MAX_COLLATION_TABLE_SIZE = 1 << 20;
+// Resolution of the collator's loss and reordering timers
+constexpr uint64_t COLLATOR_TIMER_TICK_NANOSECONDS = 100000;
+
+/* Receive buffers, allocated once and reused for every datagram. The kernel fills in whatever is read back, so they
+ * are not cleared between receive calls. */
+struct ReceiveBuffers {
+    explicit ReceiveBuffers(size_t batch_size)
+        : buffers(batch_size), controls(batch_size), src_addrs(batch_size), iovs(batch_size), messages(batch_size)
+    {
+    }
+    // We should only be receiving ReflectorPackets
+    std::vector<ReflectorPacket> buffers;
+    std::vector<std::array<char, CONTROL_BUFFER_SIZE>> controls;
+    std::vector<struct sockaddr_in6> src_addrs;
+    std::vector<struct iovec> iovs;
+    std::vector<struct mmsghdr> messages;
+};
 
 using Clock = std::chrono::system_clock;
 
-Client::Client(const Args &args) : start_time((uint64_t) time(nullptr)), raw_data_list(), args(args)
+static auto make_schedule(const Args &args) -> ProbeSchedule
+{
+    return {(uint64_t) args.mean_inter_packet_delay_ms * MICROSECONDS_IN_MILLISECOND * NANOSECONDS_IN_MICROSECOND,
+            args.constant_inter_packet_delay,
+            std::vector<uint16_t>(args.payload_lens.begin(), args.payload_lens.end()),
+            args.seed};
+}
+
+/* Room for every packet that can be in flight: those sent within one timeout at the scheduled rate, twice over for
+ * the Poisson bursts. The table grows past this if it has to, up to MAX_COLLATION_TABLE_SIZE. */
+static auto collation_table_size(const Args &args) -> size_t
+{
+    uint64_t packets_per_wait = args.train_length > 0 ? args.train_length : 1;
+    uint64_t timeout_milliseconds = std::max<uint64_t>(args.timeout, 1) * MILLISECONDS_IN_SECOND;
+    uint64_t in_flight = args.mean_inter_packet_delay_ms == 0
+                             ? MAX_COLLATION_TABLE_SIZE
+                             : 2 * packets_per_wait * timeout_milliseconds / args.mean_inter_packet_delay_ms;
+    if (args.num_samples != 0 && args.runtime == 0) {
+        in_flight = std::min<uint64_t>(in_flight, args.num_samples);
+    }
+    return (size_t) std::clamp<uint64_t>(in_flight, MIN_COLLATION_TABLE_SIZE, MAX_COLLATION_TABLE_SIZE);
+}
+
+static auto now_epoch_nanoseconds() -> uint64_t
+{
+    Timestamp now = get_timestamp();
+    return timestamp_to_nsec(&now);
+}
+
+/* Whether the collator prints packets in sequence order. Trains always are, as the capacity estimate takes the
+ * packets of a train in order. */
+static auto collates_in_order(const Args &args) -> bool
+{
+    return args.train_length > 0 || args.reorder_window_ms > 0;
+}
+
+Client::Client(const Args &args)
+    : start_time((uint64_t) time(nullptr)), observation_queue(OBSERVATION_QUEUE_CAPACITY),
+      raw_data_table(collation_table_size(args), MAX_COLLATION_TABLE_SIZE),
+      collator_timers(COLLATOR_TIMER_TICK_NANOSECONDS, now_epoch_nanoseconds()),
+      capacity(std::max(args.train_length, 1U),
+               UDP_HEADER_SIZE + (args.ip_version == IPV6 ? IPV6_HEADER_SIZE : IPV4_HEADER_SIZE)),
+      schedule(make_schedule(args)), receive_buffers(std::make_unique<ReceiveBuffers>(args.batch_size)), args(args)
 {
+    if (args.remote_hosts.size() != 1) {
+        throw std::runtime_error("A client session measures exactly one reflector");
+    }
     // Construct remote socket address
     struct addrinfo hints {};
     memset(&hints, 0, sizeof(hints));
@@ -84,11 +165,29 @@ Client::Client(const Args &args) : start_time((uint64_t) time(nullptr)), raw_dat
     // Setup the socket options, to be able to receive TTL and TOS
     set_socket_options(fd, HDR_TTL, args.timeout);
     set_socket_tos(fd, args.snd_tos);
+    if (args.txtime) {
+        // TX timestamps of the first packets show whether the qdisc actually holds them until their launch time
+        if (enable_txtime(fd, args.txtime_clock) && enable_tx_timestamping(fd)) {
+            txtime_state = TxtimeState::Probing;
+        } else {
+            std::cerr << "[PROBLEM] Pacing in user space instead of with SO_TXTIME" << std::endl;
+        }
+    }
+    if (args.share_local_port) {
+        // The sessions of one process bind the same port; each receives only from the reflector it is connected to
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+    }
     // Bind the socket to a local port
     if (bind(fd, local_address_info->ai_addr, local_address_info->ai_addrlen) == -1) {
         std::cerr << strerror(errno) << std::endl;
         throw std::runtime_error("Failed to bind socket: " + std::string(strerror(errno)));
     }
+    // Connecting makes the kernel deliver only this reflector's packets to the socket
+    if (connect(fd, remote_address_info[0]->ai_addr, remote_address_info[0]->ai_addrlen) == -1) {
+        std::cerr << strerror(errno) << std::endl;
+        throw std::runtime_error("Failed to connect socket: " + std::string(strerror(errno)));
+    }
     // Query the actual bound port (important when binding to port 0)
     struct sockaddr_storage bound_addr {};
     socklen_t bound_addr_len = sizeof(bound_addr);
@@ -101,6 +200,11 @@ Client::Client(const Args &args) : start_time((uint64_t) time(nullptr)), raw_dat
         }
         this->args.local_port = std::to_string(actual_port);
     }
+    collator_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (collator_event_fd == -1) {
+        std::cerr << strerror(errno) << std::endl;
+        throw std::runtime_error("Failed to create eventfd: " + std::string(strerror(errno)));
+    }
     // Initialize the stats
     stats_RTT = sqa_stats_create();
     if (stats_RTT == nullptr) {
@@ -141,50 +245,66 @@ Client::~Client()
     if (fd != -1) {
         close(fd);
     }
+    if (collator_event_fd != -1) {
+        close(collator_event_fd);
+    }
 }
 
 /* The packet generation function */
 void Client::runSenderThread()
 {
     uint32_t index = 0;
-    std::random_device rd;                                // Will be used to obtain a seed for the random number engine
-    std::mt19937 gen(rd());                               // Standard mersenne_twister_engine seeded with rd()
-    constexpr double MAX_DELAY_MICROSECONDS = 10000000.0; // Maximum delay in microseconds
-    std::exponential_distribution<> d(1.0 / (static_cast<double>(args.mean_inter_packet_delay_ms) *
-                                             MICROSECONDS_IN_MILLISECOND)); // Lambda is 1.0/mean (in microseconds)
     while (args.num_samples == 0 || index < args.num_samples || args.runtime != 0) {
         if (args.runtime != 0 && (uint64_t) time(nullptr) - this->start_time >= args.runtime) {
             // If runtime is set, stop sending packets after the specified time
             break;
         }
-        size_t payload_len = (size_t) *select_randomly(args.payload_lens.begin(), args.payload_lens.end(), args.seed);
-        uint32_t delay = 0;
-        if (args.constant_inter_packet_delay) {
-            delay = args.mean_inter_packet_delay_ms * MICROSECONDS_IN_MILLISECOND;
-        } else {
-            delay = std::max(static_cast<uint32_t>(std::min(d(gen), MAX_DELAY_MICROSECONDS)), static_cast<uint32_t>(0));
-        }
-        usleep(delay);
-        try {
-            Timestamp sent_time = sendPacket(index, payload_len);
-            if (first_packet_sent_epoch_nanoseconds == 0) {
-                first_packet_sent_epoch_nanoseconds = timestamp_to_nsec(&sent_time);
+        ScheduledProbe probe = schedule.next();
+        // A train is sent back to back after a single wait
+        size_t payload_len = args.train_length > 0 ? args.train_size : probe.payload_len;
+        uint32_t packets = args.train_length > 0 ? args.train_length : 1;
+        // The delay is counted from the previous deadline, so sleeping late or sending slowly does not lower the rate.
+        // With SO_TXTIME the packet is queued a window ahead and the qdisc releases it at the deadline.
+        uint64_t lead = txtime_state == TxtimeState::Off
+                            ? 0
+                            : (uint64_t) args.txtime_window_us * NANOSECONDS_IN_MICROSECOND;
+        pacer.wait(probe.gap_nanoseconds, lead);
+        uint64_t launch_time = lead == 0 ? 0 : pacer.getDeadline();
+        for (uint32_t packet = 0; packet < packets; packet++, index++) {
+            try {
+                Timestamp sent_time = sendPacket(index, payload_len, launch_time);
+                if (first_packet_sent_epoch_nanoseconds == 0) {
+                    first_packet_sent_epoch_nanoseconds = timestamp_to_nsec(&sent_time);
+                }
+                last_packet_sent_epoch_nanoseconds = timestamp_to_nsec(&sent_time);
+                if (collator_started.load(std::memory_order_acquire)) {
+                    enqueueSent(QEDObservation(
+                        ObservationPoints::CLIENT_SEND, timestamp_to_nsec(&sent_time), index, payload_len));
+                    wakeCollator();
+                }
+            } catch (const std::exception &e) { // catch error from sendPacket
+                std::cerr << e.what() << std::endl;
             }
-            last_packet_sent_epoch_nanoseconds = timestamp_to_nsec(&sent_time);
-            if (this->collator_started != 0) {
-                auto obs = std::make_shared<QEDObservation>(ObservationPoints::CLIENT_SEND,
-                                                            timestamp_to_nsec(&sent_time),
-                                                            index,
-                                                            payload_len);
-
-                enqueue_observation(obs);
+            if (txtime_state == TxtimeState::Active && index % TXTIME_ERROR_DRAIN_INTERVAL == 0) {
+                txtime_errors += drain_txtime_errors(fd);
             }
-        } catch (const std::exception &e) { // catch error from sendPacket
-            std::cerr << e.what() << std::endl;
         }
-        index++;
+        schedule.refill();
+        if (txtime_state == TxtimeState::Probing && txtime_probe_launches.size() >= TXTIME_PROBE_PACKETS) {
+            finishTxtimeProbe();
+        }
+    }
+    if (txtime_state == TxtimeState::Probing) {
+        finishTxtimeProbe();
     }
-    this->sending_completed = (uint64_t) time(nullptr);
+    if (txtime_state == TxtimeState::Active) {
+        // The last packets may still wait in the qdisc
+        usleep(args.txtime_window_us);
+        txtime_errors += drain_txtime_errors(fd);
+    }
+    sending_completed.store((uint64_t) time(nullptr), std::memory_order_release);
+    // The collator finishes once the last packet is done, which it may be already
+    wakeCollator();
 }
 
 /* Receives and processes the reflected
@@ -192,114 +312,203 @@ void Client::runSenderThread()
 void Client::runReceiverThread()
 {
     /* run until all packets have been received (or timed out) */
-    while (this->sending_completed == 0 || (this->received_packets < this->sent_packets &&
-                                            (uint64_t) time(nullptr) - this->sending_completed < args.timeout)) {
-        if (!awaitAndHandleResponse()) {
-            // If no response was received, check if the oldest packet should be processed
-            check_if_oldest_packet_should_be_processed();
-        }
+    uint64_t completed = 0;
+    while ((completed = sending_completed.load(std::memory_order_acquire)) == 0 ||
+           (this->received_packets < this->sent_packets && (uint64_t) time(nullptr) - completed < args.timeout)) {
+        awaitAndHandleResponse();
     }
 }
 
-void Client::process_observation(const std::shared_ptr<QEDObservation> &obs)
+/* When a packet that is still incomplete counts as lost, in nanoseconds since the epoch */
+static auto lossDeadline(const RawData &raw_data, uint8_t timeout) -> uint64_t
 {
-    // Look for the observation in the raw_data deque
-    std::shared_ptr<RawData> entry = nullptr;
-    int made_new_entry = 0;
-    int found = 0;
-    for (auto &it : raw_data_list) {
-        entry = it;
-        if (entry->getPacketId() == obs->getPacketId()) {
-            found = 1;
-            break;
-        }
+    return raw_data.getAddedAtEpochNanoseconds() + timeout * NANOSECONDS_IN_SECOND;
+}
+
+static auto is_complete(const RawData &raw_data) -> bool
+{
+    return raw_data.getClientSendEpochNanoseconds() > 0 && raw_data.getServerReceiveEpochNanoseconds() > 0 &&
+           raw_data.getServerSendEpochNanoseconds() > 0 && raw_data.getClientReceiveEpochNanoseconds() > 0;
+}
+
+void Client::process_observation(const QEDObservation &obs)
+{
+    // Look for the observation's packet in the collation table, adding it if this is its first observation
+    bool made_new_entry = false;
+    CollationEntry *entry = raw_data_table.findOrInsert(obs.getPacketId(), made_new_entry);
+    if (entry == nullptr || entry->state == CollationEntry::State::Emitted) {
+        // The packet was already printed or counted as lost
+        return;
     }
-    if (found == 0) {
-        // Didn't find the entry, so create a new one
-        const Timestamp now_ts = get_timestamp();
-        entry = std::make_shared<RawData>(timestamp_to_nsec(&now_ts), obs->getPacketId());
-        made_new_entry = 1;
+    RawData &raw_data = entry->raw_data;
+    if (made_new_entry) {
+        raw_data = RawData(now_epoch_nanoseconds(), obs.getPacketId());
+        collator_timers.schedule(lossDeadline(raw_data, args.timeout),
+                                 {obs.getPacketId(), CollatorTimer::Kind::Loss});
     }
     // Update the entry with the observation data
-    entry->setPayloadLen(obs->getPayloadLen());
-    switch (obs->getObservationPoint()) {
+    raw_data.setPayloadLen(obs.getPayloadLen());
+    switch (obs.getObservationPoint()) {
     case ObservationPoints::CLIENT_SEND:
-        entry->setClientSendEpochNanoseconds(obs->getEpochNanoseconds());
+        raw_data.setClientSendEpochNanoseconds(obs.getEpochNanoseconds());
         break;
     case ObservationPoints::SERVER_RECEIVE:
-        entry->setServerReceiveEpochNanoseconds(obs->getEpochNanoseconds());
+        raw_data.setServerReceiveEpochNanoseconds(obs.getEpochNanoseconds());
         break;
     case ObservationPoints::SERVER_SEND:
-        entry->setServerSendEpochNanoseconds(obs->getEpochNanoseconds());
+        raw_data.setServerSendEpochNanoseconds(obs.getEpochNanoseconds());
         break;
     case ObservationPoints::CLIENT_RECEIVE:
-        entry->setClientReceiveEpochNanoseconds(obs->getEpochNanoseconds());
+        raw_data.setClientReceiveEpochNanoseconds(obs.getEpochNanoseconds());
         break;
     default:
         break;
     }
-    // If the entry is new, add it to the raw_data list
-    if (made_new_entry > 0) {
-        // Add the entry to the raw_data list
-        raw_data_list.addObservation(entry);
+    if (entry->state != CollationEntry::State::Outstanding || !is_complete(raw_data)) {
+        return;
+    }
+    if (!collates_in_order(args)) {
+        emit_packet(raw_data);
+        entry->state = CollationEntry::State::Emitted;
+        return;
+    }
+    // Waits for the packets ahead of it, but no longer than the reordering window
+    entry->state = CollationEntry::State::Ready;
+    if (args.train_length == 0) {
+        uint64_t window = (uint64_t) args.reorder_window_ms * MICROSECONDS_IN_MILLISECOND * NANOSECONDS_IN_MICROSECOND;
+        collator_timers.schedule(now_epoch_nanoseconds() + window, {obs.getPacketId(), CollatorTimer::Kind::Reorder});
     }
 }
 
-void Client::check_if_oldest_packet_should_be_processed()
+/* Timers are not cancelled, so one whose packet has moved on since it was set does nothing */
+void Client::expire_timer(const CollatorTimer &timer)
 {
-    // Check the timestamp on the oldest entry in raw_data and print it if it is old enough
-    std::shared_ptr<RawData> oldest_raw_data = raw_data_list.getOldestEntry();
-    Timestamp now = get_timestamp();
-    uint64_t now_nanoseconds = timestamp_to_nsec(&now);
-    int oldest_entry_is_complete = 0;
-    if (oldest_raw_data != nullptr && oldest_raw_data->getClientSendEpochNanoseconds() > 0 &&
-        oldest_raw_data->getServerReceiveEpochNanoseconds() > 0 &&
-        oldest_raw_data->getServerSendEpochNanoseconds() > 0 &&
-        oldest_raw_data->getClientReceiveEpochNanoseconds() > 0) {
-        oldest_entry_is_complete = 1;
-    }
-    if (oldest_raw_data != nullptr &&
-        (oldest_entry_is_complete > 0 ||
-         (now_nanoseconds - oldest_raw_data->getAddedAtEpochNanoseconds()) > args.timeout * NANOSECONDS_IN_SECOND)) {
-        // The oldest entry is old enough to be processed
-        aggregateRawData(oldest_raw_data);
-
-        if (args.print_format == "raw") {
-            std::cout << oldest_raw_data->getPacketId() << args.sep << oldest_raw_data->getPayloadLen() << args.sep
-                      << oldest_raw_data->getClientSendEpochNanoseconds() << args.sep
-                      << oldest_raw_data->getServerReceiveEpochNanoseconds() << args.sep
-                      << oldest_raw_data->getServerSendEpochNanoseconds() << args.sep
-                      << oldest_raw_data->getClientReceiveEpochNanoseconds() << "\n";
+    CollationEntry *entry = raw_data_table.find(timer.packet_id);
+    if (entry == nullptr) {
+        return;
+    }
+    if (timer.kind == CollatorTimer::Kind::Loss && entry->state == CollationEntry::State::Outstanding) {
+        // Still incomplete at the timeout, so the packet is lost
+        if (collates_in_order(args)) {
+            entry->state = CollationEntry::State::Ready;
+            return;
+        }
+        emit_packet(entry->raw_data);
+        entry->state = CollationEntry::State::Emitted;
+    } else if (timer.kind == CollatorTimer::Kind::Reorder && entry->state == CollationEntry::State::Ready) {
+        // An earlier packet is still outstanding after the reordering window, so this one goes out of order
+        emit_packet(entry->raw_data);
+        entry->state = CollationEntry::State::Emitted;
+    }
+}
+
+/* Releases the packets at the head of the collation table that are done, printing those that were waiting for their
+ * turn, and finishes the collator once every packet sent has been released */
+void Client::release_oldest_packets()
+{
+    for (CollationEntry *oldest = raw_data_table.oldest();
+         oldest != nullptr && oldest->state != CollationEntry::State::Outstanding;
+         oldest = raw_data_table.oldest()) {
+        if (oldest->state == CollationEntry::State::Ready) {
+            emit_packet(oldest->raw_data);
         }
-        // Remove the oldest entry from the raw_data list
-        raw_data_list.popObservation();
+        raw_data_table.popOldest();
     }
-    if (oldest_raw_data == nullptr && this->sending_completed > 0) {
+    if (raw_data_table.empty() && sending_completed.load(std::memory_order_acquire) > 0 &&
+        observation_queue.empty()) {
         // All the packets have been sent and all the responses have been received or timed out
         // Close the thread
-        collator_finished = 1;
+        capacity.finish();
+        collator_finished.store(true, std::memory_order_release);
+    }
+}
+
+/* Aggregates a packet that is complete or lost, and prints it with the raw format */
+void Client::emit_packet(const RawData &raw_data)
+{
+    aggregateRawData(raw_data);
+    if (args.print_format == "raw") {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << raw_data.getPacketId() << args.sep << raw_data.getPayloadLen() << args.sep
+                  << raw_data.getClientSendEpochNanoseconds() << args.sep
+                  << raw_data.getServerReceiveEpochNanoseconds() << args.sep
+                  << raw_data.getServerSendEpochNanoseconds() << args.sep
+                  << raw_data.getClientReceiveEpochNanoseconds() << "\n";
     }
 }
 
 /* Processes observations recorded by the sender and the receiver */
 void Client::runCollatorThread()
 {
-    this->collator_started = 1;
-    // Consumes the observation queue and generates a table.
-    // Uses semaphore to wake the thread only when there are observations to consume.
-    while (collator_finished == 0) {
-        std::shared_ptr<QEDObservation> tmp_obs;
-
-        if (!observation_list.isEmpty()) {
-            // Retrieve and remove the first observation from the list
-            tmp_obs = observation_list.popObservation();
-            if (tmp_obs) {
-                process_observation(tmp_obs);
-            }
-        } else {
-            check_if_oldest_packet_should_be_processed();
-            usleep(COLLATOR_SLEEP_DURATION_MICROSECONDS);
+    collator_started.store(true, std::memory_order_release);
+    // Consumes the observation queue and generates a table
+    std::vector<QEDObservation> batch(COLLATOR_BATCH_SIZE);
+    while (!collator_finished.load(std::memory_order_acquire)) {
+        size_t count = observation_queue.popBatch(batch.data(), batch.size());
+        for (size_t i = 0; i < count; i++) {
+            process_observation(batch[i]);
+        }
+        collator_timers.advance(now_epoch_nanoseconds(), [this](const CollatorTimer &timer) { expire_timer(timer); });
+        release_oldest_packets();
+        if (count == 0 && !collator_finished.load(std::memory_order_acquire)) {
+            waitForCollatorWork();
+        }
+    }
+}
+
+/* Sleeps until a producer queues an observation or the next timer expires */
+void Client::waitForCollatorWork()
+{
+    collator_sleeping.store(true, std::memory_order_relaxed);
+    // Pairs with the fence in wakeCollator: either the producer sees the collator asleep, or the collator sees what
+    // the producer queued
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (observation_queue.empty() &&
+        (!raw_data_table.empty() || sending_completed.load(std::memory_order_acquire) == 0)) {
+        struct pollfd event = {collator_event_fd, POLLIN, 0};
+        struct timespec timeout {};
+        struct timespec *timeout_ptr = nullptr;
+        uint64_t deadline = collator_timers.nextExpiry();
+        if (deadline != 0) {
+            uint64_t now_nanoseconds = now_epoch_nanoseconds();
+            timeout = nanosecondsToTimespec(deadline > now_nanoseconds ? deadline - now_nanoseconds : 0);
+            timeout_ptr = &timeout;
         }
+        ppoll(&event, 1, timeout_ptr, nullptr);
+    }
+    collator_sleeping.store(false, std::memory_order_relaxed);
+    // Clears the signals; the descriptor is non-blocking, so this fails with EAGAIN when there were none
+    uint64_t events = 0;
+    ssize_t cleared = read(collator_event_fd, &events, sizeof(events));
+    (void) cleared;
+}
+
+/* A full queue means the collator is behind, so the producer waits for room rather than lose the observation. Once
+ * the collator has finished nothing drains the queue, and late observations are dropped. */
+void Client::enqueueSent(const QEDObservation &obs)
+{
+    while (!observation_queue.tryPushSent(obs) && !collator_finished.load(std::memory_order_acquire)) {
+        wakeCollator();
+        std::this_thread::yield();
+    }
+}
+
+void Client::enqueueReceived(const QEDObservation &obs)
+{
+    while (!observation_queue.tryPushReceived(obs) && !collator_finished.load(std::memory_order_acquire)) {
+        wakeCollator();
+        std::this_thread::yield();
+    }
+}
+
+/* Costs a system call only when the collator is asleep */
+void Client::wakeCollator()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (collator_sleeping.load(std::memory_order_relaxed)) {
+        uint64_t event = 1;
+        ssize_t signalled = write(collator_event_fd, &event, sizeof(event));
+        (void) signalled;
     }
 }
 
@@ -313,27 +522,33 @@ void Client::printRawDataHeader() const
     (void) fflush(stdout);
 }
 
-void Client::aggregateRawData(const std::shared_ptr<RawData> &oldest_raw_data)
+void Client::aggregateRawData(const RawData &oldest_raw_data)
 {
+    if (args.train_length > 0) {
+        capacity.add(oldest_raw_data.getPacketId(),
+                     oldest_raw_data.getPayloadLen(),
+                     oldest_raw_data.getServerReceiveEpochNanoseconds(),
+                     oldest_raw_data.getClientReceiveEpochNanoseconds());
+    }
     // Compute the delays (without clock correction), and add them to the sqa_stats
     timespec client_server_delay = {};
-    if (oldest_raw_data->getClientSendEpochNanoseconds() > 0 &&
-        oldest_raw_data->getServerReceiveEpochNanoseconds() > 0) {
-        client_server_delay = nanosecondsToTimespec(oldest_raw_data->getServerReceiveEpochNanoseconds() -
-                                                    oldest_raw_data->getClientSendEpochNanoseconds());
+    if (oldest_raw_data.getClientSendEpochNanoseconds() > 0 &&
+        oldest_raw_data.getServerReceiveEpochNanoseconds() > 0) {
+        client_server_delay = nanosecondsToTimespec(oldest_raw_data.getServerReceiveEpochNanoseconds() -
+                                                    oldest_raw_data.getClientSendEpochNanoseconds());
         sqa_stats_add_sample(this->stats_client_server, &client_server_delay);
     }
     timespec server_client_delay = {};
     timespec internal_delay{};
-    if (oldest_raw_data->getServerSendEpochNanoseconds() > 0 &&
-        oldest_raw_data->getClientReceiveEpochNanoseconds() > 0 &&
-        oldest_raw_data->getServerReceiveEpochNanoseconds() > 0 &&
-        oldest_raw_data->getClientSendEpochNanoseconds() > 0) {
-        server_client_delay = nanosecondsToTimespec(oldest_raw_data->getClientReceiveEpochNanoseconds() -
-                                                    oldest_raw_data->getServerSendEpochNanoseconds());
+    if (oldest_raw_data.getServerSendEpochNanoseconds() > 0 &&
+        oldest_raw_data.getClientReceiveEpochNanoseconds() > 0 &&
+        oldest_raw_data.getServerReceiveEpochNanoseconds() > 0 &&
+        oldest_raw_data.getClientSendEpochNanoseconds() > 0) {
+        server_client_delay = nanosecondsToTimespec(oldest_raw_data.getClientReceiveEpochNanoseconds() -
+                                                    oldest_raw_data.getServerSendEpochNanoseconds());
         sqa_stats_add_sample(this->stats_server_client, &server_client_delay);
-        internal_delay = nanosecondsToTimespec(oldest_raw_data->getServerSendEpochNanoseconds() -
-                                               oldest_raw_data->getServerReceiveEpochNanoseconds());
+        internal_delay = nanosecondsToTimespec(oldest_raw_data.getServerSendEpochNanoseconds() -
+                                               oldest_raw_data.getServerReceiveEpochNanoseconds());
         sqa_stats_add_sample(this->stats_internal, &internal_delay);
 
     } else {
@@ -358,30 +573,95 @@ auto Client::getSentPackets() const -> int
     return sent_packets;
 }
 
-auto Client::sendPacket(uint32_t idx, size_t payload_len) -> Timestamp
+static auto clock_nanoseconds(clockid_t clock) -> uint64_t
 {
-    // Send the UDP packet
+    struct timespec now {};
+    clock_gettime(clock, &now);
+    return (uint64_t) now.tv_sec * NANOSECONDS_IN_SECOND + (uint64_t) now.tv_nsec;
+}
+
+auto Client::sendPacket(uint32_t idx, size_t payload_len, uint64_t launch_time) -> Timestamp
+{
+    alignas(struct cmsghdr) std::array<char, CMSG_SPACE(sizeof(uint64_t))> control{};
+    uint64_t launch_epoch_nanoseconds = 0;
+    Timestamp launch_timestamp = {};
+    if (launch_time != 0) {
+        // A late wake-up sends at once. The packet carries the time it leaves rather than the time it was queued.
+        uint64_t now = monotonic_nanoseconds();
+        uint64_t ahead = launch_time > now ? launch_time - now : 0;
+        launch_epoch_nanoseconds = clock_nanoseconds(CLOCK_REALTIME) + ahead;
+        uint64_t txtime = clock_nanoseconds(args.txtime_clock) + ahead;
+        struct timespec launch_timespec = nanosecondsToTimespec(launch_epoch_nanoseconds);
+        timespec_to_timestamp(&launch_timespec, &launch_timestamp);
+        auto *cm = reinterpret_cast<struct cmsghdr *>(control.data());
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_TXTIME;
+        cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+        memcpy(CMSG_DATA(cm), &txtime, sizeof(txtime));
+    }
     ClientPacket senderPacket = craftSenderPacket(idx);
-    std::array<struct iovec, 1> iov{};
-    iov[0].iov_base = &senderPacket;
-    iov[0].iov_len = payload_len;
-    for (const auto &rai : remote_address_info) {
-        struct msghdr message = {};
-        message.msg_name = rai->ai_addr;
-        message.msg_namelen = rai->ai_addrlen;
-        message.msg_iov = iov.data();
-        message.msg_iovlen = 1;
-        message.msg_control = nullptr;
-        message.msg_controllen = 0;
-        if (sendmsg(fd, &message, 0) == -1) {
-            std::cerr << strerror(errno) << std::endl;
-            throw std::runtime_error(std::string("Sending UDP message failed with error."));
+    if (launch_time != 0) {
+        senderPacket.timestamp = htonts(launch_timestamp);
+    }
+    struct iovec iov = {&senderPacket, payload_len};
+    // The socket is connected to the reflector, so the message needs no address
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = launch_time != 0 ? control.data() : nullptr;
+    message.msg_controllen = launch_time != 0 ? control.size() : 0;
+    while (sendmsg(fd, &message, 0) == -1) {
+        // An ICMP port unreachable for an earlier packet fails the next send on a connected socket, once
+        if (errno == EINTR || errno == ECONNREFUSED) {
+            continue;
         }
-        this->sent_packets += 1;
+        std::cerr << strerror(errno) << std::endl;
+        throw std::runtime_error(std::string("Sending UDP message failed with error."));
+    }
+    this->sent_packets += 1;
+    if (txtime_state == TxtimeState::Probing) {
+        txtime_probe_launches.push_back(launch_epoch_nanoseconds);
     }
     return ntohts(senderPacket.timestamp);
 }
 
+/* Keeps SO_TXTIME if the probe packets left at their launch time, and otherwise falls back to the pacer alone. A qdisc
+ * other than fq or etf sends them as soon as they are queued, a whole window early. */
+void Client::finishTxtimeProbe()
+{
+    uint64_t give_up = monotonic_nanoseconds() + TXTIME_PROBE_TIMEOUT_NANOSECONDS;
+    size_t stamped = 0;
+    int64_t earliest = MAXINT64;
+    while (stamped < txtime_probe_launches.size() && monotonic_nanoseconds() < give_up) {
+        uint32_t id = 0;
+        struct timespec tx_timestamp {};
+        if (!read_tx_timestamp(fd, &id, &tx_timestamp)) {
+            struct pollfd error_queue = {fd, 0, 0}; // POLLERR is always reported
+            poll(&error_queue, 1, 1);
+            continue;
+        }
+        if (id < txtime_probe_launches.size()) {
+            auto departure = (int64_t) ((uint64_t) tx_timestamp.tv_sec * NANOSECONDS_IN_SECOND +
+                                        (uint64_t) tx_timestamp.tv_nsec);
+            earliest = std::min(earliest, departure - (int64_t) txtime_probe_launches[id]);
+            stamped++;
+        }
+    }
+    unsigned int no_timestamping = 0;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &no_timestamping, sizeof(no_timestamping));
+    txtime_errors += drain_txtime_errors(fd);
+
+    auto tolerance = (int64_t) args.txtime_window_us * NANOSECONDS_IN_MICROSECOND / 2;
+    if (stamped > 0 && earliest > -tolerance) {
+        txtime_state = TxtimeState::Active;
+        return;
+    }
+    txtime_state = TxtimeState::Off;
+    std::cerr << "[PROBLEM] The egress qdisc does not hold packets until their SO_TXTIME launch time (it takes fq or "
+                 "etf), pacing in user space instead"
+              << std::endl;
+}
+
 auto Client::craftSenderPacket(uint32_t idx) -> ClientPacket
 {
     constexpr uint16_t ERROR_ESTIMATE_DEFAULT_BITMAP = 0x8001; // Sync = 1, Multiplier = 1
@@ -395,19 +675,23 @@ auto Client::craftSenderPacket(uint32_t idx) -> ClientPacket
 
 auto Client::awaitAndHandleResponse() -> bool
 {
-    // Read incoming datagram
-    std::array<char, sizeof(ReflectorPacket)> buffer{}; // We should only be receiving ReflectorPackets
-    std::array<char, 2048> control{};
-    struct sockaddr_in6 src_addr {};
-
-    struct iovec iov {};
-    iov.iov_base = buffer.data();
-    iov.iov_len = sizeof(buffer);
+    if (args.batch_size > 1) {
+        return receiveBatch();
+    }
+    ReflectorPacket *packet = &receive_buffers->buffers[0];
+    struct iovec &iov = receive_buffers->iovs[0];
+    iov.iov_base = packet;
+    iov.iov_len = sizeof(*packet);
 
     timespec incoming_timestamp = {0, 0};
     timespec *incoming_timestamp_ptr = &incoming_timestamp;
 
-    struct msghdr incoming_msg = make_msghdr(&iov, 1, &src_addr, sizeof(src_addr), control.data(), sizeof(control));
+    struct msghdr incoming_msg = make_msghdr(&iov,
+                                             1,
+                                             &receive_buffers->src_addrs[0],
+                                             sizeof(struct sockaddr_in6),
+                                             receive_buffers->controls[0].data(),
+                                             CONTROL_BUFFER_SIZE);
 
     ssize_t count = recvmsg(fd, &incoming_msg, MSG_WAITALL);
 #ifdef KERNEL_TIMESTAMP_DISABLED_IN_CLIENT
@@ -421,11 +705,51 @@ auto Client::awaitAndHandleResponse() -> bool
     if ((incoming_msg.msg_flags & MSG_TRUNC) != 0) {
         return false;
     }
-    auto *rec = static_cast<ReflectorPacket *>(static_cast<void *>(buffer.data()));
-    handleReflectorPacket(rec, incoming_msg, count, incoming_timestamp_ptr);
+    handleReflectorPacket(packet, incoming_msg, count, incoming_timestamp_ptr);
     return true;
 }
 
+/* Takes up to batch_size datagrams with one recvmmsg and handles them in the order they arrived */
+auto Client::receiveBatch() -> bool
+{
+    std::vector<ReflectorPacket> &buffers = receive_buffers->buffers;
+    std::vector<struct iovec> &iovs = receive_buffers->iovs;
+    std::vector<struct mmsghdr> &messages = receive_buffers->messages;
+
+    for (size_t i = 0; i < args.batch_size; i++) {
+        iovs[i].iov_base = static_cast<void *>(&buffers[i]);
+        iovs[i].iov_len = sizeof(ReflectorPacket);
+        // The kernel overwrites the name and control lengths, so they must be reset before every call
+        messages[i].msg_hdr = make_msghdr(&iovs[i],
+                                          1,
+                                          &receive_buffers->src_addrs[i],
+                                          sizeof(struct sockaddr_in6),
+                                          receive_buffers->controls[i].data(),
+                                          CONTROL_BUFFER_SIZE);
+        messages[i].msg_len = 0;
+    }
+    // Blocks for the first datagram only, up to the socket's receive timeout, then takes whatever else is queued
+    int received = recvmmsg(fd, messages.data(), args.batch_size, MSG_WAITFORONE, nullptr);
+    if (received <= 0) {
+        return false;
+    }
+    bool handled = false;
+    for (size_t i = 0; i < (size_t) received; i++) {
+        msghdr &message = messages[i].msg_hdr;
+        if ((message.msg_flags & MSG_TRUNC) != 0) {
+            continue;
+        }
+        timespec incoming_timestamp = {0, 0};
+#ifdef KERNEL_TIMESTAMP_DISABLED_IN_CLIENT
+#else
+        get_kernel_timestamp(message, &incoming_timestamp);
+#endif
+        handleReflectorPacket(&buffers[i], message, messages[i].msg_len, &incoming_timestamp);
+        handled = true;
+    }
+    return handled;
+}
+
 struct TimeData {
     int64_t internal_delay;       // Internal server delay in nanoseconds
     int64_t server_client_delay;  // Server to client delay in nanoseconds
@@ -502,11 +826,6 @@ static void populateMetricData(MetricData &data,
     data.packets_lost = uint64_t(stats->number_of_lost_packets);
 }
 
-void Client::enqueue_observation(const std::shared_ptr<QEDObservation> &obs)
-{
-    observation_list.addObservation(obs);
-}
-
 void Client::handleReflectorPacket(ReflectorPacket *reflectorPacket,
                                    msghdr msghdr,
                                    ssize_t payload_len,
@@ -533,27 +852,19 @@ void Client::handleReflectorPacket(ReflectorPacket *reflectorPacket,
     // std::string host = inet_ntoa(sock->sin_addr);
     // uint16_t  port = ntohs(sock->sin_port);
     // uint16_t local_port = atoi(args.local_port.c_str());
-    uint32_t packet_id = ntohl(reflectorPacket->seq_number);
+    // A stateful reflector numbers its replies on its own, so the reply is matched on the number we sent
+    uint32_t packet_id = ntohl(reflectorPacket->sender_seq_number);
     this->last_received_packet_id = (int32_t) packet_id;
     this->received_packets += 1;
-    if (this->collator_started != 0) {
-        auto obs1 = std::make_shared<QEDObservation>(ObservationPoints::CLIENT_RECEIVE,
-                                                     incoming_timestamp_nanoseconds,
-                                                     packet_id,
-                                                     payload_len);
-        auto obs2 = std::make_shared<QEDObservation>(ObservationPoints::SERVER_RECEIVE,
-                                                     timestamp_to_nsec(&server_receive_time),
-                                                     packet_id,
-                                                     payload_len);
-        auto obs3 = std::make_shared<QEDObservation>(ObservationPoints::SERVER_SEND,
-                                                     timestamp_to_nsec(&server_send_time),
-                                                     packet_id,
-                                                     payload_len);
-
+    if (collator_started.load(std::memory_order_acquire)) {
         // Queue all observations in the FIFO to the collator
-        enqueue_observation(obs3);
-        enqueue_observation(obs2);
-        enqueue_observation(obs1);
+        enqueueReceived(QEDObservation(
+            ObservationPoints::SERVER_SEND, timestamp_to_nsec(&server_send_time), packet_id, payload_len));
+        enqueueReceived(QEDObservation(
+            ObservationPoints::SERVER_RECEIVE, timestamp_to_nsec(&server_receive_time), packet_id, payload_len));
+        enqueueReceived(
+            QEDObservation(ObservationPoints::CLIENT_RECEIVE, incoming_timestamp_nanoseconds, packet_id, payload_len));
+        wakeCollator();
     }
     if (args.print_format == "legacy") {
         printReflectorPacket(reflectorPacket,
@@ -590,6 +901,7 @@ void Client::printReflectorPacket(ReflectorPacket *reflectorPacket,
     MetricData data;
     populateMetricData(data, reflectorPacket, ipHeader, host.data(), local_port, port, payload_len, timeData, stats);
 
+    std::lock_guard<std::mutex> lock(output_mutex);
     if (args.print_RTT_only) {
         // Save current format state
         std::ostream &os = std::cout;
@@ -677,6 +989,7 @@ void Client::printMetrics(const MetricData &data) const
 
 void Client::print_lost_packet(uint32_t packet_id, uint64_t initial_send_time, uint16_t payload_len) const
 {
+    std::lock_guard<std::mutex> lock(output_mutex);
     // Save current format state
     std::ostream &os = std::cout;
     std::ios::fmtflags f = os.flags();
@@ -795,6 +1108,66 @@ void Client::printStats(int packets_sent)
     printPercentileLine("p95:", PERCENTILE_95);
     printPercentileLine("p99:", PERCENTILE_99);
     printPercentileLine("p99.9:", PERCENTILE_99_9);
+    printPacing(os);
+    if (args.train_length > 0) {
+        printCapacity(os);
+    }
+}
+
+/* Compares the send rate asked for with the one the pacer kept, and shows how late the sends were */
+void Client::printPacing(std::ostream &os) const
+{
+    std::ios::fmtflags f = os.flags();
+    std::streamsize prec = os.precision();
+    // The pacer waits once per train
+    const char *unit = args.train_length > 0 ? " trains/s" : " packets/s";
+    os << std::fixed << std::setprecision(2) << "Send rate: target ";
+    if (args.mean_inter_packet_delay_ms > 0) {
+        os << (double) MILLISECONDS_IN_SECOND / (double) args.mean_inter_packet_delay_ms << unit;
+    } else {
+        os << "unlimited";
+    }
+    os << ", scheduled " << pacer.scheduledRate() << unit << ", achieved " << pacer.achievedRate() << unit;
+    if (pacer.getScheduleRestarts() > 0) {
+        os << ", schedule restarted " << pacer.getScheduleRestarts() << " times after falling behind";
+    }
+    os << "\n";
+    if (args.txtime) {
+        os << "Kernel pacing: ";
+        if (txtime_state == TxtimeState::Active) {
+            os << "SO_TXTIME " << args.txtime_window_us << " us ahead, " << txtime_errors
+               << " packets dropped for a missed launch time\n";
+        } else {
+            os << "off, paced in user space\n";
+        }
+    }
+    os.flags(f);
+    os.precision(prec);
+    write_delay_histogram(os, pacer.getScheduleErrors(), "Send schedule error");
+}
+
+/* The bottleneck capacity of each direction, from the trains the collator has seen */
+void Client::printCapacity(std::ostream &os) const
+{
+    std::ios::fmtflags f = os.flags();
+    std::streamsize prec = os.precision();
+    os << std::fixed << std::setprecision(2);
+    auto printDirection = [&](const char *direction, const std::vector<double> &estimates) {
+        os << "Capacity " << direction << ": ";
+        if (estimates.empty()) {
+            os << "no train had two packets arrive\n";
+            return;
+        }
+        auto [min, max] = std::minmax_element(estimates.begin(), estimates.end());
+        os << "median " << CapacityEstimator::median(estimates) * BITS_TO_MEGABITS << " Mbit/s, min "
+           << *min * BITS_TO_MEGABITS << " Mbit/s, max " << *max * BITS_TO_MEGABITS << " Mbit/s over "
+           << estimates.size() << " trains of " << args.train_length << " packets\n";
+    };
+    // The forward dispersion is taken at the reflector, the backward one from the kernel RX timestamps here
+    printDirection("forward", capacity.getForward());
+    printDirection("backward", capacity.getBackward());
+    os.flags(f);
+    os.precision(prec);
 }
 
 static auto td_to_json(td_histogram_t *histogram) -> nlohmann::json
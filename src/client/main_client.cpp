@@ -8,8 +8,10 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <thread>
+#include <vector>
 #include <unistd.h>
 
 static auto parse_args(int argc, char **argv) -> Args
@@ -36,9 +38,12 @@ static auto parse_args(int argc, char **argv) -> Args
                    args.timeout,
                    "How long (in seconds) to wait for response on each packet before concluding the packet is lost.")
         ->default_str(std::to_string(args.timeout));
-    app.add_option("-s, --seed", args.seed, "Seed for the RNG. 0 means random.");
+    app.add_option("-s, --seed", args.seed, "Seed for the RNG drawing the inter-packet delays and payload lengths. 0 means random.");
     app.add_flag("--print-digest{true}", args.print_digest, "Prints a statistical summary at the end.");
-    app.add_option("-j, --json-output", args.json_output_file, "Filename to dump json output to");
+    app.add_option("-j, --json-output",
+                   args.json_output_file,
+                   "Filename to dump json output to. With several reflectors, each gets the file name with its "
+                   "index appended, as in out.json.0.");
     app.add_flag("--print-lost-packets",
                  args.print_lost_packets,
                  "Prints sent and lost packet counters, legacy format only");
@@ -60,6 +65,40 @@ static auto parse_args(int argc, char **argv) -> Args
     app.add_flag("--constant-inter-packet-delay",
                  args.constant_inter_packet_delay,
                  "The constant inter-packet delay in milliseconds. Overrides the default Poisson traffic pattern.");
+    auto *opt_txtime = app.add_flag("--txtime",
+                                    args.txtime,
+                                    "Hand each packet its launch time with SO_TXTIME so the fq or etf qdisc releases it "
+                                    "on schedule. Falls back to pacing in user space when the qdisc ignores it.");
+    app.add_option("--txtime-window",
+                   args.txtime_window_us,
+                   "How long (in microseconds) before its launch time each --txtime packet is queued.")
+        ->check(CLI::Range(20, 1000000))
+        ->needs(opt_txtime);
+    std::string txtime_clock = "monotonic";
+    app.add_option("--txtime-clock",
+                   txtime_clock,
+                   "Clock of the --txtime launch times: monotonic for fq, tai for etf.")
+        ->check(CLI::IsMember({"monotonic", "tai"}))
+        ->needs(opt_txtime);
+    auto *opt_train = app.add_option("--train",
+                                     args.train_length,
+                                     "Send back-to-back trains of this many packets, one per inter-packet delay, and "
+                                     "estimate the bottleneck capacity of each direction from their dispersion. 2 "
+                                     "sends packet pairs. -n counts packets, rounded up to whole trains.")
+                          ->check(CLI::Range(2, 1000));
+    app.add_option("--train-size", args.train_size, "The payload length of the --train packets.")
+        ->check(CLI::Range(MIN_PAYLOAD_LEN, MAX_PAYLOAD_LEN))
+        ->needs(opt_train);
+    app.add_option("--batch",
+                   args.batch_size,
+                   "Maximum number of replies to receive per recvmmsg call. 1 receives one reply per recvmsg.")
+        ->check(CLI::Range(1, (int) MAX_RECEIVE_BATCH_SIZE));
+    app.add_option("--reorder-window",
+                   args.reorder_window_ms,
+                   "How long (in milliseconds) a completed packet waits for the packets sent before it, so that the "
+                   "raw output and the statistics take packets in order. 0 takes each packet as soon as it is "
+                   "complete or lost. Packets of --train are always taken in order.")
+        ->default_str(std::to_string(args.reorder_window_ms));
     uint8_t tos = 0;
     auto *opt_tos = app.add_option("-T, --tos", tos, "The TOS value (<256).")
                         ->check(CLI::Range(256))
@@ -107,12 +146,25 @@ static auto parse_args(int argc, char **argv) -> Args
         }
     }
 
+    args.txtime_clock = txtime_clock == "tai" ? CLOCK_TAI : CLOCK_MONOTONIC;
     if (*opt_tos) {
         args.snd_tos = tos - (((tos & 0x2) >> 1) & (tos & 0x1));
     }
     return args;
 }
 
+/* The arguments of the session with the index-th reflector */
+static auto session_args(const Args &args, size_t index) -> Args
+{
+    Args session = args;
+    session.remote_hosts = {args.remote_hosts[index]};
+    session.remote_ports = {args.remote_ports[index]};
+    // Distinct but still reproducible schedules, so the sessions do not probe in lockstep
+    session.seed = args.seed == 0 ? 0 : args.seed + (uint32_t) index;
+    session.share_local_port = args.remote_hosts.size() > 1 && args.local_port != "0";
+    return session;
+}
+
 auto main(int argc, char **argv) -> int
 {
     try {
@@ -123,21 +175,39 @@ auto main(int argc, char **argv) -> int
                 << std::endl;
             args.num_samples = 0;
         }
-        Client client = Client(args);
-        std::thread receiver_thread(&Client::runReceiverThread, &client);
-        std::thread sender_thread(&Client::runSenderThread, &client);
-        client.printHeader();
-        if (args.print_format != "legacy" || args.print_lost_packets) {
-            client.runCollatorThread();
+        // Every reflector gets a session of its own, with a connected socket, sequence numbers and statistics
+        std::vector<std::unique_ptr<Client>> sessions;
+        for (size_t i = 0; i < args.remote_hosts.size(); i++) {
+            sessions.push_back(std::make_unique<Client>(session_args(args, i)));
+        }
+        sessions[0]->printHeader();
+        bool collate = args.print_format != "legacy" || args.print_lost_packets || args.train_length > 0;
+        std::vector<std::thread> threads;
+        for (auto &session : sessions) {
+            threads.emplace_back(&Client::runReceiverThread, session.get());
+            if (collate) {
+                threads.emplace_back(&Client::runCollatorThread, session.get());
+            }
+            threads.emplace_back(&Client::runSenderThread, session.get());
         }
-        sender_thread.join();
-        receiver_thread.join();
-        int packets_sent = client.getSentPackets();
-        if (args.print_digest && args.print_format != "legacy") {
-            client.printStats(packets_sent);
+        for (auto &thread : threads) {
+            thread.join();
         }
-        if (!args.json_output_file.empty() && args.print_format != "legacy") {
-            client.JsonLog(args.json_output_file);
+        for (size_t i = 0; i < sessions.size(); i++) {
+            Client &client = *sessions[i];
+            bool print_digest = args.print_digest && args.print_format != "legacy";
+            if (sessions.size() > 1 && (print_digest || args.train_length > 0)) {
+                std::cout << "Reflector " << args.remote_hosts[i] << ":" << args.remote_ports[i] << "\n";
+            }
+            if (print_digest) {
+                client.printStats(client.getSentPackets());
+            } else if (args.train_length > 0) {
+                client.printCapacity(std::cout);
+            }
+            if (!args.json_output_file.empty() && args.print_format != "legacy") {
+                client.JsonLog(sessions.size() > 1 ? args.json_output_file + "." + std::to_string(i)
+                                                   : args.json_output_file);
+            }
         }
         return 0;
     } catch (const CLI::BadNameString &e) {
@@ -0,0 +1,249 @@
+#include "LoadTest.h"
+#include "WorkerPool.h"
+#include "reflect.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <netdb.h>
+#include <poll.h>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+constexpr size_t LOAD_CONTROL_BUFFER_SIZE = 1024;
+constexpr uint64_t NANOSECONDS_IN_SECOND = 1000000000;
+constexpr uint64_t NANOSECONDS_IN_MILLISECOND = 1000000;
+constexpr double NANOSECONDS_IN_MICROSECOND = 1000;
+// How long a sender without a rate waits for replies before it takes its whole window as lost
+constexpr int LOAD_WINDOW_TIMEOUT_MILLISECONDS = 10;
+// How long the senders wait for the last replies after the test
+constexpr uint64_t LOAD_DRAIN_NANOSECONDS = NANOSECONDS_IN_SECOND;
+constexpr size_t MAX_RESERVED_SAMPLES = 1 << 22;
+
+static auto monotonic_nsec() -> uint64_t
+{
+    struct timespec now {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NANOSECONDS_IN_SECOND + (uint64_t) now.tv_nsec;
+}
+
+/* Value below which the given share of the sorted samples lie, in microseconds */
+static auto percentile_usec(const std::vector<int64_t> &sorted, double quantile) -> double
+{
+    auto rank = (size_t) std::ceil(quantile * (double) sorted.size());
+    return (double) sorted[rank == 0 ? 0 : rank - 1] / NANOSECONDS_IN_MICROSECOND;
+}
+
+static void print_distribution(const std::string &label, std::vector<int64_t> &samples)
+{
+    if (samples.empty()) {
+        std::cout << label << ": no samples" << std::endl;
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    std::cout << label << " (us): p50 " << percentile_usec(samples, 0.5) << ", p90 " << percentile_usec(samples, 0.9)
+              << ", p99 " << percentile_usec(samples, 0.99) << ", p99.9 " << percentile_usec(samples, 0.999)
+              << ", max " << percentile_usec(samples, 1.0) << std::endl;
+}
+
+LoadTest::LoadTest(LoadTestArgs args) : args(std::move(args)) {}
+
+void LoadTest::resolveTarget(const std::string &host, uint16_t port)
+{
+    struct addrinfo hints {};
+    hints.ai_family = args.ip_version == 6 ? AF_INET6 : AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *res = nullptr;
+    int err = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res);
+    if (err != 0) {
+        throw std::runtime_error("Cannot resolve " + host + ": " + gai_strerror(err));
+    }
+    memcpy(&target, res->ai_addr, res->ai_addrlen);
+    target_len = res->ai_addrlen;
+    freeaddrinfo(res);
+}
+
+auto LoadTest::run() -> int
+{
+    // The in-process reflector is the production one with its per-packet output turned off
+    std::unique_ptr<Server> server;
+    std::unique_ptr<WorkerPool> pool;
+    std::thread reflector_thread;
+    int reflector_result = 0;
+    if (args.target_host.empty()) {
+        Args &reflector_args = args.reflector;
+        reflector_args.ip_version = args.ip_version;
+        reflector_args.local_host = args.ip_version == 6 ? "::1" : "127.0.0.1";
+        reflector_args.local_port = "0";
+        reflector_args.num_samples = 0;
+        reflector_args.timeout = 0;
+        reflector_args.print_packets = false;
+        uint16_t port = 0;
+        if (reflector_args.workers != 1) {
+            pool = std::make_unique<WorkerPool>(reflector_args);
+            port = get_bound_port(pool->getServers().front()->getSocket());
+            reflector_thread = std::thread([&pool, &reflector_result]() { reflector_result = pool->run(); });
+        } else {
+            server = std::make_unique<Server>(reflector_args);
+            port = get_bound_port(server->getSocket());
+            reflector_thread = std::thread([&server, &reflector_result]() { reflector_result = server->listen(); });
+        }
+        if (port == 0) {
+            throw std::runtime_error("Cannot read the port of the in-process reflector");
+        }
+        resolveTarget(reflector_args.local_host, port);
+    } else {
+        resolveTarget(args.target_host, args.target_port);
+    }
+
+    std::vector<SenderResult> results(args.threads);
+    std::vector<std::thread> senders;
+    for (auto &result : results) {
+        senders.emplace_back(&LoadTest::runSender, this, &result);
+    }
+    for (auto &sender : senders) {
+        sender.join();
+    }
+
+    if (reflector_thread.joinable()) {
+        if (pool) {
+            pool->stop();
+        } else {
+            server->stop();
+        }
+        reflector_thread.join();
+    }
+    report(results);
+    if (pool) {
+        pool->printCounters();
+    } else if (server) {
+        Server::printCounters(server->getCounters(), "Reflector: ");
+    }
+    return reflector_result;
+}
+
+void LoadTest::runSender(SenderResult *result)
+{
+    int fd = socket(target.ss_family, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        std::cerr << "Cannot create a sender socket: " << strerror(errno) << std::endl;
+        return;
+    }
+    // The same socket setup as the client, which also turns on the kernel receive timestamps
+    set_socket_options(fd, HDR_TTL, 0);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&target), target_len) != 0) {
+        std::cerr << "Cannot connect a sender socket: " << strerror(errno) << std::endl;
+        close(fd);
+        return;
+    }
+    size_t expected = args.rate > 0 ? (size_t) (args.rate * args.duration) : MAX_RESERVED_SAMPLES;
+    result->internal_delays.reserve(std::min(expected, MAX_RESERVED_SAMPLES));
+    result->round_trips.reserve(std::min(expected, MAX_RESERVED_SAMPLES));
+
+    ClientPacket packet;
+    packet.timestamp_error_estimate = htons(ERROR_ESTIMATE_DEFAULT_BITMAP);
+    ReflectorPacket reply;
+    std::array<char, LOAD_CONTROL_BUFFER_SIZE> control{};
+    struct iovec iov = {&reply, sizeof(reply)};
+    uint64_t in_flight = 0;
+
+    // Takes every reply already queued, first waiting up to timeout_ms for one. Returns how many were taken.
+    auto receive_replies = [&](int timeout_ms) -> size_t {
+        if (timeout_ms > 0) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            poll(&pfd, 1, timeout_ms);
+        }
+        size_t taken = 0;
+        while (true) {
+            struct msghdr message = make_msghdr(&iov, 1, nullptr, 0, control.data(), control.size());
+            ssize_t len = recvmsg(fd, &message, MSG_DONTWAIT);
+            if (len == -1) {
+                return taken;
+            }
+            taken++;
+            if (len < REFLECTOR_HEADER_SIZE) {
+                continue;
+            }
+            struct timespec arrival {};
+            get_kernel_timestamp(message, &arrival);
+            if (arrival.tv_sec == 0 && arrival.tv_nsec == 0) {
+                clock_gettime(CLOCK_REALTIME, &arrival);
+            }
+            Timestamp arrival_timestamp = {};
+            timespec_to_timestamp(&arrival, &arrival_timestamp);
+            Timestamp sender_timestamp = ntohts(reply.sender_timestamp);
+            Timestamp reflector_receive = ntohts(reply.receive_timestamp);
+            Timestamp reflector_send = ntohts(reply.timestamp);
+            result->received++;
+            in_flight = in_flight > 0 ? in_flight - 1 : 0;
+            result->internal_delays.push_back(
+                (int64_t) (timestamp_to_nsec(&reflector_send) - timestamp_to_nsec(&reflector_receive)));
+            result->round_trips.push_back(
+                (int64_t) (timestamp_to_nsec(&arrival_timestamp) - timestamp_to_nsec(&sender_timestamp)));
+        }
+    };
+
+    uint64_t interval = args.rate > 0 ? (uint64_t) ((double) NANOSECONDS_IN_SECOND / args.rate) : 0;
+    uint64_t now = monotonic_nsec();
+    uint64_t end = now + args.duration * NANOSECONDS_IN_SECOND;
+    uint64_t next_send = now;
+    uint32_t seq = 0;
+    while ((now = monotonic_nsec()) < end) {
+        bool may_send = interval > 0 ? now >= next_send : in_flight < args.window;
+        if (may_send) {
+            packet.seq_number = htonl(seq++);
+            packet.timestamp = htonts(get_timestamp());
+            if (send(fd, &packet, args.payload_size, 0) == -1) {
+                result->send_errors++;
+            } else {
+                result->sent++;
+                in_flight++;
+            }
+            next_send += interval;
+            continue;
+        }
+        if (interval > 0) {
+            // Sleep in poll only when the next send is more than a millisecond away, and spin otherwise
+            receive_replies((int) ((next_send - now) / NANOSECONDS_IN_MILLISECOND));
+        } else if (receive_replies(LOAD_WINDOW_TIMEOUT_MILLISECONDS) == 0) {
+            // Nothing came back for a while, so whatever is in the window was lost; do not stall on it
+            in_flight = 0;
+        }
+    }
+    uint64_t drain_end = monotonic_nsec() + LOAD_DRAIN_NANOSECONDS;
+    while (result->received < result->sent && monotonic_nsec() < drain_end) {
+        receive_replies(LOAD_WINDOW_TIMEOUT_MILLISECONDS);
+    }
+    close(fd);
+}
+
+void LoadTest::report(std::vector<SenderResult> &results) const
+{
+    SenderResult total;
+    for (auto &result : results) {
+        total.sent += result.sent;
+        total.send_errors += result.send_errors;
+        total.received += result.received;
+        total.internal_delays.insert(
+            total.internal_delays.end(), result.internal_delays.begin(), result.internal_delays.end());
+        total.round_trips.insert(total.round_trips.end(), result.round_trips.begin(), result.round_trips.end());
+    }
+    uint64_t lost = total.sent > total.received ? total.sent - total.received : 0;
+    double loss_percent = total.sent > 0 ? 100.0 * (double) lost / (double) total.sent : 0;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Load test: " << args.threads << " sender threads, " << args.payload_size << " byte payloads, "
+              << args.duration << " s" << std::endl;
+    std::cout << "Sent " << total.sent << " packets (" << (double) total.sent / args.duration << " packets/s), "
+              << total.send_errors << " send errors" << std::endl;
+    std::cout << "Reflected " << total.received << " packets (" << (double) total.received / args.duration
+              << " reflections/s), lost " << lost << " (" << std::setprecision(3) << loss_percent << "%)"
+              << std::endl;
+    std::cout << std::setprecision(1);
+    print_distribution("Reflector internal delay", total.internal_delays);
+    print_distribution("Round trip", total.round_trips);
+}
@@ -0,0 +1,69 @@
+#include "LoadTest.h"
+#include <CLI/CLI.hpp>
+#include <iostream>
+
+static auto parse_args(int argc, char **argv) -> LoadTestArgs
+{
+    LoadTestArgs args{};
+    std::string title =
+        "Twamp-Light reflector load test written by Domos. Version " + std::string(TWAMP_VERSION_TXT);
+    CLI::App app{std::move(title)};
+    app.option_defaults()->always_capture_default(true);
+    std::string target;
+    app.add_option("--target",
+                   target,
+                   "Reflector to load, in the format IP:Port. Without it a reflector is started in this process on "
+                   "the loopback address.");
+    app.add_option("--ip", args.ip_version, "The IP version to use.");
+    app.add_option("--threads", args.threads, "Number of sender threads, each with its own socket.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--rate",
+                   args.rate,
+                   "Packets per second sent by each sender thread. 0 sends as fast as the window allows.")
+        ->check(CLI::NonNegativeNumber);
+    app.add_option("--size", args.payload_size, "The payload length of the test packets.")
+        ->check(CLI::Range((int) REFLECTOR_HEADER_SIZE, (int) TST_PKT_SIZE));
+    app.add_option("--duration", args.duration, "How long (in seconds) to send.")->check(CLI::PositiveNumber);
+    app.add_option("--window",
+                   args.window,
+                   "Most packets a sender thread without a --rate has waiting for their reflection.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--batch",
+                   args.reflector.batch_size,
+                   "In-process reflector: maximum number of datagrams per recvmmsg/sendmmsg call.")
+        ->check(CLI::Range(1, (int) MAX_BATCH_SIZE));
+    app.add_flag("--io-uring", args.reflector.io_uring, "In-process reflector: reflect through io_uring.");
+    app.add_option("--workers",
+                   args.reflector.workers,
+                   "In-process reflector: number of reflector threads with their own SO_REUSEPORT sockets. 0 starts "
+                   "one per available CPU.");
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError &e) {
+        std::exit((app).exit(e));
+    }
+
+    if (!target.empty()) {
+        bool parsed = args.ip_version == IPV6 ? parseIPv6Port(target, args.target_host, args.target_port)
+                                              : parseIPPort(target, args.target_host, args.target_port);
+        if (!parsed) {
+            std::cerr << "[PROBLEM] Target must be in the format IP:Port" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    return args;
+}
+
+auto main(int argc, char **argv) -> int
+{
+    try {
+        LoadTest load_test(parse_args(argc, argv));
+        return load_test.run();
+    } catch (const std::runtime_error &e) {
+        std::cerr << "Runtime error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    } catch (const std::exception &e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,105 @@
+#include "BinaryLog.h"
+#include "TextLog.h"
+#include "utils.hpp"
+#include <CLI/CLI.hpp>
+#include <arpa/inet.h>
+#include <array>
+#include <cstring>
+#include <endian.h>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct DecodeArgs {
+    std::string input;
+    char sep = ',';
+};
+
+static auto parse_args(int argc, char **argv) -> DecodeArgs
+{
+    DecodeArgs args{};
+    std::string title =
+        "Twamp-Light binary log decoder written by Domos. Version " + std::string(TWAMP_VERSION_TXT);
+    CLI::App app{std::move(title)};
+    app.option_defaults()->always_capture_default(true);
+    app.add_option("input", args.input, "Binary log written by twamp-light-server --log-format binary.")
+        ->required();
+    app.add_option("--sep", args.sep, "The separator to use in the output.");
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError &e) {
+        std::exit((app).exit(e));
+    }
+    return args;
+}
+
+/* The MetricData the server would have printed the record from */
+static auto to_metric_data(BinaryLogRecord record) -> MetricData
+{
+    binary_log_byte_order(&record);
+    std::array<char, INET6_ADDRSTRLEN> host = {};
+    inet_ntop(record.ip_version == IPV6 ? AF_INET6 : AF_INET, record.address, host.data(), host.size());
+
+    MetricData data;
+    data.ip = std::string(host.data());
+    data.sending_port = record.sending_port;
+    data.receiving_port = record.receiving_port;
+    data.payload_length = record.payload_length;
+    data.client_server_delay_nanoseconds = record.forward_delay;
+    data.internal_delay_nanoseconds = record.internal_delay;
+    data.initial_send_time = record.send_time;
+    data.sender_seq_number = record.sender_seq_number;
+    data.seq_number = record.seq_number;
+    data.sender_ttl = record.ttl;
+    data.sender_tos = record.sender_tos;
+    return data;
+}
+
+auto main(int argc, char **argv) -> int
+{
+    DecodeArgs args = parse_args(argc, argv);
+    int fd = open(args.input.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        std::cerr << "[PROBLEM] Cannot open " << args.input << ": " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(BinaryLogHeader)) {
+        std::cerr << "[PROBLEM] " << args.input << " is too short for a binary log" << std::endl;
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    auto size = (size_t) st.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "[PROBLEM] Cannot map " << args.input << ": " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    const auto *header = static_cast<const BinaryLogHeader *>(mapping);
+    if (memcmp(header->magic, BINARY_LOG_MAGIC, sizeof(header->magic)) != 0 ||
+        le32toh(header->version) != BINARY_LOG_VERSION || le32toh(header->record_size) != sizeof(BinaryLogRecord)) {
+        std::cerr << "[PROBLEM] " << args.input << " is not a version " << BINARY_LOG_VERSION << " binary log"
+                  << std::endl;
+        munmap(mapping, size);
+        return EXIT_FAILURE;
+    }
+    // The header takes the first record slot; a partly written last record is left out
+    const auto *records = static_cast<const BinaryLogRecord *>(mapping) + 1;
+    size_t count = size / sizeof(BinaryLogRecord) - 1;
+    if (size % sizeof(BinaryLogRecord) != 0) {
+        std::cerr << "[PROBLEM] " << args.input << " ends in a partial record, which is skipped" << std::endl;
+    }
+
+    write_text_log_header(std::cout, args.sep);
+    for (size_t i = 0; i < count; i++) {
+        write_text_log_line(std::cout, to_metric_data(records[i]), args.sep);
+    }
+    std::cout.flush();
+    munmap(mapping, size);
+    return EXIT_SUCCESS;
+}
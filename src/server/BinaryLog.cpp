@@ -0,0 +1,85 @@
+#include "BinaryLog.h"
+#include <cerrno>
+#include <cstring>
+#include <endian.h>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <time.h>
+#include <unistd.h>
+
+constexpr uint64_t NANOSECONDS_IN_SECOND = 1000000000;
+
+void binary_log_byte_order(BinaryLogRecord *record)
+{
+    record->send_time = htole64(record->send_time);
+    record->internal_delay = (int64_t) htole64((uint64_t) record->internal_delay);
+    record->forward_delay = (int64_t) htole64((uint64_t) record->forward_delay);
+    record->sender_seq_number = htole32(record->sender_seq_number);
+    record->seq_number = htole32(record->seq_number);
+    record->sending_port = htole16(record->sending_port);
+    record->receiving_port = htole16(record->receiving_port);
+    record->payload_length = htole16(record->payload_length);
+}
+
+/* Writes all of count bytes, resuming after signals and partial writes */
+static auto write_all(int fd, const void *data, size_t count) -> bool
+{
+    const auto *bytes = static_cast<const char *>(data);
+    while (count > 0) {
+        ssize_t written = write(fd, bytes, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        count -= (size_t) written;
+    }
+    return true;
+}
+
+BinaryLogWriter::BinaryLogWriter(const std::string &path)
+{
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        throw std::runtime_error("Cannot open the binary log " + path + ": " + strerror(errno));
+    }
+    struct timespec now {};
+    clock_gettime(CLOCK_REALTIME, &now);
+    BinaryLogHeader header{};
+    memcpy(header.magic, BINARY_LOG_MAGIC, sizeof(header.magic));
+    header.version = htole32(BINARY_LOG_VERSION);
+    header.record_size = htole32(sizeof(BinaryLogRecord));
+    header.start_time = htole64((uint64_t) now.tv_sec * NANOSECONDS_IN_SECOND + (uint64_t) now.tv_nsec);
+    if (!write_all(fd, &header, sizeof(header))) {
+        close(fd);
+        throw std::runtime_error("Cannot write the binary log header to " + path + ": " + strerror(errno));
+    }
+}
+
+BinaryLogWriter::~BinaryLogWriter()
+{
+    close(fd);
+}
+
+auto BinaryLogWriter::shared(const std::string &path) -> std::shared_ptr<BinaryLogWriter>
+{
+    static std::mutex writers_mutex;
+    static std::map<std::string, std::weak_ptr<BinaryLogWriter>> writers;
+    std::lock_guard<std::mutex> lock(writers_mutex);
+    std::shared_ptr<BinaryLogWriter> writer = writers[path].lock();
+    if (!writer) {
+        writer = std::make_shared<BinaryLogWriter>(path);
+        writers[path] = writer;
+    }
+    return writer;
+}
+
+auto BinaryLogWriter::append(const BinaryLogRecord *records, size_t count) -> bool
+{
+    // O_APPEND makes one write of whole records land contiguously, whichever server issues it
+    return write_all(fd, records, count * sizeof(BinaryLogRecord));
+}
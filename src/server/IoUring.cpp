@@ -0,0 +1,207 @@
+#include "IoUring.h"
+#ifdef TWAMP_IO_URING
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static auto io_uring_setup(unsigned int entries, struct io_uring_params *params) -> int
+{
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static auto io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg,
+                           size_t arg_size) -> int
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static auto io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) -> int
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static auto map_ring(int fd, size_t size, off_t offset) -> void *
+{
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("Failed to map io_uring: " + std::string(strerror(errno)));
+    }
+    return ptr;
+}
+
+static auto offset_ptr(void *base, uint32_t offset) -> unsigned int *
+{
+    return reinterpret_cast<unsigned int *>(static_cast<uint8_t *>(base) + offset);
+}
+
+IoUring::IoUring(unsigned int entries, unsigned int num_buffers, size_t buffer_size, uint16_t buffer_group)
+    : buffer_group(buffer_group), buffer_size(buffer_size)
+{
+    try {
+        setup(entries, num_buffers);
+    } catch (...) {
+        // The destructor does not run for a constructor that throws, so release what was set up so far
+        release();
+        throw;
+    }
+}
+
+void IoUring::setup(unsigned int entries, unsigned int num_buffers)
+{
+    ring_fd = io_uring_setup(entries, &params);
+    if (ring_fd < 0) {
+        throw std::runtime_error("io_uring_setup failed: " + std::string(strerror(errno)));
+    }
+    // Both rings share one mapping on every kernel that has provided buffer rings, but be correct on others too
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        sq_ring = map_ring(ring_fd, sq_ring_size, IORING_OFF_SQ_RING);
+        cq_ring = sq_ring;
+    } else {
+        sq_ring = map_ring(ring_fd, sq_ring_size, IORING_OFF_SQ_RING);
+        cq_ring = map_ring(ring_fd, cq_ring_size, IORING_OFF_CQ_RING);
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(map_ring(ring_fd, sqes_size, IORING_OFF_SQES));
+
+    sq_head = offset_ptr(sq_ring, params.sq_off.head);
+    sq_tail = offset_ptr(sq_ring, params.sq_off.tail);
+    sq_mask = *offset_ptr(sq_ring, params.sq_off.ring_mask);
+    sq_array = offset_ptr(sq_ring, params.sq_off.array);
+    sq_local_tail = *sq_tail;
+    cq_head = offset_ptr(cq_ring, params.cq_off.head);
+    cq_tail = offset_ptr(cq_ring, params.cq_off.tail);
+    cq_mask = *offset_ptr(cq_ring, params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(static_cast<uint8_t *>(cq_ring) + params.cq_off.cqes);
+
+    // The provided buffer ring must be page aligned, which an anonymous mapping guarantees
+    buffer_ring_size = num_buffers * sizeof(io_uring_buf);
+    void *ring_memory = mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring_memory == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate the io_uring buffer ring: " + std::string(strerror(errno)));
+    }
+    // io_uring_buf_ring is not used directly: its flexible array member gets an 8 byte offset when compiled as
+    // C++, so index the entries as a plain array. The ring tail overlays the resv field of the first entry.
+    buffer_ring = static_cast<io_uring_buf *>(ring_memory);
+    buffer_ring_tail = &buffer_ring[0].resv;
+    buffer_ring_mask = num_buffers - 1;
+    struct io_uring_buf_reg reg {};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buffer_ring);
+    reg.ring_entries = num_buffers;
+    reg.bgid = buffer_group;
+    if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        throw std::runtime_error("Kernel does not support io_uring provided buffer rings: " +
+                                 std::string(strerror(errno)));
+    }
+    buffers.resize(num_buffers * buffer_size);
+    for (unsigned int i = 0; i < num_buffers; i++) {
+        recycleBuffer((uint16_t) i);
+    }
+}
+
+IoUring::~IoUring()
+{
+    release();
+}
+
+void IoUring::release()
+{
+    // Closing the ring releases the registered buffer ring as well
+    if (ring_fd >= 0) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    if (buffer_ring != nullptr) {
+        munmap(buffer_ring, buffer_ring_size);
+        buffer_ring = nullptr;
+    }
+    if (sqes != nullptr) {
+        munmap(sqes, sqes_size);
+        sqes = nullptr;
+    }
+    if (cq_ring != nullptr && cq_ring != sq_ring) {
+        munmap(cq_ring, cq_ring_size);
+    }
+    cq_ring = nullptr;
+    if (sq_ring != nullptr) {
+        munmap(sq_ring, sq_ring_size);
+        sq_ring = nullptr;
+    }
+}
+
+auto IoUring::getSqe() -> io_uring_sqe *
+{
+    unsigned int head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sq_local_tail - head >= params.sq_entries) {
+        return nullptr;
+    }
+    unsigned int index = sq_local_tail & sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    sq_local_tail++;
+    return sqe;
+}
+
+auto IoUring::submitAndWait(unsigned int wait_nr, const struct timespec *timeout) -> int
+{
+    unsigned int to_submit = sq_local_tail - *sq_tail;
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    unsigned int flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = 0;
+    if (timeout != nullptr) {
+        struct __kernel_timespec ts {};
+        ts.tv_sec = timeout->tv_sec;
+        ts.tv_nsec = timeout->tv_nsec;
+        struct io_uring_getevents_arg arg {};
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        ret = io_uring_enter(ring_fd, to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        ret = io_uring_enter(ring_fd, to_submit, wait_nr, flags, nullptr, _NSIG / 8);
+    }
+    return ret < 0 ? -errno : ret;
+}
+
+auto IoUring::peekCqe() -> io_uring_cqe *
+{
+    unsigned int head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+    return &cqes[head & cq_mask];
+}
+
+void IoUring::cqeSeen()
+{
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+auto IoUring::getBufferGroup() const -> uint16_t
+{
+    return buffer_group;
+}
+
+auto IoUring::getBuffer(uint16_t buffer_id) -> uint8_t *
+{
+    return &buffers[buffer_id * buffer_size];
+}
+
+void IoUring::recycleBuffer(uint16_t buffer_id)
+{
+    uint16_t tail = *buffer_ring_tail;
+    io_uring_buf *buf = &buffer_ring[tail & buffer_ring_mask];
+    buf->addr = reinterpret_cast<uint64_t>(getBuffer(buffer_id));
+    buf->len = (uint32_t) buffer_size;
+    buf->bid = buffer_id;
+    __atomic_store_n(buffer_ring_tail, (uint16_t) (tail + 1), __ATOMIC_RELEASE);
+}
+#endif // TWAMP_IO_URING
@@ -0,0 +1,150 @@
+#include "MetricsEndpoint.h"
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+constexpr int METRICS_POLL_MILLISECONDS = 100;
+constexpr int METRICS_LISTEN_BACKLOG = 16;
+constexpr size_t METRICS_REQUEST_BUFFER_SIZE = 4096;
+static_assert(CPU_SAMPLE_INTERVAL == 1024, "The CPU sample help texts name the interval");
+
+auto format_prometheus_metrics(const ServerCounters &counters, const DelayHistogram &histogram) -> std::string
+{
+    std::ostringstream os;
+    write_prometheus_counter(
+        os, "twamp_reflector_received_packets_total", "Test packets received.", counters.received_packets);
+    write_prometheus_counter(
+        os, "twamp_reflector_reflected_packets_total", "Test packets reflected.", counters.reflected_packets);
+    write_prometheus_counter(os,
+                             "twamp_reflector_truncated_packets_total",
+                             "Datagrams larger than the receive buffer, dropped truncated.",
+                             counters.truncated_packets);
+    write_prometheus_counter(os,
+                             "twamp_reflector_rate_limited_packets_total",
+                             "Test packets dropped by the per-source rate limit.",
+                             counters.rate_limited_packets);
+    write_prometheus_counter(
+        os, "twamp_reflector_send_errors_total", "Reflections the kernel refused to send.", counters.send_errors);
+    write_prometheus_counter(
+        os, "twamp_reflector_receive_calls_total", "Receive system calls made.", counters.receive_calls);
+    write_prometheus_counter(os, "twamp_reflector_send_calls_total", "Send system calls made.", counters.send_calls);
+    write_prometheus_counter(os,
+                             "twamp_reflector_dropped_log_records_total",
+                             "Per-packet output lines dropped because the log writer fell behind.",
+                             counters.dropped_log_records);
+    write_prometheus_counter(os,
+                             "twamp_reflector_missed_tx_timestamps_total",
+                             "Reflections reported with the send time taken before the send.",
+                             counters.missed_tx_timestamps);
+    write_prometheus_counter(os,
+                             "twamp_reflector_own_cpu_samples_total",
+                             "SO_INCOMING_CPU samples, one per 1024 test packets, that found the packet on the "
+                             "reflector's CPU, with --steer-cpu.",
+                             counters.own_cpu_samples);
+    write_prometheus_counter(os,
+                             "twamp_reflector_other_cpu_samples_total",
+                             "SO_INCOMING_CPU samples, one per 1024 test packets, that found the packet on another CPU "
+                             "than the reflector's, with --steer-cpu.",
+                             counters.other_cpu_samples);
+    write_prometheus_histogram(os,
+                               "twamp_reflector_internal_delay_seconds",
+                               "Time from receiving a test packet to sending its reflection.",
+                               histogram);
+    return os.str();
+}
+
+MetricsEndpoint::MetricsEndpoint(std::string path, std::vector<const Server *> servers)
+    : path(std::move(path)), servers(std::move(servers))
+{
+    struct sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (this->path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Metrics socket path is too long: " + this->path);
+    }
+    memcpy(addr.sun_path, this->path.c_str(), this->path.size() + 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        throw std::runtime_error("Cannot create the metrics socket: " + std::string(strerror(errno)));
+    }
+    // A socket file left behind by an earlier run would make bind fail. Anything else at the path is left alone, and
+    // bind reports it.
+    struct stat st {};
+    if (lstat(this->path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(this->path.c_str());
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(fd, METRICS_LISTEN_BACKLOG) != 0) {
+        std::string error = strerror(errno);
+        close(fd);
+        throw std::runtime_error("Cannot listen on the metrics socket " + this->path + ": " + error);
+    }
+    thread = std::thread(&MetricsEndpoint::run, this);
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+    stopping = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    close(fd);
+    unlink(path.c_str());
+}
+
+void MetricsEndpoint::run()
+{
+    while (!stopping) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, METRICS_POLL_MILLISECONDS) <= 0) {
+            continue;
+        }
+        int client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            continue;
+        }
+        serve(client_fd);
+        close(client_fd);
+    }
+}
+
+void MetricsEndpoint::serve(int client_fd) const
+{
+    // Whatever was asked for, the answer is the same; only wait briefly for the request so a client that sends
+    // nothing, like socat, gets its answer too
+    std::array<char, METRICS_REQUEST_BUFFER_SIZE> request{};
+    struct pollfd pfd = {client_fd, POLLIN, 0};
+    if (poll(&pfd, 1, METRICS_POLL_MILLISECONDS) > 0) {
+        (void) recv(client_fd, request.data(), request.size(), MSG_DONTWAIT);
+    }
+
+    std::string body = render();
+    std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t result = send(client_fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            return;
+        }
+        sent += (size_t) result;
+    }
+}
+
+auto MetricsEndpoint::render() const -> std::string
+{
+    ServerCounters counters;
+    DelayHistogram histogram;
+    for (const Server *server : servers) {
+        counters += server->getCounters();
+        histogram += server->getDelayHistogram();
+    }
+    return format_prometheus_metrics(counters, histogram);
+}
@@ -0,0 +1,172 @@
+#include "MultiServer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+constexpr int MILLISECONDS_IN_SECOND = 1000;
+constexpr size_t MAX_EPOLL_EVENTS = 64;
+constexpr uint64_t MICROSECONDS_IN_MILLISECOND = 1000;
+
+static auto parse_port(const std::string &input, uint16_t &port) -> bool
+{
+    char *endptr = nullptr;
+    int64_t tmpport = strtol(input.c_str(), &endptr, 10);
+    if (input.empty() || *endptr != '\0' || tmpport <= 0 || tmpport >= 65536) {
+        return false;
+    }
+    port = (uint16_t) tmpport;
+    return true;
+}
+
+auto parse_listen_address(const std::string &input, ListenAddress &address) -> bool
+{
+    size_t colon_pos = input.rfind(':');
+    if (colon_pos == std::string::npos) {
+        return false;
+    }
+    std::string host = input.substr(0, colon_pos);
+    std::string ports = input.substr(colon_pos + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    address.ip_version = host.find(':') != std::string::npos ? 6 : 4;
+    address.host = host;
+
+    size_t dash_pos = ports.find('-');
+    if (dash_pos == std::string::npos) {
+        if (!parse_port(ports, address.first_port)) {
+            return false;
+        }
+        address.last_port = address.first_port;
+        return true;
+    }
+    return parse_port(ports.substr(0, dash_pos), address.first_port) &&
+           parse_port(ports.substr(dash_pos + 1), address.last_port) && address.first_port <= address.last_port;
+}
+
+MultiServer::MultiServer(const Args &args) : args(args)
+{
+    for (const ListenAddress &address : args.listen_addresses) {
+        for (uint32_t port = address.first_port; port <= address.last_port; port++) {
+            if (servers.size() == MAX_LISTEN_SOCKETS) {
+                throw std::runtime_error("Too many listening sockets, at most " + std::to_string(MAX_LISTEN_SOCKETS) +
+                                         " are supported");
+            }
+            Args socket_args = args;
+            socket_args.listen_addresses.clear();
+            socket_args.local_host = address.host;
+            socket_args.local_port = std::to_string(port);
+            socket_args.ip_version = address.ip_version;
+            // An IPv6 wildcard would otherwise claim the IPv4 wildcard on the same port too
+            socket_args.v6_only = true;
+            servers.push_back(std::make_unique<Server>(socket_args));
+            servers.back()->shareSampleCounter(&sample_counter);
+            std::string host = address.host.empty() ? "*" : address.host;
+            labels.push_back(address.ip_version == 6 ? "[" + host + "]:" + socket_args.local_port
+                                                     : host + ":" + socket_args.local_port);
+        }
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        throw std::runtime_error("epoll_create1 failed: " + std::string(strerror(errno)));
+    }
+    for (size_t i = 0; i < servers.size(); i++) {
+        struct epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, servers[i]->getSocket(), &event) != 0) {
+            throw std::runtime_error("epoll_ctl failed: " + std::string(strerror(errno)));
+        }
+    }
+}
+
+MultiServer::~MultiServer()
+{
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+}
+
+auto MultiServer::run() -> int
+{
+    for (auto &server : servers) {
+        server->startListening();
+    }
+    // All sockets share args.cpu and args.realtime_priority, and this thread serves them all
+    servers.front()->tuneReflectorThread();
+    std::vector<struct epoll_event> events(std::min(servers.size(), MAX_EPOLL_EVENTS));
+    int timeout_ms = args.timeout == 0 ? -1 : args.timeout * MILLISECONDS_IN_SECOND;
+    int wait_ms = timeout_ms;
+    if (args.log_format == LogFormat::Binary && !args.async_log) {
+        // Wake up at least once per flush interval, so idle sockets still write out their buffered records
+        auto flush_ms = (int) (BINARY_LOG_FLUSH_INTERVAL_USEC / MICROSECONDS_IN_MILLISECOND);
+        wait_ms = timeout_ms == -1 ? flush_ms : std::min(timeout_ms, flush_ms);
+    }
+    uint64_t last_event_usec = get_usec();
+    int result = 0;
+    bool done = false;
+    while (!done) {
+        int ready = epoll_wait(epoll_fd, events.data(), (int) events.size(), wait_ms);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << strerror(errno) << std::endl;
+            result = 1;
+            break;
+        }
+        for (auto &server : servers) {
+            server->flushIdleLog();
+        }
+        if (ready == 0) {
+            bool timed_out =
+                timeout_ms != -1 && get_usec() - last_event_usec >= (uint64_t) timeout_ms * MICROSECONDS_IN_MILLISECOND;
+            if (!timed_out) {
+                continue;
+            }
+            std::cerr << "Socket timed out." << std::endl;
+            result = EAGAIN;
+            break;
+        }
+        last_event_usec = get_usec();
+        for (int i = 0; i < ready; i++) {
+            // Level triggered, so a socket left with datagrams after its share is reported again
+            ReceiveStatus status = servers[events[i].data.u64]->drainSocket();
+            if (status == ReceiveStatus::Failed) {
+                result = 1;
+                done = true;
+            } else if (status == ReceiveStatus::Done) {
+                done = true;
+            }
+        }
+    }
+    for (auto &server : servers) {
+        server->finishListening();
+    }
+    return result;
+}
+
+void MultiServer::printCounters() const
+{
+    ServerCounters total;
+    for (size_t i = 0; i < servers.size(); i++) {
+        const ServerCounters &counters = servers[i]->getCounters();
+        Server::printCounters(counters, labels[i] + ": ");
+        total += counters;
+    }
+    Server::printCounters(total, "Total: ");
+}
+
+auto MultiServer::getServers() const -> std::vector<const Server *>
+{
+    std::vector<const Server *> result;
+    for (const auto &server : servers) {
+        result.push_back(server.get());
+    }
+    return result;
+}
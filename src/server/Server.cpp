@@ -3,20 +3,75 @@
 //
 
 #include "Server.h"
+#include "IoUring.h"
+#include "reflect.h"
 #include "utils.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <array>
+#include <chrono>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <vector>
 
 // Constants
-constexpr uint16_t ERROR_ESTIMATE_DEFAULT_BITMAP = 0x8001; // Sync = 1, Multiplier = 1
+constexpr size_t CONTROL_BUFFER_SIZE = 1024;
+constexpr size_t LOG_WRITER_BATCH_SIZE = 256;
+// Binary log records are appended to the file this many at a time, or at least once a second
+constexpr size_t BINARY_LOG_BUFFER_RECORDS = 256;
+constexpr std::chrono::milliseconds LOG_WRITER_IDLE_SLEEP(1);
 
-constexpr double MICROSECONDS_TO_SECONDS = 1e-6;
+constexpr uint64_t MICROSECONDS_IN_SECOND = 1000000;
+constexpr uint64_t SESSION_SWEEP_INTERVAL_USEC = MICROSECONDS_IN_SECOND;
+// Receive calls one socket gets per readiness event of an external event loop
+constexpr size_t DRAIN_RECEIVE_CALLS = 64;
+
+#ifdef TWAMP_IO_URING
+constexpr unsigned int IO_URING_ENTRIES = 512;
+constexpr unsigned int IO_URING_BUFFERS = 256; // Provided buffer rings must be a power of two
+constexpr uint16_t IO_URING_BUFFER_GROUP = 0;
+constexpr uint64_t IO_URING_RECEIVE_TAG = UINT64_MAX;
+constexpr uint64_t IO_URING_CANCEL_TAG = UINT64_MAX - 1;
+// Upper bound on how long the engine sleeps before looking at the stop flag and the idle timeout
+constexpr long IO_URING_WAIT_NANOSECONDS = 100000000;
+
+/* A reply being sent. It is reflected in place in its provided buffer, which is only recycled once the kernel
+ * completes the send. */
+struct IoUringSendSlot {
+    ReflectorPacket *packet;
+    uint16_t buffer_id;
+    struct iovec iov;
+    struct msghdr message;
+};
+#endif
+
+/* Receive buffers, allocated once and reused for every datagram. Each test packet is reflected in place in the
+ * buffer it arrived in and sent back from there, so there is no per-packet zeroing or copying. */
+struct BatchBuffers {
+    explicit BatchBuffers(size_t batch_size)
+        : buffers(batch_size), controls(batch_size), src_addrs(batch_size), iovs(batch_size), messages(batch_size),
+          replies(batch_size)
+    {
+    }
+    std::vector<ReflectorPacket> buffers;
+    std::vector<std::array<char, CONTROL_BUFFER_SIZE>> controls;
+    std::vector<struct sockaddr_in6> src_addrs;
+    std::vector<struct iovec> iovs;
+    std::vector<struct mmsghdr> messages;
+    std::vector<struct mmsghdr> replies;
+};
+
+// Workers share stdout, so lines and the header are written under one lock
+static std::mutex output_mutex;
+static bool header_printed = false;
 
 Server::Server(const Args &args) : args(args)
 {
@@ -51,80 +106,898 @@ Server::Server(const Args &args) : args(args)
     // Setup the socket options, to be able to receive TTL and TOS
     set_socket_options(fd, HDR_TTL, args.timeout);
     set_socket_tos(fd, args.snd_tos);
+    if (args.tx_timestamp && !enable_tx_timestamping(fd)) {
+        std::exit(EXIT_FAILURE);
+    }
+    if (args.v6_only && res->ai_family == AF_INET6) {
+        // Leaves the IPv4 wildcard on the same port to a separate IPv4 socket
+        int one = 1;
+        if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one)) != 0) {
+            std::cerr << "[PROBLEM] Cannot set IPV6_V6ONLY: " << strerror(errno) << std::endl;
+        }
+    }
+    if (args.busy_poll > 0) {
+        // Lets the receive calls poll the device queue for this long instead of waiting for its interrupt
+        int busy_poll = (int) args.busy_poll;
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) != 0) {
+            std::cerr << "[PROBLEM] Cannot set SO_BUSY_POLL, spinning without it: " << strerror(errno) << std::endl;
+        }
+    }
+    if (args.steer_cpu && args.cpu >= 0) {
+        // Tells the reuseport group which CPU this socket serves, for kernels that steer by it
+        if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &args.cpu, sizeof(args.cpu)) != 0) {
+            std::cerr << "[PROBLEM] Cannot set SO_INCOMING_CPU: " << strerror(errno) << std::endl;
+        }
+    }
+    if (args.reuse_port) {
+        // Let several workers bind the same address and have the kernel spread the flows between them
+        int one = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+            std::cerr << "[PROBLEM] Cannot set SO_REUSEPORT: " << strerror(errno) << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
     // Bind the socket
     if (bind(fd, res->ai_addr, res->ai_addrlen) == -1) {
         std::cerr << strerror(errno) << std::endl;
         std::exit(EXIT_FAILURE);
     }
     freeaddrinfo(res);
+    // Parsed once here instead of for every reflected packet
+    local_port = (uint16_t) std::stoi(args.local_port);
+    if (args.log_format == LogFormat::Binary) {
+        binary_log = BinaryLogWriter::shared(args.log_file);
+        binary_log_buffer.reserve(BINARY_LOG_BUFFER_RECORDS);
+        if (flushesLogWhenIdle()) {
+            // The receive calls must return now and then to flush the buffer of an idle server, so listenBlocking
+            // keeps the idle timeout itself
+            struct timeval flush_timeout = {(time_t) (BINARY_LOG_FLUSH_INTERVAL_USEC / MICROSECONDS_IN_SECOND),
+                                            (suseconds_t) (BINARY_LOG_FLUSH_INTERVAL_USEC % MICROSECONDS_IN_SECOND)};
+            if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &flush_timeout, sizeof(flush_timeout)) != 0) {
+                std::cerr << "[PROBLEM] Cannot bound the receive timeout, the binary log is flushed on packets only: "
+                          << strerror(errno) << std::endl;
+            }
+        }
+    }
 }
 
 Server::~Server()
 {
+    stopLogWriter();
     if (fd != -1) {
         close(fd);
     }
 }
 
+auto Server::getSocket() const -> int
+{
+    return fd;
+}
+
+auto Server::getCounters() const -> const ServerCounters &
+{
+    return counters;
+}
+
+auto Server::getDelayHistogram() const -> const DelayHistogram &
+{
+    return delay_histogram;
+}
+
+void Server::stop()
+{
+    stopping = true;
+    // Wakes up a worker blocked in recvmsg; this returns ENOTCONN on UDP but still flags the socket as shut down
+    shutdown(fd, SHUT_RD);
+}
+
+void Server::shareSampleCounter(std::atomic<uint32_t> *shared_counter)
+{
+    sample_counter = shared_counter;
+}
+
+/* Claims one sample from the num_samples budget. Returns false when the budget is exhausted. */
+auto Server::countSample() -> bool
+{
+    if (args.num_samples == 0) {
+        return true;
+    }
+    return sample_counter->fetch_add(1) < args.num_samples;
+}
+
+auto Server::samplesRemaining() const -> uint32_t
+{
+    if (args.num_samples == 0) {
+        return UINT32_MAX;
+    }
+    uint32_t counted = sample_counter->load();
+    return counted >= args.num_samples ? 0 : args.num_samples - counted;
+}
+
+void Server::printCounters(const ServerCounters &counters, const std::string &label)
+{
+    double reflections_per_call = 0;
+    if (counters.send_calls > 0) {
+        reflections_per_call = (double) counters.reflected_packets / (double) counters.send_calls;
+    }
+    std::cerr << label << "Received " << counters.received_packets << " packets in " << counters.receive_calls
+              << " receive calls, reflected " << counters.reflected_packets << " packets in " << counters.send_calls
+              << " send calls (" << std::fixed << std::setprecision(2) << reflections_per_call
+              << " reflections per call), " << counters.truncated_packets << " truncated, " << counters.send_errors
+              << " send errors, " << counters.dropped_log_records
+              << " log records dropped, " << counters.missed_tx_timestamps << " TX timestamps missed, "
+              << counters.rate_limited_packets << " rate limited";
+    if (counters.own_cpu_samples > 0 || counters.other_cpu_samples > 0) {
+        std::cerr << ", CPU samples (1 per " << CPU_SAMPLE_INTERVAL << " packets): " << counters.own_cpu_samples
+                  << " on the reflector's CPU, " << counters.other_cpu_samples << " on other CPUs";
+    }
+    std::cerr << std::endl;
+}
+
+void Server::printDelayHistogram(const DelayHistogram &histogram, const std::string &label)
+{
+    write_delay_histogram(std::cerr, histogram, label + "Internal delay");
+}
+
 auto Server::listen() -> int
 {
-    // Read incoming datagrams
-    uint32_t counter = 0;
-    while (true) {
-        if (args.num_samples != 0) {
-            counter++;
-            if (counter > args.num_samples) {
-                break;
-            }
-        }
-        std::array<char, sizeof(ClientPacket)> buffer{}; // We should only be receiving test_packets
-        std::array<char, 1024> control{};
-        struct sockaddr_in6 src_addr = {};
+#ifndef TWAMP_IO_URING
+    if (args.io_uring) {
+        std::cerr << "This build does not include the io_uring engine." << std::endl;
+        return 1;
+    }
+#endif
+    startListening();
+    // After the log writer started, so only the reflecting thread is pinned and raised
+    tuneReflectorThread();
+    int result = 0;
+    if (args.io_uring) {
+#ifdef TWAMP_IO_URING
+        result = listenIoUring();
+#endif
+    } else {
+        result = listenBlocking();
+    }
+    finishListening();
+    return result;
+}
 
-        std::array<struct iovec, 1> iov{};
-        iov[0].iov_base = static_cast<void *>(buffer.data());
-        iov[0].iov_len = buffer.size();
-        timespec incoming_timestamp{};
-        timespec *incoming_timestamp_ptr = &incoming_timestamp;
+void Server::startListening()
+{
+    last_binary_log_flush_usec = get_usec();
+    if (args.async_log) {
+        startLogWriter();
+    }
+}
+
+void Server::finishListening()
+{
+    // Flush whatever the writer has not printed yet before the caller reports the counters
+    stopLogWriter();
+    counters.dropped_log_records += flushBinaryLog();
+    if (args.steer_cpu && incoming_cpu_sampler.finish()) {
+        sampleIncomingCpu();
+    }
+    if (args.stateful) {
+        printSessions();
+    }
+    if (args.rate_limit > 0) {
+        printRateLimits();
+    }
+}
+
+auto Server::receive(int flags) -> ReceiveStatus
+{
+    if (!batch) {
+        batch = std::make_unique<BatchBuffers>(args.batch_size);
+    }
+    return args.batch_size > 1 ? receiveBatch(flags) : receiveSingle(flags);
+}
+
+/* Counts packets admitted for reflection towards the next CPU sample. Reading SO_INCOMING_CPU costs a system call,
+ * so it is only done once every CPU_SAMPLE_INTERVAL packets. */
+void Server::countIncomingCpu(size_t packets)
+{
+    if (args.steer_cpu && incoming_cpu_sampler.count(packets)) {
+        sampleIncomingCpu();
+    }
+}
+
+/* Counts one sample for the CPU whose softirq queued the latest packet to the socket */
+void Server::sampleIncomingCpu()
+{
+    int incoming_cpu = -1;
+    socklen_t len = sizeof(incoming_cpu);
+    if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &incoming_cpu, &len) != 0) {
+        return;
+    }
+    if (incoming_cpu == args.cpu) {
+        counters.own_cpu_samples++;
+    } else {
+        counters.other_cpu_samples++;
+    }
+}
 
-        struct msghdr message =
-            make_msghdr(iov.data(), 1, &src_addr, sizeof(src_addr), control.data(), sizeof(control));
+void Server::tuneReflectorThread()
+{
+    if (args.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(args.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            std::cerr << "[PROBLEM] Cannot pin the reflector to CPU " << args.cpu << ": " << strerror(errno)
+                      << std::endl;
+        }
+    }
+    if (args.realtime_priority > 0) {
+        struct sched_param param {};
+        param.sched_priority = args.realtime_priority;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            std::cerr << "[PROBLEM] Cannot switch the reflector to SCHED_FIFO: " << strerror(err) << std::endl;
+        }
+    }
+}
 
-        ssize_t payload_len = recvmsg(fd, &message, 0);
-        get_kernel_timestamp(message, incoming_timestamp_ptr);
-        if (payload_len == -1) {
-            if (errno == 11) {
-                std::cerr << "Socket timed out." << std::endl;
-                // std::exit(EXIT_FAILURE);
-                return 11;
+/* Blocks in the receive calls, relying on SO_RCVTIMEO for the idle timeout. With args.busy_poll it spins on
+ * non-blocking receives instead, so no wakeup sits between the datagram's arrival and its reflection. */
+auto Server::listenBlocking() -> int
+{
+    // recvmmsg blocks for the first datagram only, then takes whatever else is already queued
+    int flags = args.batch_size > 1 ? MSG_WAITFORONE : 0;
+    if (args.busy_poll > 0) {
+        flags = MSG_DONTWAIT;
+    }
+    uint64_t last_received_usec = get_usec();
+    while (!stopping && samplesRemaining() > 0) {
+        ReceiveStatus status = receive(flags);
+        if (status == ReceiveStatus::WouldBlock) {
+            flushIdleLog();
+        }
+        if (args.busy_poll > 0 || flushesLogWhenIdle()) {
+            // Spinning, or waking up to flush the log, so the idle timeout is kept here rather than by SO_RCVTIMEO
+            uint64_t now_usec = get_usec();
+            if (status != ReceiveStatus::WouldBlock) {
+                last_received_usec = now_usec;
+            } else if (args.timeout == 0 || now_usec - last_received_usec < args.timeout * MICROSECONDS_IN_SECOND) {
+                continue;
             }
-            std::cerr << strerror(errno) << std::endl;
+        }
+        if (status == ReceiveStatus::WouldBlock) {
+            std::cerr << "Socket timed out." << std::endl;
+            return EAGAIN;
+        }
+        if (status == ReceiveStatus::Failed) {
             return 1;
         }
+        if (status == ReceiveStatus::Done) {
+            break;
+        }
+    }
+    return 0;
+}
+
+auto Server::drainSocket() -> ReceiveStatus
+{
+    // Bounded, so one busy socket cannot starve the others sharing the event loop
+    for (size_t i = 0; i < DRAIN_RECEIVE_CALLS; i++) {
+        if (stopping || samplesRemaining() == 0) {
+            return ReceiveStatus::Done;
+        }
+        ReceiveStatus status = receive(MSG_DONTWAIT);
+        if (status != ReceiveStatus::Received) {
+            return status;
+        }
+    }
+    return ReceiveStatus::Received;
+}
+
+/* Receives and reflects one datagram with recvmsg/sendmsg */
+auto Server::receiveSingle(int flags) -> ReceiveStatus
+{
+    // We should only be receiving test packets, and the kernel fills in whatever is read back, so the pooled
+    // buffers are not cleared between datagrams
+    ReflectorPacket *packet = &batch->buffers[0];
+    struct sockaddr_in6 &src_addr = batch->src_addrs[0];
+    struct iovec &iov = batch->iovs[0];
+    iov.iov_base = packet;
+    iov.iov_len = sizeof(*packet);
+    timespec incoming_timestamp{};
+    timespec *incoming_timestamp_ptr = &incoming_timestamp;
+
+    struct msghdr message =
+        make_msghdr(&iov, 1, &src_addr, sizeof(src_addr), batch->controls[0].data(), CONTROL_BUFFER_SIZE);
+
+    ssize_t payload_len = recvmsg(fd, &message, flags);
+    counters.receive_calls++;
+    if (stopping) {
+        return ReceiveStatus::Done;
+    }
+    get_kernel_timestamp(message, incoming_timestamp_ptr);
+    if (payload_len == -1) {
+        if (errno == EAGAIN) {
+            return ReceiveStatus::WouldBlock;
+        }
+        std::cerr << strerror(errno) << std::endl;
+        return ReceiveStatus::Failed;
+    }
+    if (args.rate_limit > 0 && !admitPacket(reinterpret_cast<sockaddr *>(&src_addr))) {
+        return ReceiveStatus::Received;
+    }
+    if (!countSample()) {
+        return ReceiveStatus::Done;
+    }
+    counters.received_packets++;
+    countIncomingCpu(1);
+    if ((message.msg_flags & MSG_TRUNC) != 0) {
+        counters.truncated_packets++;
+        std::cout << "Datagram too large for buffer: truncated" << std::endl;
+    } else {
+        handleTestPacket(packet, message, payload_len, incoming_timestamp_ptr);
+    }
+    return ReceiveStatus::Received;
+}
+
+/* Receives up to batch_size datagrams with one recvmmsg and reflects them with a single sendmmsg */
+auto Server::receiveBatch(int flags) -> ReceiveStatus
+{
+    std::vector<ReflectorPacket> &buffers = batch->buffers;
+    std::vector<struct sockaddr_in6> &src_addrs = batch->src_addrs;
+    std::vector<struct iovec> &iovs = batch->iovs;
+    std::vector<struct mmsghdr> &messages = batch->messages;
+    std::vector<struct mmsghdr> &replies = batch->replies;
+
+    size_t to_receive = std::min((size_t) args.batch_size, (size_t) samplesRemaining());
+    for (size_t i = 0; i < to_receive; i++) {
+        iovs[i].iov_base = static_cast<void *>(&buffers[i]);
+        iovs[i].iov_len = sizeof(ReflectorPacket);
+        // The kernel overwrites the name and control lengths, so they must be reset before every call
+        messages[i].msg_hdr = make_msghdr(
+            &iovs[i], 1, &src_addrs[i], sizeof(src_addrs[i]), batch->controls[i].data(), CONTROL_BUFFER_SIZE);
+        messages[i].msg_len = 0;
+    }
+
+    int received = recvmmsg(fd, messages.data(), (unsigned int) to_receive, flags, nullptr);
+    counters.receive_calls++;
+    if (stopping) {
+        return ReceiveStatus::Done;
+    }
+    if (received == -1) {
+        if (errno == EAGAIN) {
+            return ReceiveStatus::WouldBlock;
+        }
+        std::cerr << strerror(errno) << std::endl;
+        return ReceiveStatus::Failed;
+    }
+
+    bool budget_exhausted = false;
+    size_t admitted = 0;
+    size_t num_replies = 0;
+    for (size_t i = 0; i < (size_t) received; i++) {
+        // Over-budget sources are dropped before they cost a sample or any reflection work
+        if (args.rate_limit > 0 && !admitPacket(reinterpret_cast<sockaddr *>(&src_addrs[i]))) {
+            continue;
+        }
+        if (!countSample()) {
+            budget_exhausted = true;
+            break;
+        }
+        counters.received_packets++;
+        admitted++;
+        msghdr &message = messages[i].msg_hdr;
         if ((message.msg_flags & MSG_TRUNC) != 0) {
+            counters.truncated_packets++;
             std::cout << "Datagram too large for buffer: truncated" << std::endl;
+            continue;
+        }
+        timespec incoming_timestamp{};
+        get_kernel_timestamp(message, &incoming_timestamp);
+        reflectPacket(&buffers[i], message, &incoming_timestamp);
+        if (args.stateful) {
+            trackSession(buffers[i], message);
+        }
+
+        // The reply goes out of the receive buffer, trimmed to the length that came in
+        iovs[i].iov_len = messages[i].msg_len;
+        replies[num_replies].msg_hdr = make_msghdr(&iovs[i], 1, &src_addrs[i], message.msg_namelen, nullptr, 0);
+        replies[num_replies].msg_len = 0;
+        num_replies++;
+    }
+    countIncomingCpu(admitted);
+
+    // sendmmsg may send only part of the batch, so keep going until all replies are out
+    size_t sent_total = 0;
+    size_t num_sent = 0;
+    while (sent_total < num_replies) {
+        int sent = sendmmsg(fd, &replies[sent_total], (unsigned int) (num_replies - sent_total), 0);
+        counters.send_calls++;
+        if (sent == -1) {
+            std::cerr << strerror(errno) << std::endl;
+            // Skip the datagram that failed and carry on with the rest of the batch
+            counters.send_errors++;
+            sent_total++;
+            continue;
+        }
+        counters.reflected_packets += (uint64_t) sent;
+        sent_total += (size_t) sent;
+        num_sent += (size_t) sent;
+    }
+    if (args.stateful) {
+        for (size_t i = 0; i < num_replies; i++) {
+            if (replies[i].msg_len > 0) {
+                sessionReflected(replies[i].msg_hdr);
+            }
+        }
+    }
+    if (args.tx_timestamp) {
+        // Failed datagrams have no msg_len and took no error queue id, so the stamps line up with the rest
+        collectTxTimestamps(num_sent);
+        size_t stamp_index = 0;
+        for (size_t i = 0; i < num_replies; i++) {
+            if (replies[i].msg_len > 0) {
+                applyTxTimestamp(*static_cast<ReflectorPacket *>(replies[i].msg_hdr.msg_iov->iov_base),
+                                 tx_timestamps[stamp_index++]);
+            }
+        }
+    }
+    // Logging waits until the whole batch is on the wire
+    for (size_t i = 0; i < num_replies; i++) {
+        const struct iovec *reply_iov = replies[i].msg_hdr.msg_iov;
+        recordMetrics(*static_cast<ReflectorPacket *>(reply_iov->iov_base),
+                      replies[i].msg_hdr,
+                      (ssize_t) reply_iov->iov_len);
+    }
+    return budget_exhausted ? ReceiveStatus::Done : ReceiveStatus::Received;
+}
+
+#ifdef TWAMP_IO_URING
+/* Reflects through io_uring: one multishot recvmsg fills provided buffers and every reflection is queued as a
+ * sendmsg, so a single io_uring_enter both submits the pending replies and reaps the next receives. */
+auto Server::listenIoUring() -> int
+{
+    const size_t buffer_size =
+        sizeof(io_uring_recvmsg_out) + sizeof(struct sockaddr_in6) + CONTROL_BUFFER_SIZE + sizeof(ClientPacket);
+    // Only the name and control lengths are used: the kernel lays out a io_uring_recvmsg_out header,
+    // the source address, the control messages and the payload in that order in each provided buffer.
+    struct msghdr receive_template {};
+    receive_template.msg_namelen = sizeof(struct sockaddr_in6);
+    receive_template.msg_controllen = CONTROL_BUFFER_SIZE;
+
+    std::vector<IoUringSendSlot> send_slots(IO_URING_ENTRIES);
+    std::vector<uint32_t> free_slots;
+    free_slots.reserve(send_slots.size());
+    for (uint32_t i = 0; i < send_slots.size(); i++) {
+        free_slots.push_back(i);
+    }
+    // Declared after the receive template and the send slots, so it is closed before the memory its requests use
+    IoUring ring(IO_URING_ENTRIES, IO_URING_BUFFERS, buffer_size, IO_URING_BUFFER_GROUP);
+    size_t sends_in_flight = 0;
+    size_t sends_queued = 0;
+    bool receive_armed = false;
+    bool budget_exhausted = false;
+    uint64_t last_activity_usec = get_usec();
+    int result = 0;
+
+    auto get_sqe = [&]() -> io_uring_sqe * {
+        io_uring_sqe *sqe = ring.getSqe();
+        if (sqe == nullptr) {
+            // Submission queue full: push what is queued to the kernel without waiting
+            ring.submitAndWait(0, nullptr);
+            counters.send_calls++;
+            sends_queued = 0;
+            sqe = ring.getSqe();
+        }
+        return sqe;
+    };
+    // Completion of a reflected packet, which is only logged now that it has been sent
+    auto complete_send = [&](uint64_t slot_index, int res) {
+        IoUringSendSlot &slot = send_slots[slot_index];
+        sends_in_flight--;
+        if (res < 0) {
+            counters.send_errors++;
+            std::cerr << strerror(-res) << std::endl;
         } else {
-            auto *rec = static_cast<ClientPacket *>(static_cast<void *>(buffer.data()));
-            handleTestPacket(rec, message, payload_len, incoming_timestamp_ptr);
+            counters.reflected_packets++;
+            if (args.stateful) {
+                sessionReflected(slot.message);
+            }
+        }
+        recordMetrics(*slot.packet, slot.message, (ssize_t) slot.iov.iov_len);
+        ring.recycleBuffer(slot.buffer_id);
+        free_slots.push_back((uint32_t) slot_index);
+    };
+
+    while (!stopping && result == 0 && (!budget_exhausted || sends_in_flight > 0)) {
+        // Other workers sharing the sample counter may have used up the budget
+        budget_exhausted = budget_exhausted || samplesRemaining() == 0;
+        if (!receive_armed && !budget_exhausted) {
+            io_uring_sqe *sqe = get_sqe();
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&receive_template);
+            sqe->len = 1;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = ring.getBufferGroup();
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->user_data = IO_URING_RECEIVE_TAG;
+            receive_armed = true;
+        }
+        struct timespec wait = {0, IO_URING_WAIT_NANOSECONDS};
+        int ret = ring.submitAndWait(1, &wait);
+        counters.receive_calls++;
+        if (sends_queued > 0) {
+            counters.send_calls++;
+            sends_queued = 0;
+        }
+        if (ret < 0 && ret != -ETIME && ret != -EINTR) {
+            std::cerr << "io_uring_enter: " << strerror(-ret) << std::endl;
+            result = 1;
+            break;
+        }
+
+        bool activity = false;
+        size_t received_now = 0;
+        io_uring_cqe *cqe = nullptr;
+        while ((cqe = ring.peekCqe()) != nullptr) {
+            activity = true;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uint64_t user_data = cqe->user_data;
+            ring.cqeSeen();
+
+            if (user_data != IO_URING_RECEIVE_TAG) {
+                complete_send(user_data, res);
+                continue;
+            }
+
+            if ((flags & IORING_CQE_F_MORE) == 0) {
+                // The multishot receive ended (e.g. it ran out of buffers) and has to be re-armed
+                receive_armed = false;
+            }
+            if (res < 0) {
+                if (res == -ENOBUFS || stopping) {
+                    continue;
+                }
+                std::cerr << strerror(-res) << std::endl;
+                result = 1;
+                break;
+            }
+            if ((flags & IORING_CQE_F_BUFFER) == 0) {
+                continue;
+            }
+            auto buffer_id = (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+            uint8_t *buffer = ring.getBuffer(buffer_id);
+            uint8_t *name = buffer + sizeof(io_uring_recvmsg_out);
+            if (args.rate_limit > 0 && !budget_exhausted && !admitPacket(reinterpret_cast<sockaddr *>(name))) {
+                ring.recycleBuffer(buffer_id);
+                continue;
+            }
+            if (budget_exhausted || !countSample()) {
+                budget_exhausted = true;
+                ring.recycleBuffer(buffer_id);
+                continue;
+            }
+            counters.received_packets++;
+            received_now++;
+
+            // Rebuild a msghdr over the buffer so the cmsg parsing is shared with the recvmsg paths
+            auto *out = reinterpret_cast<io_uring_recvmsg_out *>(buffer);
+            uint8_t *control = name + receive_template.msg_namelen;
+            uint8_t *payload = control + receive_template.msg_controllen;
+            struct msghdr message {};
+            message.msg_name = name;
+            message.msg_namelen = std::min(out->namelen, receive_template.msg_namelen);
+            message.msg_control = control;
+            message.msg_controllen = out->controllen;
+            message.msg_flags = (int) out->flags;
+            if ((out->flags & MSG_TRUNC) != 0) {
+                counters.truncated_packets++;
+                std::cout << "Datagram too large for buffer: truncated" << std::endl;
+                ring.recycleBuffer(buffer_id);
+                continue;
+            }
+            if (free_slots.empty()) {
+                // Every slot is waiting for the kernel to complete a send, so this reflection is dropped
+                counters.send_errors++;
+                ring.recycleBuffer(buffer_id);
+                continue;
+            }
+            timespec incoming_timestamp{};
+            get_kernel_timestamp(message, &incoming_timestamp);
+            auto payload_len = (ssize_t) out->payloadlen;
+
+            uint32_t slot_index = free_slots.back();
+            free_slots.pop_back();
+            IoUringSendSlot &slot = send_slots[slot_index];
+            // Every provided buffer holds a whole ClientPacket after the name and control areas
+            slot.packet = reinterpret_cast<ReflectorPacket *>(payload);
+            slot.buffer_id = buffer_id;
+            reflectPacket(slot.packet, message, &incoming_timestamp);
+            if (args.stateful) {
+                trackSession(*slot.packet, message);
+            }
+            slot.iov.iov_base = slot.packet;
+            slot.iov.iov_len = (size_t) payload_len;
+            slot.message = make_msghdr(
+                &slot.iov, 1, reinterpret_cast<struct sockaddr_in6 *>(name), message.msg_namelen, nullptr, 0);
+
+            io_uring_sqe *sqe = get_sqe();
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&slot.message);
+            sqe->len = 1;
+            sqe->user_data = slot_index;
+            sends_in_flight++;
+            sends_queued++;
+        }
+        countIncomingCpu(received_now);
+        flushIdleLog();
+
+        if (activity) {
+            last_activity_usec = get_usec();
+        } else if (args.timeout != 0 && get_usec() - last_activity_usec >= args.timeout * MICROSECONDS_IN_SECOND) {
+            std::cerr << "Socket timed out." << std::endl;
+            result = EAGAIN;
         }
     }
-    return 0;
+
+    // The receive still writes to the provided buffers and the sends in flight read their slots, so wait for the
+    // kernel to finish with both before they are freed. The late receives are not reflected.
+    if (receive_armed) {
+        io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = IO_URING_RECEIVE_TAG;
+        sqe->user_data = IO_URING_CANCEL_TAG;
+    }
+    while (receive_armed || sends_in_flight > 0) {
+        struct timespec wait = {0, IO_URING_WAIT_NANOSECONDS};
+        int ret = ring.submitAndWait(1, &wait);
+        if (ret < 0 && ret != -ETIME && ret != -EINTR) {
+            // Closing the ring cancels whatever is left
+            std::cerr << "io_uring_enter: " << strerror(-ret) << std::endl;
+            break;
+        }
+        io_uring_cqe *cqe = nullptr;
+        while ((cqe = ring.peekCqe()) != nullptr) {
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uint64_t user_data = cqe->user_data;
+            ring.cqeSeen();
+            if (user_data == IO_URING_RECEIVE_TAG) {
+                receive_armed = receive_armed && (flags & IORING_CQE_F_MORE) != 0;
+            } else if (user_data != IO_URING_CANCEL_TAG) {
+                complete_send(user_data, res);
+            }
+        }
+    }
+    return result;
+}
+#endif
+
+void Server::handleTestPacket(ReflectorPacket *packet,
+                              msghdr sender_msg,
+                              ssize_t payload_len,
+                              timespec *incoming_timestamp)
+{
+    reflectPacket(packet, sender_msg, incoming_timestamp);
+    ReflectorPacket &reflector_packet = *packet;
+    if (args.stateful) {
+        trackSession(reflector_packet, sender_msg);
+    }
+    // Overwrite and reuse the sender message with our own data and send it back, instead of creating a new one.
+    struct msghdr message = sender_msg;
+
+    std::array<struct iovec, 1> iov{};
+    iov[0].iov_base = &reflector_packet;
+    iov[0].iov_len = (size_t) payload_len;
+    message.msg_iov = iov.data();
+    message.msg_iovlen = 1;
+    message.msg_control = nullptr;
+    message.msg_controllen = 0; // Set the control buffer size
+    counters.send_calls++;
+    if (sendmsg(fd, &message, 0) == -1) {
+        counters.send_errors++;
+        std::cerr << strerror(errno) << std::endl;
+    } else {
+        counters.reflected_packets++;
+        if (args.stateful) {
+            sessionReflected(sender_msg);
+        }
+        if (args.tx_timestamp) {
+            collectTxTimestamps(1);
+            applyTxTimestamp(reflector_packet, tx_timestamps[0]);
+        }
+    }
+    // Logging only starts once the reflected packet is on its way
+    recordMetrics(reflector_packet, sender_msg, payload_len);
+}
+
+/* Takes a token from the source's bucket. Returns false, counting the drop, when the source is over its budget. */
+auto Server::admitPacket(const sockaddr *src_addr) -> bool
+{
+    uint64_t now_usec = get_usec();
+    bool inserted = false;
+    TokenBucket &bucket = rate_limits.findOrInsert(make_source_key(src_addr), &inserted);
+    if (inserted) {
+        bucket.tokens = args.rate_burst;
+        bucket.last_refill_usec = now_usec;
+    }
+    bool admitted = bucket.tryConsume(now_usec, args.rate_limit, args.rate_burst);
+    if (!admitted) {
+        counters.rate_limited_packets++;
+    }
+    if (now_usec - last_rate_limit_sweep_usec >= SESSION_SWEEP_INTERVAL_USEC) {
+        evictIdleRateLimits(now_usec);
+        last_rate_limit_sweep_usec = now_usec;
+    }
+    return admitted;
+}
+
+/* Forgets sources whose bucket has refilled completely, as a new bucket would start out the same */
+void Server::evictIdleRateLimits(uint64_t now_usec)
+{
+    auto refill_usec = (uint64_t) (args.rate_burst / args.rate_limit * (double) MICROSECONDS_IN_SECOND);
+    uint64_t idle_usec = std::max(refill_usec, SESSION_SWEEP_INTERVAL_USEC);
+    rate_limits.eraseIf([&](const SessionKey &key, const TokenBucket &bucket) {
+        if (now_usec - bucket.last_refill_usec < idle_usec) {
+            return false;
+        }
+        if (bucket.dropped > 0) {
+            printRateLimit(key, bucket, "Rate limited source expired ");
+        }
+        return true;
+    });
+}
+
+void Server::printRateLimits()
+{
+    rate_limits.forEach([](const SessionKey &key, const TokenBucket &bucket) {
+        if (bucket.dropped > 0) {
+            printRateLimit(key, bucket, "Rate limited source ");
+        }
+    });
+}
+
+void Server::printRateLimit(const SessionKey &key, const TokenBucket &bucket, const std::string &label)
+{
+    std::array<char, INET6_ADDRSTRLEN> host = {};
+    format_key_address(key, host.data());
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cerr << label << host.data() << ": passed " << bucket.passed << ", dropped " << bucket.dropped << std::endl;
+}
+
+/* Updates the sender's session and, being stateful, numbers the reflected packet from the session's own counter */
+void Server::trackSession(ReflectorPacket &reflector_packet, const msghdr &sender_msg)
+{
+    uint64_t now_usec = get_usec();
+    SessionKey key = make_session_key(static_cast<const sockaddr *>(sender_msg.msg_name), local_port);
+    Session &session = sessions.findOrInsert(key);
+    session.recordSenderSeq(ntohl(reflector_packet.sender_seq_number));
+    session.last_seen_usec = now_usec;
+    reflector_packet.seq_number = htonl(session.reflector_seq++);
+    if (args.session_timeout != 0 && now_usec - last_session_sweep_usec >= SESSION_SWEEP_INTERVAL_USEC) {
+        evictIdleSessions(now_usec);
+        last_session_sweep_usec = now_usec;
+    }
+}
+
+void Server::sessionReflected(const msghdr &sender_msg)
+{
+    SessionKey key = make_session_key(static_cast<const sockaddr *>(sender_msg.msg_name), local_port);
+    Session *session = sessions.find(key);
+    if (session != nullptr) {
+        session->reflected++;
+    }
 }
 
-void Server::handleTestPacket(ClientPacket *packet, msghdr sender_msg, ssize_t payload_len, timespec *incoming_timestamp)
+void Server::evictIdleSessions(uint64_t now_usec)
+{
+    uint64_t timeout_usec = args.session_timeout * MICROSECONDS_IN_SECOND;
+    sessions.eraseIf([&](const SessionKey &key, const Session &session) {
+        if (now_usec - session.last_seen_usec < timeout_usec) {
+            return false;
+        }
+        printSession(key, session, "Session expired ");
+        return true;
+    });
+}
+
+void Server::printSessions()
+{
+    sessions.forEach([](const SessionKey &key, const Session &session) { printSession(key, session, "Session "); });
+}
+
+void Server::printSession(const SessionKey &key, const Session &session, const std::string &label)
+{
+    std::array<char, INET6_ADDRSTRLEN> host = {};
+    format_key_address(key, host.data());
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cerr << label << host.data() << ":" << ntohs(key.port) << " -> " << key.local_port << ": received "
+              << session.received << ", reflected " << session.reflected << ", lost " << session.lost
+              << ", reordered " << session.reordered << ", duplicated " << session.duplicated << std::endl;
+}
+
+/* Reads the error queue stamps of the last count datagrams sent into tx_timestamps, without waiting: the reflection
+ * path never blocks for a stamp. Datagrams held in a qdisc or driver queue are stamped after this returns; their stamps
+ * are left zero and counted as missed, and the late stamps are drained and discarded on a later call. */
+void Server::collectTxTimestamps(size_t count)
+{
+    tx_timestamps.assign(count, timespec{});
+    uint32_t id = 0;
+    timespec tx_timestamp{};
+    // Empty the whole queue, so late stamps of earlier sends never pile up in front of the current ones
+    while (read_tx_timestamp(fd, &id, &tx_timestamp)) {
+        uint32_t index = id - next_tx_id;
+        if (index < count && tx_timestamps[index].tv_sec == 0 && tx_timestamps[index].tv_nsec == 0) {
+            tx_timestamps[index] = tx_timestamp;
+        }
+    }
+    next_tx_id += (uint32_t) count;
+}
+
+/* Replaces the send time taken before the send with the kernel's, for the output only: the datagram has left */
+void Server::applyTxTimestamp(ReflectorPacket &reflector_packet, const timespec &tx_timestamp)
+{
+    if (tx_timestamp.tv_sec == 0 && tx_timestamp.tv_nsec == 0) {
+        counters.missed_tx_timestamps++;
+        return;
+    }
+    Timestamp send_timestamp = {};
+    timespec_to_timestamp(&tx_timestamp, &send_timestamp);
+    reflector_packet.timestamp = htonts(send_timestamp);
+}
+
+void Server::recordMetrics(const ReflectorPacket &reflector_packet, msghdr sender_msg, ssize_t payload_len)
+{
+    Timestamp receive_timestamp = ntohts(reflector_packet.receive_timestamp);
+    Timestamp send_timestamp = ntohts(reflector_packet.timestamp);
+    delay_histogram.observe(
+        (int64_t) (timestamp_to_nsec(&send_timestamp) - timestamp_to_nsec(&receive_timestamp)));
+    if (!args.print_packets) {
+        return;
+    }
+    LogRecord record;
+    record.seq_number = reflector_packet.seq_number;
+    record.sender_seq_number = reflector_packet.sender_seq_number;
+    record.send_timestamp = reflector_packet.timestamp;
+    record.receive_timestamp = reflector_packet.receive_timestamp;
+    record.sender_timestamp = reflector_packet.sender_timestamp;
+    record.sender_ttl = reflector_packet.sender_ttl;
+    record.sender_tos = reflector_packet.sender_tos;
+    record.payload_length = (uint16_t) payload_len;
+    size_t addr_len = std::min((size_t) sender_msg.msg_namelen, sizeof(record.addr));
+    memcpy(&record.addr, sender_msg.msg_name, addr_len);
+    memset(reinterpret_cast<char *>(&record.addr) + addr_len, 0, sizeof(record.addr) - addr_len);
+    if (log_ring) {
+        // Never wait for the writer: a full queue costs log lines, not reflection latency
+        if (!log_ring->tryPush(record)) {
+            counters.dropped_log_records++;
+        }
+        return;
+    }
+    if (binary_log) {
+        logBinary(record);
+        return;
+    }
+    printMetrics(makeMetricData(record));
+}
+
+auto Server::makeMetricData(const LogRecord &record) const -> MetricData
 {
-    ReflectorPacket reflector_packet = craftReflectorPacket(packet, sender_msg, incoming_timestamp);
     std::array<char, INET6_ADDRSTRLEN> host = {};
     uint16_t port = 0;
+    struct msghdr sender_msg {};
+    sender_msg.msg_name = const_cast<sockaddr_in6 *>(&record.addr);
+    sender_msg.msg_namelen = sizeof(record.addr);
     parse_ip_address(sender_msg, &port, host.data(), args.ip_version);
-    // Overwrite and reuse the sender message with our own data and send it back, instead of creating a new one.
     uint64_t server_receive_time = 0;
     uint64_t server_send_time = 0;
     uint64_t initial_send_time = 0;
     int64_t client_server_delay = 0;
-    Timestamp client_timestamp = ntohts(packet->timestamp);
-    Timestamp server_timestamp = ntohts(reflector_packet.receive_timestamp);
-    Timestamp send_timestamp = ntohts(reflector_packet.timestamp);
+    Timestamp client_timestamp = ntohts(record.sender_timestamp);
+    Timestamp server_timestamp = ntohts(record.receive_timestamp);
+    Timestamp send_timestamp = ntohts(record.send_timestamp);
     client_server_delay = (int64_t) (timestamp_to_nsec(&server_timestamp) - timestamp_to_nsec(&client_timestamp));
     server_receive_time = timestamp_to_nsec(&server_timestamp);
     server_send_time = timestamp_to_nsec(&send_timestamp);
@@ -134,32 +1007,144 @@ void Server::handleTestPacket(ClientPacket *packet, msghdr sender_msg, ssize_t p
     auto internal_delay = (int64_t) (server_send_time - server_receive_time);
 
     MetricData data;
-    data.payload_length = (uint16_t) payload_len;
-    data.packet = reflector_packet;
+    data.payload_length = record.payload_length;
+    data.sender_seq_number = ntohl(record.sender_seq_number);
+    data.seq_number = ntohl(record.seq_number);
+    data.sender_ttl = record.sender_ttl;
+    data.sender_tos = record.sender_tos;
     data.client_server_delay_nanoseconds = client_server_delay;
     data.internal_delay_nanoseconds = internal_delay;
-    data.receiving_port = (uint16_t) std::stoi(args.local_port);
+    data.receiving_port = local_port;
     data.sending_port = port;
     data.initial_send_time = initial_send_time;
     data.ip = std::string(host.data());
-    printMetrics(data);
-    struct msghdr message = sender_msg;
+    return data;
+}
 
-    std::array<struct iovec, 1> iov{};
-    iov[0].iov_base = &reflector_packet;
-    iov[0].iov_len = (size_t) payload_len;
-    message.msg_iov = iov.data();
-    message.msg_iovlen = 1;
-    message.msg_control = nullptr;
-    message.msg_controllen = 0; // Set the control buffer size
-    if (sendmsg(fd, &message, 0) == -1) {
-        std::cerr << strerror(errno) << std::endl;
+auto Server::makeBinaryLogRecord(const LogRecord &record) const -> BinaryLogRecord
+{
+    Timestamp client_timestamp = ntohts(record.sender_timestamp);
+    Timestamp server_timestamp = ntohts(record.receive_timestamp);
+    Timestamp send_timestamp = ntohts(record.send_timestamp);
+    uint64_t initial_send_time = timestamp_to_nsec(&client_timestamp);
+    uint64_t server_receive_time = timestamp_to_nsec(&server_timestamp);
+
+    BinaryLogRecord binary{};
+    binary.send_time = initial_send_time;
+    binary.internal_delay = (int64_t) (timestamp_to_nsec(&send_timestamp) - server_receive_time);
+    binary.forward_delay = (int64_t) (server_receive_time - initial_send_time);
+    if (record.addr.sin6_family == AF_INET6) {
+        memcpy(binary.address, &record.addr.sin6_addr, sizeof(record.addr.sin6_addr));
+        binary.ip_version = IPV6;
+    } else {
+        const auto *addr4 = reinterpret_cast<const sockaddr_in *>(&record.addr);
+        memcpy(binary.address, &addr4->sin_addr, sizeof(addr4->sin_addr));
+        binary.ip_version = IPV4;
+    }
+    // The port sits at the same offset in sockaddr_in and sockaddr_in6
+    binary.sending_port = ntohs(record.addr.sin6_port);
+    binary.receiving_port = local_port;
+    binary.sender_seq_number = ntohl(record.sender_seq_number);
+    binary.seq_number = ntohl(record.seq_number);
+    binary.payload_length = record.payload_length;
+    binary.ttl = record.sender_ttl;
+    binary.sender_tos = record.sender_tos;
+    binary_log_byte_order(&binary);
+    return binary;
+}
+
+void Server::logBinary(const LogRecord &record)
+{
+    binary_log_buffer.push_back(makeBinaryLogRecord(record));
+    if (binary_log_buffer.size() >= BINARY_LOG_BUFFER_RECORDS) {
+        counters.dropped_log_records += flushBinaryLog();
+    } else {
+        flushIdleLog();
+    }
+}
+
+/* Writes the buffered binary log records out once the last flush is BINARY_LOG_FLUSH_INTERVAL_USEC old, so a reader
+ * of a live log sees every packet within that time even when no more come in */
+void Server::flushIdleLog()
+{
+    if (!flushesLogWhenIdle() || binary_log_buffer.empty()) {
         return;
     }
+    if (get_usec() - last_binary_log_flush_usec >= BINARY_LOG_FLUSH_INTERVAL_USEC) {
+        counters.dropped_log_records += flushBinaryLog();
+    }
+}
+
+/* Appends the buffered records to the binary log and returns how many of them could not be written */
+auto Server::flushBinaryLog() -> size_t
+{
+    if (!binary_log) {
+        return 0;
+    }
+    size_t unwritten = 0;
+    if (!binary_log_buffer.empty() && !binary_log->append(binary_log_buffer.data(), binary_log_buffer.size())) {
+        unwritten = binary_log_buffer.size();
+    }
+    binary_log_buffer.clear();
+    last_binary_log_flush_usec = get_usec();
+    return unwritten;
+}
+
+void Server::startLogWriter()
+{
+    log_ring = std::make_unique<SpscRing<LogRecord>>(LOG_RING_CAPACITY);
+    log_writer_stopping = false;
+    log_writer = std::thread(&Server::runLogWriter, this);
 }
 
-auto Server::craftReflectorPacket(ClientPacket *clientPacket, msghdr sender_msg, timespec *incoming_timestamp)
-    -> ReflectorPacket
+void Server::stopLogWriter()
+{
+    if (!log_writer.joinable()) {
+        return;
+    }
+    log_writer_stopping = true;
+    log_writer.join();
+    log_ring.reset();
+    counters.dropped_log_records += unwritten_log_records;
+    unwritten_log_records = 0;
+}
+
+/* Drains the log ring in batches, formatting them off the reflection path and printing each batch at once */
+void Server::runLogWriter()
+{
+    std::vector<LogRecord> batch(LOG_WRITER_BATCH_SIZE);
+    std::ostringstream lines;
+    while (true) {
+        // Read the flag before draining, so records pushed before the stop request are never lost
+        bool last_pass = log_writer_stopping;
+        size_t count = log_ring->popBatch(batch.data(), batch.size());
+        if (count == 0) {
+            if (last_pass) {
+                break;
+            }
+            std::this_thread::sleep_for(LOG_WRITER_IDLE_SLEEP);
+            continue;
+        }
+        if (binary_log) {
+            for (size_t i = 0; i < count; i++) {
+                binary_log_buffer.push_back(makeBinaryLogRecord(batch[i]));
+            }
+            // The counters belong to the reflecting thread, which adds these once the writer has stopped
+            unwritten_log_records += flushBinaryLog();
+            continue;
+        }
+        lines.str("");
+        for (size_t i = 0; i < count; i++) {
+            write_text_log_line(lines, makeMetricData(batch[i]), args.sep);
+        }
+        std::lock_guard<std::mutex> lock(output_mutex);
+        printHeader();
+        std::cout << lines.str();
+    }
+}
+
+/* Rewrites the test packet in its receive buffer into the reflector's reply */
+void Server::reflectPacket(ReflectorPacket *packet, const msghdr &sender_msg, timespec *incoming_timestamp)
 {
     Timestamp server_timestamp = {};
     if (incoming_timestamp->tv_sec == 0 && incoming_timestamp->tv_nsec == 0) {
@@ -168,55 +1153,20 @@ auto Server::craftReflectorPacket(ClientPacket *clientPacket, msghdr sender_msg,
     } else {
         timespec_to_timestamp(incoming_timestamp, &server_timestamp);
     }
-    ReflectorPacket packet = {};
-    packet.seq_number = clientPacket->seq_number;
-    Timestamp send_timestamp = get_timestamp();
-    packet.timestamp = htonts(send_timestamp);
-    packet.timestamp_error_estimate =
-        htons(ERROR_ESTIMATE_DEFAULT_BITMAP); // Sync = 1, Multiplier = 1 Taken from TWAMP C implementation.
-    packet.receive_timestamp = htonts(server_timestamp);
-    packet.sender_seq_number = clientPacket->seq_number;
-    packet.sender_timestamp = clientPacket->timestamp;
-    packet.sender_error_estimate = clientPacket->timestamp_error_estimate;
-    IPHeader ipHeader = get_ip_header(sender_msg);
-    packet.sender_ttl = ipHeader.ttl;
-    packet.sender_tos = ipHeader.tos;
-
-    return packet;
+    reflect_in_place(packet, server_timestamp, get_ip_header(sender_msg));
 }
 
 void Server::printMetrics(const MetricData &data)
 {
-    /* Sequence number */
-    uint32_t snd_nb = ntohl(data.packet.sender_seq_number);
-    uint32_t rcv_nb = ntohl(data.packet.seq_number);
-    uint64_t client_send_time = data.initial_send_time;
-    /* Sender TOS with ECN from FW TOS */
-    uint8_t fw_tos = 0;
-    auto snd_tos =
-        static_cast<uint8_t>(data.packet.sender_tos + (fw_tos & 0x3) - (((fw_tos & 0x2) >> 1) & (fw_tos & 0x1)));
+    std::lock_guard<std::mutex> lock(output_mutex);
+    printHeader();
+    write_text_log_line(std::cout, data, args.sep);
+}
+
+void Server::printHeader() const
+{
     if (!header_printed) {
-        std::cout << "Time" << args.sep << "IP" << args.sep << "Snd#" << args.sep << "Rcv#" << args.sep << "SndPort"
-                  << args.sep << "RscPort" << args.sep << "FW_TTL" << args.sep << "SndTOS" << args.sep << "FW_TOS"
-                  << args.sep << "IntD" << args.sep << "FWD" << args.sep << "PLEN" << args.sep << "\n";
+        write_text_log_header(std::cout, args.sep);
         header_printed = true;
     }
-
-    // Save current format state
-    std::ostream &os = std::cout;
-    std::ios::fmtflags f = os.flags();
-    std::streamsize prec = os.precision();
-    char fill = os.fill();
-
-    os << std::fixed << client_send_time << args.sep << data.ip << args.sep << snd_nb << args.sep << rcv_nb << args.sep
-       << data.sending_port << args.sep << data.receiving_port << args.sep << unsigned(data.packet.sender_ttl)
-       << args.sep << unsigned(snd_tos) << args.sep << unsigned(fw_tos)
-       << args.sep << (double) data.internal_delay_nanoseconds * MICROSECONDS_TO_SECONDS
-       << args.sep << (double) data.client_server_delay_nanoseconds * MICROSECONDS_TO_SECONDS << args.sep
-       << std::to_string(data.payload_length) << "\n";
-
-    // Restore format state
-    os.flags(f);
-    os.precision(prec);
-    os.fill(fill);
 }
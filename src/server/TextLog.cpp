@@ -0,0 +1,40 @@
+#include "TextLog.h"
+#include <ios>
+
+constexpr double MICROSECONDS_TO_SECONDS = 1e-6;
+
+void write_text_log_header(std::ostream &os, char sep)
+{
+    os << "Time" << sep << "IP" << sep << "Snd#" << sep << "Rcv#" << sep << "SndPort" << sep << "RscPort" << sep
+       << "FW_TTL" << sep << "SndTOS" << sep << "FW_TOS" << sep << "IntD" << sep << "FWD" << sep << "PLEN" << sep
+       << "\n";
+}
+
+void write_text_log_line(std::ostream &os, const MetricData &data, char sep)
+{
+    /* Sequence number */
+    uint32_t snd_nb = data.sender_seq_number;
+    uint32_t rcv_nb = data.seq_number;
+    uint64_t client_send_time = data.initial_send_time;
+    /* Sender TOS with ECN from FW TOS */
+    uint8_t fw_tos = 0;
+    auto snd_tos =
+        static_cast<uint8_t>(data.sender_tos + (fw_tos & 0x3) - (((fw_tos & 0x2) >> 1) & (fw_tos & 0x1)));
+
+    // Save current format state
+    std::ios::fmtflags f = os.flags();
+    std::streamsize prec = os.precision();
+    char fill = os.fill();
+
+    os << std::fixed << client_send_time << sep << data.ip << sep << snd_nb << sep << rcv_nb << sep
+       << data.sending_port << sep << data.receiving_port << sep << unsigned(data.sender_ttl)
+       << sep << unsigned(snd_tos) << sep << unsigned(fw_tos)
+       << sep << (double) data.internal_delay_nanoseconds * MICROSECONDS_TO_SECONDS
+       << sep << (double) data.client_server_delay_nanoseconds * MICROSECONDS_TO_SECONDS << sep
+       << std::to_string(data.payload_length) << "\n";
+
+    // Restore format state
+    os.flags(f);
+    os.precision(prec);
+    os.fill(fill);
+}
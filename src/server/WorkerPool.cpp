@@ -0,0 +1,138 @@
+#include "WorkerPool.h"
+#include <arpa/inet.h>
+#include <cstring>
+#include <iostream>
+#include <linux/filter.h>
+#include <sched.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+
+/* Returns the CPUs this process is allowed to run on */
+static auto get_allowed_cpus() -> std::vector<int>
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    if (cpus.empty()) {
+        cpus.push_back(0);
+    }
+    return cpus;
+}
+
+/**
+ * Attaches a classic BPF program to the reuseport group of fd that hands each datagram to the worker pinned to
+ * the CPU which received it. The program returns the index of that worker's socket in the group, which is its
+ * creation order. Datagrams received on a CPU without a worker get an out-of-range index, for which the kernel
+ * falls back to its flow hash.
+ */
+static auto attach_cpu_steering(int fd, const std::vector<int> &worker_cpus) -> bool
+{
+    std::vector<sock_filter> program;
+    program.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t) (SKF_AD_OFF + SKF_AD_CPU)));
+    for (size_t i = 0; i < worker_cpus.size(); i++) {
+        program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t) worker_cpus[i], 0, 1));
+        program.push_back(BPF_STMT(BPF_RET | BPF_K, (uint32_t) i));
+    }
+    program.push_back(BPF_STMT(BPF_RET | BPF_K, (uint32_t) worker_cpus.size()));
+    struct sock_fprog fprog = {(unsigned short) program.size(), program.data()};
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog)) != 0) {
+        std::cerr << "[PROBLEM] Cannot attach the CPU steering program, the kernel hashes flows instead: "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+WorkerPool::WorkerPool(const Args &args) : args(args), cpus(get_allowed_cpus())
+{
+    size_t num_workers = args.workers == 0 ? cpus.size() : args.workers;
+    this->args.workers = (uint16_t) num_workers;
+    this->args.reuse_port = true;
+    std::vector<int> worker_cpus;
+    for (size_t i = 0; i < num_workers; i++) {
+        // Each worker pins its own thread when it starts listening
+        Args worker_args = this->args;
+        worker_args.cpu = cpus[i % cpus.size()];
+        worker_cpus.push_back(worker_args.cpu);
+        servers.push_back(std::make_unique<Server>(worker_args));
+        servers.back()->shareSampleCounter(&sample_counter);
+        if (i == 0 && this->args.local_port == "0") {
+            // Every worker must join the reuseport group of the port the first one was given
+            this->args.local_port = std::to_string(get_bound_port(servers.back()->getSocket()));
+        }
+    }
+    if (this->args.steer_cpu) {
+        // The program applies to the whole group, so attaching it to one socket is enough
+        attach_cpu_steering(servers.front()->getSocket(), worker_cpus);
+    }
+}
+
+auto WorkerPool::run() -> int
+{
+    std::vector<int> results(servers.size(), 0);
+    std::vector<std::thread> threads;
+    threads.reserve(servers.size());
+    for (size_t i = 0; i < servers.size(); i++) {
+        threads.emplace_back(&WorkerPool::runWorker, this, i, &results[i]);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (int result : results) {
+        if (result != 0) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+void WorkerPool::runWorker(size_t worker_id, int *result)
+{
+    *result = servers[worker_id]->listen();
+    // Once the shared num_samples budget is used up, the workers still blocked in recvmsg must be woken up.
+    // A worker that merely timed out leaves the others running.
+    if (*result == 0 && args.num_samples != 0) {
+        stop();
+    }
+}
+
+void WorkerPool::stop()
+{
+    for (auto &server : servers) {
+        server->stop();
+    }
+}
+
+void WorkerPool::printCounters() const
+{
+    ServerCounters total;
+    DelayHistogram total_delays;
+    for (size_t i = 0; i < servers.size(); i++) {
+        const ServerCounters &counters = servers[i]->getCounters();
+        Server::printCounters(counters,
+                              "Worker " + std::to_string(i) + " (CPU " + std::to_string(cpus[i % cpus.size()]) + "): ");
+        total += counters;
+        total_delays += servers[i]->getDelayHistogram();
+    }
+    Server::printCounters(total, "Total: ");
+    if (args.busy_poll > 0) {
+        Server::printDelayHistogram(total_delays, "Total: ");
+    }
+}
+
+auto WorkerPool::getServers() const -> std::vector<const Server *>
+{
+    std::vector<const Server *> result;
+    for (const auto &server : servers) {
+        result.push_back(server.get());
+    }
+    return result;
+}
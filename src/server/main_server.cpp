@@ -1,6 +1,11 @@
 #include <CLI/CLI.hpp>
+#include "MetricsEndpoint.h"
+#include "MultiServer.h"
 #include "Server.h"
+#include "WorkerPool.h"
+#include <cstring>
 #include <iostream>
+#include <sys/mman.h>
 #include <unistd.h>
 
 static auto parse_args(int argc, char **argv)
@@ -24,6 +29,99 @@ static auto parse_args(int argc, char **argv)
         ->default_str(std::to_string(args.timeout));
     app.add_option("--sep", args.sep, "The separator to use in the output.");
     app.add_option("--ip", args.ip_version, "The IP version to use.");
+    app.add_option("--batch",
+                   args.batch_size,
+                   "Maximum number of datagrams to receive and reflect per recvmmsg/sendmmsg call. 1 reflects one datagram per recvmsg/sendmsg.")
+        ->check(CLI::Range(1, (int) MAX_BATCH_SIZE));
+    auto *opt_io_uring = app.add_flag("--io-uring",
+                 args.io_uring,
+                 "Reflect through io_uring with a multishot receive into provided buffers. Needs Linux 6.0 or later.");
+    app.add_flag("--tx-timestamp",
+                 args.tx_timestamp,
+                 "Report the kernel's software TX timestamp from the socket error queue as the send time in the output, instead of the time taken before sending. "
+                 "Stamps are not waited for: a reply whose stamp is not queued right after the send keeps the earlier time and counts as a missed TX timestamp.")
+        ->excludes(opt_io_uring);
+    app.add_flag("--stateful",
+                 args.stateful,
+                 "Track sessions by 5-tuple: number reflected packets per session and report each session's received, reflected, lost and reordered packets.");
+    app.add_option("--session-timeout",
+                   args.session_timeout,
+                   "Seconds without packets before a stateful session is reported and forgotten. Set to 0 to keep sessions until shutdown.");
+    app.add_option("--rate-limit",
+                   args.rate_limit,
+                   "Packets per second reflected for each source address. Packets over the limit are dropped without a reply. Set to 0 to disable.")
+        ->check(CLI::NonNegativeNumber);
+    app.add_option("--rate-burst",
+                   args.rate_burst,
+                   "Number of packets a source may send back to back before --rate-limit applies.")
+        ->check(CLI::PositiveNumber);
+    app.add_flag("--async-log",
+                 args.async_log,
+                 "Queue the per-packet output to a writer thread, so formatting and printing never delay a reflection.");
+    std::vector<std::string> listen_strs;
+    auto *opt_listen =
+        app.add_option("--listen",
+                       listen_strs,
+                       "Address and port, or port range FIRST-LAST, to serve. Repeat it to serve several addresses, ports "
+                       "and IP versions from one event loop; IPv6 addresses go in brackets, e.g. [::]:862. Overrides "
+                       "--local_address, --local_port and --ip.")
+            ->check([&args](const std::string &str) {
+                ListenAddress address;
+                if (!parse_listen_address(str, address)) {
+                    return "Listen address must be in the format IP:Port or IP:FirstPort-LastPort";
+                }
+                args.listen_addresses.push_back(std::move(address));
+                return "";
+            })
+            ->excludes(opt_io_uring);
+    auto *opt_quiet =
+        app.add_flag("--quiet{false}",
+                     args.print_packets,
+                     "Do not print a line per reflected packet. The counters and the metrics endpoint still cover them.");
+    std::string log_format = "text";
+    app.add_option("--log-format",
+                   log_format,
+                   "Per-packet output: 'text' prints a line per packet, 'binary' appends fixed-width records to "
+                   "--log-file, which twamp-light-logdecode turns back into the text output.")
+        ->check(CLI::IsMember({"text", "binary"}))
+        ->excludes(opt_quiet);
+    app.add_option("--log-file", args.log_file, "The file --log-format binary writes to. It is truncated first.")
+        ->excludes(opt_quiet);
+    app.add_option("--metrics-socket",
+                   args.metrics_socket,
+                   "Serve the packet counters and the internal delay histogram in the Prometheus text format on this "
+                   "Unix socket path, e.g. for curl --unix-socket PATH http://localhost/metrics.");
+    app.add_option("--busy-poll",
+                   args.busy_poll,
+                   "Low-latency mode: spin on non-blocking receives instead of sleeping in them, with SO_BUSY_POLL set "
+                   "to this many microseconds. Keeps a CPU fully busy; reports the internal delay distribution at "
+                   "shutdown. 0 disables it.")
+        ->excludes(opt_io_uring)
+        ->excludes(opt_listen);
+    auto *opt_workers =
+        app.add_option("--workers",
+                       args.workers,
+                       "Number of reflector threads, each pinned to its own CPU with its own SO_REUSEPORT socket on the local port. 0 starts one per available CPU.")
+            ->excludes(opt_listen);
+    app.add_flag("--steer-cpu",
+                 args.steer_cpu,
+                 "With --workers: have the kernel hand each datagram to the worker pinned to the CPU that received it "
+                 "(a reuseport BPF program on the receiving CPU, and SO_INCOMING_CPU), so the NIC queue's CPU also "
+                 "reflects it. The counters sample the receiving CPU once every 1024 packets and show how many samples "
+                 "found each worker on its own CPU.")
+        ->needs(opt_workers);
+    app.add_option("--cpu", args.cpu, "Pin the reflecting thread to this CPU.")
+        ->check(CLI::Range(0, CPU_SETSIZE - 1))
+        ->excludes(opt_workers)
+        ->default_str("");
+    app.add_option("--realtime",
+                   args.realtime_priority,
+                   "Run the reflecting threads under SCHED_FIFO with this priority (1-99). Needs CAP_SYS_NICE. 0 keeps "
+                   "the default scheduling policy.")
+        ->check(CLI::Range(0, 99));
+    app.add_flag("--mlock",
+                 args.lock_memory,
+                 "Lock all current and future memory of the process into RAM, so no page fault stalls a reflection.");
     auto *opt_tos = app.add_option("-T, --tos", tos, "The TOS value (<256).")
                         ->check(CLI::Range(256))
                         ->default_str(std::to_string(args.snd_tos));
@@ -36,15 +134,63 @@ static auto parse_args(int argc, char **argv)
     if (*opt_tos) {
         args.snd_tos = tos - (((tos & 0x2) >> 1) & (tos & 0x1));
     }
+    if (log_format == "binary") {
+        if (args.log_file.empty()) {
+            std::cerr << "[PROBLEM] --log-format binary needs a --log-file" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        args.log_format = LogFormat::Binary;
+    }
+    if (args.steer_cpu && args.workers == 1) {
+        // A single reflector has no other worker to steer to
+        std::cerr << "[PROBLEM] --steer-cpu needs --workers 0 or more than 1" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
     return args;
 }
 
+/* Starts the metrics endpoint if one was asked for. It must be destroyed before the servers it reads. */
+static auto start_metrics_endpoint(const Args &args, std::vector<const Server *> servers)
+    -> std::unique_ptr<MetricsEndpoint>
+{
+    if (args.metrics_socket.empty()) {
+        return nullptr;
+    }
+    return std::make_unique<MetricsEndpoint>(args.metrics_socket, std::move(servers));
+}
+
 auto main(int argc, char **argv) -> int
 {
     try {
         Args args = parse_args(argc, argv);
+        if (args.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            std::cerr << "[PROBLEM] Cannot lock the process memory: " << strerror(errno) << std::endl;
+        }
+        if (args.workers != 1) {
+            WorkerPool pool(args);
+            auto metrics = start_metrics_endpoint(args, pool.getServers());
+            int result = pool.run();
+            pool.printCounters();
+            return result;
+        }
+        if (!args.listen_addresses.empty()) {
+            MultiServer server(args);
+            auto metrics = start_metrics_endpoint(args, server.getServers());
+            int result = server.run();
+            server.printCounters();
+            return result;
+        }
         Server server = Server(args);
-        return server.listen();
+        auto metrics = start_metrics_endpoint(args, {&server});
+        int result = server.listen();
+        if (args.batch_size > 1 || args.io_uring || args.async_log || args.tx_timestamp || args.rate_limit > 0 ||
+            args.busy_poll > 0) {
+            Server::printCounters(server.getCounters());
+        }
+        if (args.busy_poll > 0) {
+            Server::printDelayHistogram(server.getDelayHistogram());
+        }
+        return result;
     } catch (const CLI::BadNameString &e) {
         std::cerr << "Invalid argument: " << e.what() << std::endl;
         return EXIT_FAILURE;
@@ -28,6 +28,8 @@ constexpr uint32_t NTP_EPOCH_OFFSET = 2208988800UL;
 #include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
 #include <linux/net_tstamp.h>
 #include <sys/time.h>
 
@@ -40,6 +42,7 @@ constexpr double NANOSECONDS_IN_SECOND = 1e9;
 constexpr int64_t NANOSECONDS_IN_MICROSECOND = 1000;
 constexpr int64_t MICROSEONDS_IN_SECOND_INT = 1000000;
 constexpr int64_t NANOSECONDS_IN_SECOND_INT = 1000000000;
+constexpr size_t TX_TIMESTAMP_CONTROL_SIZE = 256;
 
 void timeval_to_timestamp(const struct timeval *tv, Timestamp *ts)
 {
@@ -287,6 +290,90 @@ void set_socket_tos(int socket, uint8_t ip_tos)
     fprintf(stderr, "No way to set the TOS value for leaving packets on that platform.\n");
 #endif
 }
+auto get_bound_port(int socket) -> uint16_t
+{
+    struct sockaddr_storage bound_addr {};
+    socklen_t bound_addr_len = sizeof(bound_addr);
+    if (getsockname(socket, reinterpret_cast<struct sockaddr *>(&bound_addr), &bound_addr_len) != 0) {
+        return 0;
+    }
+    if (bound_addr.ss_family == AF_INET6) {
+        return ntohs(reinterpret_cast<struct sockaddr_in6 *>(&bound_addr)->sin6_port);
+    }
+    return ntohs(reinterpret_cast<struct sockaddr_in *>(&bound_addr)->sin_port);
+}
+auto enable_tx_timestamping(int socket) -> bool
+{
+    /* Software TX timestamps are reported on the error queue, tagged with a per-datagram counter (OPT_ID).
+     * OPT_TSONLY keeps the kernel from looping the whole packet back with every timestamp. */
+    unsigned int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+                         SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+        std::cerr << "[PROBLEM] Cannot enable TX timestamping: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+auto read_tx_timestamp(int socket, uint32_t *id, struct timespec *tx_timestamp) -> bool
+{
+    std::array<char, TX_TIMESTAMP_CONTROL_SIZE> control{};
+    struct msghdr message = {};
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+    if (recvmsg(socket, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+        return false;
+    }
+    bool have_timestamp = false;
+    bool have_id = false;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&message); cm != nullptr; cm = CMSG_NXTHDR(&message, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+            // The first of the three timespecs holds the software timestamp
+            memcpy(tx_timestamp, CMSG_DATA(cm), sizeof(struct timespec));
+            have_timestamp = tx_timestamp->tv_sec != 0 || tx_timestamp->tv_nsec != 0;
+        } else if ((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                   (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+            struct sock_extended_err err {};
+            memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_errno == ENOMSG && err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                *id = err.ee_data;
+                have_id = true;
+            }
+        }
+    }
+    return have_timestamp && have_id;
+}
+auto enable_txtime(int socket, clockid_t clock) -> bool
+{
+    struct sock_txtime txtime = {};
+    txtime.clockid = clock;
+    txtime.flags = SOF_TXTIME_REPORT_ERRORS;
+    if (setsockopt(socket, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) != 0) {
+        std::cerr << "[PROBLEM] Cannot enable SO_TXTIME: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+auto drain_txtime_errors(int socket) -> uint64_t
+{
+    uint64_t errors = 0;
+    std::array<char, TX_TIMESTAMP_CONTROL_SIZE> control{};
+    while (true) {
+        struct msghdr message = {};
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+        if (recvmsg(socket, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            return errors;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&message); cm != nullptr; cm = CMSG_NXTHDR(&message, cm)) {
+            if ((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                struct sock_extended_err err {};
+                memcpy(&err, CMSG_DATA(cm), sizeof(err));
+                errors += err.ee_origin == SO_EE_ORIGIN_TXTIME ? 1 : 0;
+            }
+        }
+    }
+}
 auto isWithinEpsilon(double a, double b, double percentEpsilon) -> bool
 {
     return (std::abs(a - b) <= (std::max(std::abs(a), std::abs(b)) * percentEpsilon));
@@ -178,8 +178,14 @@ test_client_seed_reproducibility() {
     stop_server
     cp "${CLIENT_OUTPUT}" "${TEST_OUTPUT_DIR}/seed_test2.txt"
     
-    # With same seed, payload pattern should be similar
-    # (Note: timing will differ, but payload sizes should be deterministic)
+    # Timing differs between runs, but the payload length of each sequence number is drawn from the seed
+    local lens1 lens2
+    lens1=$(awk -F, '/^[0-9]/ { print $3, $NF }' "${TEST_OUTPUT_DIR}/seed_test1.txt" | sort -n)
+    lens2=$(awk -F, '/^[0-9]/ { print $3, $NF }' "${TEST_OUTPUT_DIR}/seed_test2.txt" | sort -n)
+    if [ -z "$lens1" ] || [ "$lens1" != "$lens2" ]; then
+        log_error "The same seed should give the same payload lengths"
+        return 1
+    fi
     return 0
 }
 
@@ -524,6 +530,708 @@ test_server_tos_value() {
     assert_exit_code 0 $exit_code "Server with TOS=64"
 }
 
+test_server_batch_mode() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 5 "--batch 8" || return 1
+    
+    run_client "$port" 5
+    local exit_code=$?
+    
+    # Server exits after num_samples and prints its counters
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against batched server" || return 1
+    
+    local rows
+    rows=$(grep -c "^[0-9]*,127.0.0.1," "${SERVER_OUTPUT}" || true)
+    if [ "$rows" -ne 5 ]; then
+        log_error "Expected 5 reflected rows from batched server, got $rows"
+        return 1
+    fi
+    if ! grep -q "reflections per call" "${SERVER_OUTPUT}"; then
+        log_error "Batched server should report reflections per call"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_workers() {
+    local port
+    port=$(get_next_port)
+    
+    # num_samples is shared by the workers, so the pool exits after 6 samples in total
+    start_server "$port" 6 "--workers 2" || return 1
+    
+    run_client "$port" 6
+    local exit_code=$?
+    
+    sleep 1
+    if [ -f "${SERVER_PID_FILE}" ]; then
+        local pid
+        pid=$(cat "${SERVER_PID_FILE}")
+        if kill -0 "$pid" 2>/dev/null; then
+            log_error "Worker pool should have terminated after num_samples"
+            stop_server
+            return 1
+        fi
+    fi
+    
+    assert_exit_code 0 $exit_code "Client against worker pool" || return 1
+    
+    if [ "$(grep -c "^Worker [0-9]" "${SERVER_OUTPUT}")" -ne 2 ]; then
+        log_error "Expected counters for 2 workers"
+        return 1
+    fi
+    if ! grep -q "^Total: Received 6 packets" "${SERVER_OUTPUT}"; then
+        log_error "Worker pool should have received 6 packets in total"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_io_uring() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 5 "--io-uring" || return 1
+    
+    run_client "$port" 5
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    # Builds without io_uring support reject the flag at startup
+    if grep -q "does not include the io_uring engine" "${SERVER_OUTPUT}"; then
+        log_warn "io_uring engine not compiled in, skipping"
+        return 0
+    fi
+    
+    assert_exit_code 0 $exit_code "Client against io_uring server" || return 1
+    
+    local rows
+    rows=$(grep -c "^[0-9]*,127.0.0.1," "${SERVER_OUTPUT}" || true)
+    if [ "$rows" -ne 5 ]; then
+        log_error "Expected 5 reflected rows from io_uring server, got $rows"
+        return 1
+    fi
+    if ! grep -q "^Received 5 packets" "${SERVER_OUTPUT}"; then
+        log_error "io_uring server should report its counters"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_async_log() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 5 "--async-log" || return 1
+    
+    run_client "$port" 5
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against server with async log" || return 1
+    
+    # The writer thread must flush every queued record before the server exits
+    local rows
+    rows=$(grep -c "^[0-9]*,127.0.0.1," "${SERVER_OUTPUT}" || true)
+    if [ "$rows" -ne 5 ]; then
+        log_error "Expected 5 rows from the async log writer, got $rows"
+        return 1
+    fi
+    if ! grep -q "0 log records dropped" "${SERVER_OUTPUT}"; then
+        log_error "Server should report no dropped log records"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_tx_timestamp() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 5 "--tx-timestamp" || return 1
+    
+    run_client "$port" 5
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against server with TX timestamps" || return 1
+    
+    local rows
+    rows=$(grep -c "^[0-9]*,127.0.0.1," "${SERVER_OUTPUT}" || true)
+    if [ "$rows" -ne 5 ]; then
+        log_error "Expected 5 reflected rows with TX timestamps, got $rows"
+        return 1
+    fi
+    # Loopback always stamps in software, so every send time should come from the error queue
+    if ! grep -q "0 TX timestamps missed" "${SERVER_OUTPUT}"; then
+        log_error "Server should have found a TX timestamp for every reflected packet"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_stateful() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 5 "--stateful" || return 1
+    
+    run_client "$port" 5
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against stateful server" || return 1
+    
+    # One client is one session, reported when the server exits
+    if [ "$(grep -c "^Session 127.0.0.1:" "${SERVER_OUTPUT}")" -ne 1 ]; then
+        log_error "Expected exactly one session summary"
+        return 1
+    fi
+    if ! grep -q "received 5, reflected 5, lost 0" "${SERVER_OUTPUT}"; then
+        log_error "Session summary should count 5 received and reflected packets without loss"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_stateful_renumbered() {
+    local port
+    port=$(get_next_port)
+    local client_port
+    client_port=$(get_next_port)
+    
+    start_server "$port" 10 "--stateful" || return 1
+    
+    # The second run reuses the session, so the reflector numbers its replies 5 to 9 while the client sends 0 to 4
+    run_client "$port" 5 "-P $client_port"
+    run_client "$port" 5 "-P $client_port --print-digest"
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against a renumbering stateful server" || return 1
+    if ! grep -q "received 10, reflected 10, lost 0" "${SERVER_OUTPUT}"; then
+        log_error "Both runs should share one session on the server"
+        return 1
+    fi
+    if ! grep -q "^Packets lost: 0" "${CLIENT_OUTPUT}"; then
+        log_error "Client should match replies on the sender sequence number, not the reflector's"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_rate_limit() {
+    local port
+    port=$(get_next_port)
+    
+    # 20 packets 10 ms apart are far above 5 packets per second with a burst of 2
+    start_server "$port" 0 "-t 2 --rate-limit 5 --rate-burst 2" || return 1
+    
+    run_client "$port" 20
+    
+    sleep 3
+    stop_server
+    
+    local rows
+    rows=$(grep -c "^[0-9]*,127.0.0.1," "${SERVER_OUTPUT}" || true)
+    if [ "$rows" -lt 2 ] || [ "$rows" -gt 6 ]; then
+        log_error "Expected the burst plus a few refilled packets to be reflected, got $rows"
+        return 1
+    fi
+    if ! grep -q "^Rate limited source 127.0.0.1: passed $rows, dropped $((20 - rows))" "${SERVER_OUTPUT}"; then
+        log_error "Server should report the drops of the rate limited source"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_multi_listen() {
+    local port1 port2
+    port1=$(get_next_port)
+    port2=$((port1 + 1))
+    
+    # One process serves both ports, plus an IPv6 wildcard socket on the first that must not clash with IPv4
+    start_server "$port1" 6 "--listen 127.0.0.1:$port1-$port2 --listen [::]:$port1" || return 1
+    
+    "${CLIENT}" -n 3 -i 10 "127.0.0.1:$port1" "127.0.0.1:$port2" &>"${CLIENT_OUTPUT}"
+    local exit_code=$?
+    
+    # The server stops by itself once both sockets together have seen 6 samples
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against a multi-socket server" || return 1
+    if ! grep -q "^127.0.0.1:$port1: Received 3 packets" "${SERVER_OUTPUT}" ||
+        ! grep -q "^127.0.0.1:$port2: Received 3 packets" "${SERVER_OUTPUT}"; then
+        log_error "Each listening socket should report its own packets"
+        return 1
+    fi
+    if ! grep -q "^Total: Received 6 packets" "${SERVER_OUTPUT}"; then
+        log_error "Server should report the total over all sockets"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_client_fanout() {
+    local port1 port3
+    port1=$(get_next_port)
+    port3=$((port1 + 2))
+    
+    start_server "$port1" 15 "--listen 127.0.0.1:$port1-$port3" || return 1
+    
+    # Every reflector gets a session of its own, and so the whole sequence space
+    "${CLIENT}" -n 5 -i 10 "127.0.0.1:$port1" "127.0.0.1:$((port1 + 1))" "127.0.0.1:$port3" &>"${CLIENT_OUTPUT}"
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client fanning out to three reflectors" || return 1
+    local port
+    for port in "$port1" "$((port1 + 1))" "$port3"; do
+        if [ "$(awk -F, -v port="$port" '/^[0-9]/ && $6 == port' "${CLIENT_OUTPUT}" | wc -l)" -ne 5 ]; then
+            log_error "Client should get all 5 probes back from the reflector on port $port"
+            return 1
+        fi
+    done
+    if ! grep -q "^Total: Received 15 packets" "${SERVER_OUTPUT}"; then
+        log_error "The reflectors should receive 15 packets in all"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_client_sessions_shared_port() {
+    local port1 port2 local_port
+    port1=$(get_next_port)
+    port2=$((port1 + 1))
+    local_port=$(get_next_port)
+    
+    start_server "$port1" 8 "--listen 127.0.0.1:$port1-$port2" || return 1
+    
+    # Both sessions bind the same local port; their connected sockets still keep the replies apart
+    "${CLIENT}" -n 4 -i 10 -P "$local_port" "127.0.0.1:$port1" "127.0.0.1:$port2" \
+        --print-format raw --print-digest &>"${CLIENT_OUTPUT}"
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client with two sessions on one local port" || return 1
+    if [ "$(grep -c "^Reflector 127.0.0.1:" "${CLIENT_OUTPUT}")" -ne 2 ]; then
+        log_error "Each reflector should get its own digest"
+        return 1
+    fi
+    if [ "$(grep -c "^Packets lost: 0" "${CLIENT_OUTPUT}")" -ne 2 ]; then
+        log_error "Neither session should lose packets to the other"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_client_batch_receive() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 20 "--batch 8" || return 1
+    
+    # Replies queue up while the probes go out 1 ms apart, so recvmmsg takes several per call
+    "${CLIENT}" -n 20 -i 1 --batch 16 "127.0.0.1:$port" --print-format raw --print-digest &>"${CLIENT_OUTPUT}"
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client receiving in batches" || return 1
+    if [ "$(grep -c "^[0-9]" "${CLIENT_OUTPUT}")" -ne 20 ]; then
+        log_error "Client should print a row for each of the 20 probes"
+        return 1
+    fi
+    if ! grep -q "^Packets lost: 0" "${CLIENT_OUTPUT}"; then
+        log_error "Batched receive should not lose packets"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_client_reorder_window() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 20 || return 1
+    
+    run_client "$port" 20 "--print-format raw --print-digest --reorder-window 50"
+    local exit_code=$?
+    
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client with a reordering window" || return 1
+    # The raw rows come out in sequence order
+    if ! grep "^[0-9]" "${CLIENT_OUTPUT}" | cut -d, -f1 | sort -n -c; then
+        log_error "Client should print the raw rows in sequence order"
+        return 1
+    fi
+    if [ "$(grep -c "^[0-9]" "${CLIENT_OUTPUT}")" -ne 20 ]; then
+        log_error "Client should print a row for each of the 20 probes"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_client_train() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 24 || return 1
+    
+    run_client "$port" 24 "--print-format raw --print-digest --train 4 --train-size 1000"
+    local exit_code=$?
+    
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client in train mode" || return 1
+    if ! grep -q "^Packets sent: 24" "${CLIENT_OUTPUT}"; then
+        log_error "Client should send 6 trains of 4 packets"
+        return 1
+    fi
+    if ! grep -q "^Capacity forward: median [0-9.]* Mbit/s.* over [0-9]* trains of 4 packets" "${CLIENT_OUTPUT}" ||
+        ! grep -q "^Capacity backward: median [0-9.]* Mbit/s" "${CLIENT_OUTPUT}"; then
+        log_error "Digest should report a capacity estimate for each direction"
+        return 1
+    fi
+    if [ "$(awk -F, '/^[0-9]/ && $2 != 1000' "${CLIENT_OUTPUT}" | wc -l)" -ne 0 ]; then
+        log_error "Every train packet should have the --train-size payload"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_metrics_socket() {
+    local port
+    port=$(get_next_port)
+    local socket_path="${TEST_OUTPUT_DIR}/metrics.sock"
+    
+    if ! command -v curl &>/dev/null; then
+        log_warn "curl not found, skipping"
+        return 0
+    fi
+    
+    start_server "$port" 0 "-t 30 --metrics-socket ${socket_path}" || return 1
+    
+    run_client "$port" 5
+    
+    local metrics
+    metrics=$(curl -s --unix-socket "${socket_path}" http://localhost/metrics)
+    stop_server
+    
+    if ! grep -q "^twamp_reflector_reflected_packets_total 5$" <<<"$metrics"; then
+        log_error "Metrics should count the 5 reflected packets"
+        return 1
+    fi
+    if ! grep -q "^twamp_reflector_internal_delay_seconds_count 5$" <<<"$metrics"; then
+        log_error "Internal delay histogram should hold the 5 reflected packets"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_metrics_socket_keeps_files() {
+    local port
+    port=$(get_next_port)
+    setup_test_dir
+    local file_path="${TEST_OUTPUT_DIR}/not-a-socket"
+    echo "keep me" >"${file_path}"
+    
+    # A mistyped --metrics-socket must not delete the file it names
+    timeout 5 "${SERVER}" -P "$port" -t 1 --metrics-socket "${file_path}" &>"${SERVER_OUTPUT}"
+    local exit_code=$?
+    
+    if [ $exit_code -eq 0 ]; then
+        log_error "Server should fail to listen on a path that is not a socket"
+        return 1
+    fi
+    if [ "$(cat "${file_path}" 2>/dev/null)" != "keep me" ]; then
+        log_error "The file at the metrics socket path should be left alone"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_busy_poll() {
+    local port
+    port=$(get_next_port)
+    
+    # SO_BUSY_POLL may be refused without CAP_NET_ADMIN; the spin runs either way
+    start_server "$port" 5 "-t 5 --busy-poll 50" || return 1
+    
+    run_client "$port" 5
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against a busy-polling server" || return 1
+    if ! grep -q "^Received 5 packets" "${SERVER_OUTPUT}"; then
+        log_error "Busy-polling server should reflect all 5 packets"
+        return 1
+    fi
+    if ! grep -q "^Internal delay of 5 packets: mean" "${SERVER_OUTPUT}"; then
+        log_error "Busy-polling server should report the internal delay distribution"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_quiet() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 3 "-t 5 --quiet --batch 8" || return 1
+    
+    run_client "$port" 3
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against a quiet server" || return 1
+    if grep -q "^Time" "${SERVER_OUTPUT}"; then
+        log_error "Quiet server should not print the per-packet header"
+        return 1
+    fi
+    if ! grep -q "^Received 3 packets" "${SERVER_OUTPUT}"; then
+        log_error "Quiet server should still count the reflected packets"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_loadtest_in_process() {
+    local output
+    output=$("${LOADTEST}" --duration 1 --threads 2 --rate 500 2>&1)
+    local exit_code=$?
+    
+    assert_exit_code 0 $exit_code "Load test against the in-process reflector" || return 1
+    if ! echo "$output" | grep -q "^Sent 1000 packets"; then
+        log_error "Two senders at 500 packets/s should send 1000 packets in 1 s"
+        echo "$output"
+        return 1
+    fi
+    if ! echo "$output" | grep -q "^Reflected [1-9][0-9]* packets"; then
+        log_error "Load test should report reflected packets"
+        return 1
+    fi
+    if ! echo "$output" | grep -q "^Reflector internal delay (us): p50"; then
+        log_error "Load test should report the internal delay percentiles"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_loadtest_target() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 0 "-t 10 --quiet" || return 1
+    
+    local output
+    output=$("${LOADTEST}" --target "127.0.0.1:$port" --duration 1 --rate 200 2>&1)
+    local exit_code=$?
+    
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Load test against a running server" || return 1
+    if ! echo "$output" | grep -q "^Reflected [1-9][0-9]* packets"; then
+        log_error "Load test should report the packets the server reflected"
+        echo "$output"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_binary_log() {
+    local port
+    port=$(get_next_port)
+    local log_file="${TEST_OUTPUT_DIR}/server_log.bin"
+    
+    start_server "$port" 3 "-t 5 --log-format binary --log-file ${log_file}" || return 1
+    
+    run_client "$port" 3
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against a server logging in binary" || return 1
+    if grep -q "^Time" "${SERVER_OUTPUT}"; then
+        log_error "Binary logging server should not print the text output"
+        return 1
+    fi
+    local decoded
+    decoded=$("${LOGDECODE}" "${log_file}" 2>&1)
+    exit_code=$?
+    rm -f "${log_file}"
+    
+    assert_exit_code 0 $exit_code "Decoding the binary log" || return 1
+    if ! echo "$decoded" | head -1 | grep -q "^Time,IP,Snd#,Rcv#"; then
+        log_error "Decoded log should start with the text output header"
+        return 1
+    fi
+    if [ "$(echo "$decoded" | grep -c "^[0-9]*,127.0.0.1,[0-2],[0-2],[0-9]*,${port},")" -ne 3 ]; then
+        log_error "Decoded log should hold a line per reflected packet"
+        echo "$decoded"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_binary_log_idle_flush() {
+    local port
+    port=$(get_next_port)
+    local log_file="${TEST_OUTPUT_DIR}/server_idle_log.bin"
+    
+    # More samples than the client sends, so the server is still running and idle when the log is read
+    start_server "$port" 10 "--log-format binary --log-file ${log_file}" || return 1
+    
+    run_client "$port" 3
+    local exit_code=$?
+    
+    # Longer than the flush interval, without a packet to trigger the flush
+    sleep 2
+    local decoded
+    decoded=$("${LOGDECODE}" "${log_file}" 2>&1)
+    stop_server
+    rm -f "${log_file}"
+    
+    assert_exit_code 0 $exit_code "Client against a server logging in binary" || return 1
+    if [ "$(echo "$decoded" | grep -c "^[0-9]*,127.0.0.1,")" -ne 3 ]; then
+        log_error "An idle server should have flushed every reflected packet to its binary log"
+        echo "$decoded"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_binary_log_needs_file() {
+    local output
+    output=$("${SERVER}" --log-format binary 2>&1) || true
+    
+    if echo "$output" | grep -q "needs a --log-file"; then
+        return 0
+    fi
+    log_error "Binary logging without a --log-file should have been rejected"
+    return 1
+}
+
+test_server_steer_cpu() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 5 "-t 5 --workers 2 --steer-cpu" || return 1
+    
+    run_client "$port" 5
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against CPU-steered workers" || return 1
+    if grep -q "Cannot attach the CPU steering program" "${SERVER_OUTPUT}"; then
+        log_warn "Kernel refused the steering program, flows were hashed"
+    fi
+    # 5 packets are under one sample interval, so each worker that got any takes a single sample at shutdown
+    local samples
+    samples=$(grep "^Total: Received 5 packets" "${SERVER_OUTPUT}" |
+        sed -n "s/.*CPU samples (1 per 1024 packets): \([0-9]*\) on the reflector's CPU, \([0-9]*\) on other CPUs.*/\1 \2/p")
+    if [ -z "$samples" ]; then
+        log_error "Steered workers should report the CPU samples by receiving CPU"
+        return 1
+    fi
+    local total
+    total=$(echo "$samples" | awk '{print $1 + $2}')
+    if [ "$total" -lt 1 ] || [ "$total" -gt 2 ]; then
+        log_error "Expected one CPU sample per worker that got packets, got ${total}"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_multi_listen_cpu() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 5 "-t 5 --listen 127.0.0.1:$port --cpu 0" || return 1
+    
+    # The event loop runs on the main thread, whose id is the process id
+    local pid allowed
+    pid=$(cat "${SERVER_PID_FILE}")
+    allowed=$(awk '/^Cpus_allowed_list:/ {print $2}' "/proc/${pid}/status")
+    
+    run_client "$port" 5
+    local exit_code=$?
+    
+    sleep 1
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client against a pinned listen event loop" || return 1
+    if [ "$allowed" != "0" ]; then
+        log_error "The --listen event loop should be pinned to CPU 0, it may run on ${allowed}"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_server_steer_cpu_needs_workers() {
+    local output
+    output=$("${SERVER}" --workers 1 --steer-cpu 2>&1) || true
+    
+    if echo "$output" | grep -q "steer-cpu needs --workers"; then
+        return 0
+    fi
+    log_error "--steer-cpu with a single worker should have been rejected"
+    return 1
+}
+
 # ============================================================================
 # Combined/interaction tests
 # ============================================================================
@@ -591,6 +1299,62 @@ test_print_digest_with_raw_format() {
     return 0
 }
 
+test_client_txtime() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 20 || return 1
+    
+    run_client "$port" 20 "--print-format raw --print-digest --txtime --txtime-window 200"
+    local exit_code=$?
+    
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client with --txtime" || return 1
+    # Loopback has no fq or etf qdisc, so the client has to notice and keep pacing in user space
+    if ! grep -q "^Kernel pacing: " "${CLIENT_OUTPUT}"; then
+        log_error "Digest should report whether SO_TXTIME paced the packets"
+        return 1
+    fi
+    if ! grep -q "^Packets lost: 0" "${CLIENT_OUTPUT}"; then
+        log_error "No packets should be lost with --txtime"
+        return 1
+    fi
+    
+    return 0
+}
+
+test_print_digest_send_rate() {
+    local port
+    port=$(get_next_port)
+    
+    start_server "$port" 20 || return 1
+    
+    run_client "$port" 20 "--print-format raw --print-digest --constant-inter-packet-delay"
+    local exit_code=$?
+    
+    stop_server
+    
+    assert_exit_code 0 $exit_code "Client with the send rate report" || return 1
+    local achieved
+    achieved=$(grep "^Send rate: target 100.00 packets/s" "${CLIENT_OUTPUT}" | sed 's/.*achieved \([0-9.]*\) packets.*/\1/')
+    if [ -z "$achieved" ]; then
+        log_error "Digest should report the target and achieved send rates"
+        return 1
+    fi
+    # Paced on absolute deadlines, 10 ms gaps give 100 packets/s however long each send takes
+    if ! awk -v rate="$achieved" 'BEGIN { exit !(rate > 95 && rate < 105) }'; then
+        log_error "Achieved send rate $achieved should be close to 100 packets/s"
+        return 1
+    fi
+    if ! grep -q "^Send schedule error of 20 packets: mean" "${CLIENT_OUTPUT}"; then
+        log_error "Digest should report the send schedule error histogram"
+        return 1
+    fi
+    
+    return 0
+}
+
 # ============================================================================
 # Invalid input tests
 # ============================================================================
@@ -671,9 +1435,37 @@ main() {
     run_test "Server timeout" test_server_timeout
     run_test "Server separator" test_server_separator
     run_test "Server TOS value" test_server_tos_value
+    run_test "Server batch mode" test_server_batch_mode
+    run_test "Server worker pool" test_server_workers
+    run_test "Server io_uring engine" test_server_io_uring
+    run_test "Server async log writer" test_server_async_log
+    run_test "Server TX timestamps" test_server_tx_timestamp
+    run_test "Server stateful sessions" test_server_stateful
+    run_test "Server stateful renumbering" test_server_stateful_renumbered
+    run_test "Server per-source rate limit" test_server_rate_limit
+    run_test "Server multiple listen sockets" test_server_multi_listen
+    run_test "Server metrics socket" test_server_metrics_socket
+    run_test "Server metrics socket keeps other files" test_server_metrics_socket_keeps_files
+    run_test "Server busy-poll mode" test_server_busy_poll
+    run_test "Server quiet mode" test_server_quiet
+    run_test "Load test in-process reflector" test_loadtest_in_process
+    run_test "Load test remote target" test_loadtest_target
+    run_test "Server binary log" test_server_binary_log
+    run_test "Server binary log needs a file" test_server_binary_log_needs_file
+    run_test "Server binary log flushed while idle" test_server_binary_log_idle_flush
+    run_test "Server CPU steering" test_server_steer_cpu
+    run_test "Server CPU steering needs workers" test_server_steer_cpu_needs_workers
+    run_test "Server listen event loop pinned to a CPU" test_server_multi_listen_cpu
     run_test "Client-server IPv4" test_client_server_ipv4
     run_test "Multiple addresses" test_multiple_addresses
     run_test "Print digest with raw format" test_print_digest_with_raw_format
+    run_test "Print digest send rate" test_print_digest_send_rate
+    run_test "Client txtime" test_client_txtime
+    run_test "Client fan-out" test_client_fanout
+    run_test "Client sessions on a shared port" test_client_sessions_shared_port
+    run_test "Client batched receive" test_client_batch_receive
+    run_test "Client reordering window" test_client_reorder_window
+    run_test "Client train mode" test_client_train
     run_test "Client invalid address format" test_client_invalid_address_format
     run_test "Client no address" test_client_no_address
     
@@ -8,6 +8,8 @@ BUILD_DIR="${SCRIPT_DIR}/../build"
 # Paths to executables
 CLIENT="${BUILD_DIR}/twamp-light-client"
 SERVER="${BUILD_DIR}/twamp-light-server"
+LOADTEST="${BUILD_DIR}/twamp-light-loadtest"
+LOGDECODE="${BUILD_DIR}/twamp-light-logdecode"
 
 # Test output files
 TEST_OUTPUT_DIR="${BUILD_DIR}/test_output"
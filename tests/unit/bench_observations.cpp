@@ -0,0 +1,142 @@
+/**
+ * Microbenchmark of the client's observation queue (packetlist.h), run by hand rather than by ctest:
+ *
+ *   ./bench_observations [packets]
+ *
+ * A sender thread queues one observation per packet and a receiver thread three, as the client does, while a
+ * collator thread takes them. "locked" is the former path: every observation is a make_shared QEDObservation pushed
+ * through a mutex-guarded deque of shared_ptrs. "lock-free" copies plain observations through the ObservationQueue
+ * rings. The time is from the first push until the collator has taken the last observation.
+ */
+
+#include "packetlist.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+constexpr size_t DEFAULT_PACKETS = 2000000;
+constexpr size_t OBSERVATIONS_PER_PACKET = 4;
+constexpr size_t QUEUE_CAPACITY = 16384;
+constexpr size_t COLLATOR_BATCH_SIZE = 256;
+
+// Keeps the compiler from dropping work whose result is otherwise unused
+static volatile uint64_t sink;
+
+class LockedObservationList {
+  public:
+    void add(const std::shared_ptr<QEDObservation> &observation)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        observations.push_back(observation);
+    }
+    auto pop() -> std::shared_ptr<QEDObservation>
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (observations.empty()) {
+            return nullptr;
+        }
+        auto observation = observations.front();
+        observations.pop_front();
+        return observation;
+    }
+
+  private:
+    std::deque<std::shared_ptr<QEDObservation>> observations;
+    std::mutex mutex;
+};
+
+static auto bench_locked(size_t packets) -> double
+{
+    LockedObservationList list;
+    auto start = std::chrono::steady_clock::now();
+    std::thread sender([&list, packets]() {
+        for (uint32_t id = 0; id < packets; id++) {
+            list.add(std::make_shared<QEDObservation>(ObservationPoints::CLIENT_SEND, id, id, 100));
+        }
+    });
+    std::thread receiver([&list, packets]() {
+        for (uint32_t id = 0; id < packets; id++) {
+            list.add(std::make_shared<QEDObservation>(ObservationPoints::SERVER_SEND, id, id, 100));
+            list.add(std::make_shared<QEDObservation>(ObservationPoints::SERVER_RECEIVE, id, id, 100));
+            list.add(std::make_shared<QEDObservation>(ObservationPoints::CLIENT_RECEIVE, id, id, 100));
+        }
+    });
+    uint64_t sum = 0;
+    for (size_t taken = 0; taken < packets * OBSERVATIONS_PER_PACKET;) {
+        std::shared_ptr<QEDObservation> observation = list.pop();
+        if (!observation) {
+            std::this_thread::yield();
+            continue;
+        }
+        sum += observation->getEpochNanoseconds();
+        taken++;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    sender.join();
+    receiver.join();
+    sink = sum;
+    return elapsed.count() / (double) (packets * OBSERVATIONS_PER_PACKET);
+}
+
+static void push(ObservationQueue &queue, bool sent, const QEDObservation &observation)
+{
+    while (!(sent ? queue.tryPushSent(observation) : queue.tryPushReceived(observation))) {
+        std::this_thread::yield();
+    }
+}
+
+static auto bench_lock_free(size_t packets) -> double
+{
+    ObservationQueue queue(QUEUE_CAPACITY);
+    auto start = std::chrono::steady_clock::now();
+    std::thread sender([&queue, packets]() {
+        for (uint32_t id = 0; id < packets; id++) {
+            push(queue, true, {ObservationPoints::CLIENT_SEND, id, id, 100});
+        }
+    });
+    std::thread receiver([&queue, packets]() {
+        for (uint32_t id = 0; id < packets; id++) {
+            push(queue, false, {ObservationPoints::SERVER_SEND, id, id, 100});
+            push(queue, false, {ObservationPoints::SERVER_RECEIVE, id, id, 100});
+            push(queue, false, {ObservationPoints::CLIENT_RECEIVE, id, id, 100});
+        }
+    });
+    std::vector<QEDObservation> batch(COLLATOR_BATCH_SIZE);
+    uint64_t sum = 0;
+    for (size_t taken = 0; taken < packets * OBSERVATIONS_PER_PACKET;) {
+        size_t count = queue.popBatch(batch.data(), batch.size());
+        if (count == 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < count; i++) {
+            sum += batch[i].getEpochNanoseconds();
+        }
+        taken += count;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    sender.join();
+    receiver.join();
+    sink = sum;
+    return elapsed.count() / (double) (packets * OBSERVATIONS_PER_PACKET);
+}
+
+auto main(int argc, char **argv) -> int
+{
+    size_t packets = argc > 1 ? strtoul(argv[1], nullptr, 10) : DEFAULT_PACKETS;
+    // Warm up the allocator and the threads before measuring
+    bench_locked(packets / 10);
+    bench_lock_free(packets / 10);
+    double locked_ns = bench_locked(packets);
+    double lock_free_ns = bench_lock_free(packets);
+    std::cout << "sizeof(QEDObservation) " << sizeof(QEDObservation) << " bytes" << std::endl;
+    std::cout << "locked " << locked_ns << " ns/observation (" << 1e3 / locked_ns << " M/s), lock-free "
+              << lock_free_ns << " ns/observation (" << 1e3 / lock_free_ns << " M/s)" << std::endl;
+    return 0;
+}
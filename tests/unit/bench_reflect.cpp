@@ -0,0 +1,163 @@
+/**
+ * Microbenchmark of the per-packet reflection work (reflect.h), run by hand rather than by ctest:
+ *
+ *   ./bench_reflect [iterations]
+ *
+ * "copy" is the former path: zeroed receive and control buffers for every datagram and a zero-filled
+ * ReflectorPacket built and returned by value. "in place" rewrites the header inside a pooled receive buffer.
+ * Both take the same timestamps and receive the datagram with the same memcpy, so the difference is the
+ * zeroing and copying the in-place path avoids in the reflection itself.
+ *
+ * "server" is the whole per-packet path of a Server on the loopback: the receive, handleTestPacket, the send and
+ * recordMetrics, timed around drainSocket() while a sender socket keeps datagrams queued. It is run without
+ * per-packet output and with it, queued for the --async-log writer whose lines are discarded, so the difference is
+ * what logging costs the reflecting thread.
+ */
+
+#include "Server.h"
+#include "reflect.h"
+#include <arpa/inet.h>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr size_t CONTROL_BUFFER_SIZE = 1024;
+constexpr size_t DEFAULT_ITERATIONS = 2000000;
+// Datagrams queued to the server at a time, well within the default socket receive buffer
+constexpr size_t SERVER_BURST = 32;
+// The server path costs system calls, so it is run for fewer packets than the in-memory loops
+constexpr size_t SERVER_ITERATIONS_DIVISOR = 20;
+
+// Keeps the compiler from dropping work whose result is otherwise unused
+static volatile uint8_t sink;
+
+static auto craft_reflector_packet(const ClientPacket *client_packet, const Timestamp &receive_timestamp,
+                                   const IPHeader &ip_header) -> ReflectorPacket
+{
+    ReflectorPacket packet = {};
+    packet.seq_number = client_packet->seq_number;
+    packet.timestamp = htonts(get_timestamp());
+    packet.timestamp_error_estimate = htons(ERROR_ESTIMATE_DEFAULT_BITMAP);
+    packet.receive_timestamp = htonts(receive_timestamp);
+    packet.sender_seq_number = client_packet->seq_number;
+    packet.sender_timestamp = client_packet->timestamp;
+    packet.sender_error_estimate = client_packet->timestamp_error_estimate;
+    packet.sender_ttl = ip_header.ttl;
+    packet.sender_tos = ip_header.tos;
+    return packet;
+}
+
+static auto bench_copy(const ClientPacket &datagram, size_t payload_len, size_t iterations) -> double
+{
+    IPHeader ip_header = {HDR_TTL, 0};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        std::array<char, sizeof(ClientPacket)> buffer{};
+        std::array<char, CONTROL_BUFFER_SIZE> control{};
+        memcpy(buffer.data(), &datagram, payload_len);
+        control[0] = (char) i;
+        Timestamp receive_timestamp = get_timestamp();
+        ReflectorPacket packet = craft_reflector_packet(
+            reinterpret_cast<const ClientPacket *>(buffer.data()), receive_timestamp, ip_header);
+        sink = reinterpret_cast<const uint8_t *>(&packet)[payload_len - 1] ^ (uint8_t) control[0];
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (double) iterations;
+}
+
+static auto bench_in_place(const ClientPacket &datagram, size_t payload_len, size_t iterations) -> double
+{
+    IPHeader ip_header = {HDR_TTL, 0};
+    ReflectorPacket buffer;
+    std::array<char, CONTROL_BUFFER_SIZE> control;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        memcpy(static_cast<void *>(&buffer), &datagram, payload_len);
+        control[0] = (char) i;
+        Timestamp receive_timestamp = get_timestamp();
+        reflect_in_place(&buffer, receive_timestamp, ip_header);
+        sink = reinterpret_cast<const uint8_t *>(&buffer)[payload_len - 1] ^ (uint8_t) control[0];
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (double) iterations;
+}
+
+static auto bench_server(const ClientPacket &datagram, size_t payload_len, size_t packets, bool print_packets)
+    -> double
+{
+    Args args;
+    args.local_host = "127.0.0.1";
+    args.local_port = "0";
+    args.print_packets = print_packets;
+    args.async_log = true;
+    Server server(args);
+    struct sockaddr_in server_addr {};
+    socklen_t addr_len = sizeof(server_addr);
+    getsockname(server.getSocket(), reinterpret_cast<sockaddr *>(&server_addr), &addr_len);
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sender == -1 || connect(sender, reinterpret_cast<sockaddr *>(&server_addr), addr_len) != 0) {
+        std::cerr << "Cannot connect to the server: " << strerror(errno) << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    server.startListening();
+    ReflectorPacket reply;
+    std::chrono::duration<double, std::nano> elapsed{0};
+    for (size_t sent = 0; sent < packets; sent += SERVER_BURST) {
+        for (size_t i = 0; i < SERVER_BURST; i++) {
+            ssize_t written = send(sender, &datagram, payload_len, 0);
+            (void) written;
+        }
+        auto start = std::chrono::steady_clock::now();
+        while (server.drainSocket() == ReceiveStatus::Received) {
+        }
+        elapsed += std::chrono::steady_clock::now() - start;
+        while (recv(sender, &reply, sizeof(reply), MSG_DONTWAIT) > 0) {
+        }
+    }
+    server.finishListening();
+    close(sender);
+    uint64_t reflected = server.getCounters().reflected_packets;
+    return reflected == 0 ? 0 : elapsed.count() / (double) reflected;
+}
+
+auto main(int argc, char **argv) -> int
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : DEFAULT_ITERATIONS;
+    ClientPacket datagram;
+    datagram.seq_number = htonl(1);
+    datagram.timestamp = htonts(get_timestamp());
+
+    for (size_t payload_len : {(size_t) REFLECTOR_HEADER_SIZE, (size_t) 512, (size_t) TST_PKT_SIZE}) {
+        // Warm up caches and the clock before measuring
+        bench_copy(datagram, payload_len, iterations / 10);
+        bench_in_place(datagram, payload_len, iterations / 10);
+        double copy_ns = bench_copy(datagram, payload_len, iterations);
+        double in_place_ns = bench_in_place(datagram, payload_len, iterations);
+        std::cout << "payload " << payload_len << " bytes: copy " << copy_ns << " ns/packet, in place "
+                  << in_place_ns << " ns/packet, saving " << copy_ns - in_place_ns << " ns/packet" << std::endl;
+    }
+
+    // The log writer prints to stdout, which is not what is measured
+    std::streambuf *stdout_buffer = std::cout.rdbuf(nullptr);
+    std::array<std::array<double, 2>, 3> server_ns{};
+    size_t server_packets = iterations / SERVER_ITERATIONS_DIVISOR;
+    std::array<size_t, 3> payload_lens = {(size_t) REFLECTOR_HEADER_SIZE, (size_t) 512, (size_t) TST_PKT_SIZE};
+    for (size_t i = 0; i < payload_lens.size(); i++) {
+        bench_server(datagram, payload_lens[i], server_packets / 10, false);
+        server_ns[i][0] = bench_server(datagram, payload_lens[i], server_packets, false);
+        server_ns[i][1] = bench_server(datagram, payload_lens[i], server_packets, true);
+    }
+    std::cout.rdbuf(stdout_buffer);
+    std::cout.clear();
+    for (size_t i = 0; i < payload_lens.size(); i++) {
+        std::cout << "payload " << payload_lens[i] << " bytes: server " << server_ns[i][0]
+                  << " ns/packet without output, " << server_ns[i][1] << " ns/packet logging each packet"
+                  << std::endl;
+    }
+    return 0;
+}
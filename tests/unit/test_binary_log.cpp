@@ -0,0 +1,107 @@
+/**
+ * Unit tests for the binary per-packet log (BinaryLog.h)
+ */
+
+#include <gtest/gtest.h>
+#include "BinaryLog.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+#include <vector>
+
+static auto temp_path(const std::string &name) -> std::string
+{
+    return testing::TempDir() + name + "_" + std::to_string(getpid());
+}
+
+static auto read_file(const std::string &path) -> std::vector<char>
+{
+    std::ifstream file(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+// ============================================================================
+// Tests for the record layout
+// ============================================================================
+
+TEST(BinaryLogRecordTest, FileOrderIsLittleEndian) {
+    BinaryLogRecord record{};
+    record.send_time = 0x0102030405060708;
+    record.sender_seq_number = 0x0a0b0c0d;
+    record.sending_port = 0x1234;
+    binary_log_byte_order(&record);
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&record);
+    EXPECT_EQ(bytes[offsetof(BinaryLogRecord, send_time)], 0x08);
+    EXPECT_EQ(bytes[offsetof(BinaryLogRecord, send_time) + 7], 0x01);
+    EXPECT_EQ(bytes[offsetof(BinaryLogRecord, sender_seq_number)], 0x0d);
+    EXPECT_EQ(bytes[offsetof(BinaryLogRecord, sending_port)], 0x34);
+
+    binary_log_byte_order(&record);
+    EXPECT_EQ(record.send_time, 0x0102030405060708u);
+    EXPECT_EQ(record.sender_seq_number, 0x0a0b0c0du);
+    EXPECT_EQ(record.sending_port, 0x1234);
+}
+
+TEST(BinaryLogRecordTest, NegativeDelaysRoundTrip) {
+    BinaryLogRecord record{};
+    record.internal_delay = -1500;
+    record.forward_delay = -7;
+    binary_log_byte_order(&record);
+    binary_log_byte_order(&record);
+    EXPECT_EQ(record.internal_delay, -1500);
+    EXPECT_EQ(record.forward_delay, -7);
+}
+
+// ============================================================================
+// Tests for BinaryLogWriter
+// ============================================================================
+
+TEST(BinaryLogWriterTest, WritesHeaderThenRecords) {
+    std::string path = temp_path("binary_log_records");
+    {
+        BinaryLogWriter writer(path);
+        std::vector<BinaryLogRecord> records(3);
+        for (size_t i = 0; i < records.size(); i++) {
+            records[i].seq_number = (uint32_t) i;
+        }
+        ASSERT_TRUE(writer.append(records.data(), records.size()));
+        ASSERT_TRUE(writer.append(records.data(), 1));
+    }
+    std::vector<char> contents = read_file(path);
+    ASSERT_EQ(contents.size(), 5 * sizeof(BinaryLogRecord));
+    BinaryLogHeader header{};
+    memcpy(&header, contents.data(), sizeof(header));
+    EXPECT_EQ(memcmp(header.magic, BINARY_LOG_MAGIC, sizeof(header.magic)), 0);
+    EXPECT_EQ(header.version, BINARY_LOG_VERSION);
+    EXPECT_EQ(header.record_size, sizeof(BinaryLogRecord));
+    EXPECT_GT(header.start_time, 0u);
+
+    const auto *records = reinterpret_cast<const BinaryLogRecord *>(contents.data()) + 1;
+    EXPECT_EQ(records[2].seq_number, 2u);
+    EXPECT_EQ(records[3].seq_number, 0u);
+    std::remove(path.c_str());
+}
+
+TEST(BinaryLogWriterTest, SharedPerPathAndTruncates) {
+    std::string path = temp_path("binary_log_shared");
+    {
+        std::ofstream stale(path);
+        stale << "left over from an earlier run";
+    }
+    auto first = BinaryLogWriter::shared(path);
+    auto second = BinaryLogWriter::shared(path);
+    EXPECT_EQ(first, second);
+    BinaryLogRecord record{};
+    ASSERT_TRUE(first->append(&record, 1));
+    ASSERT_TRUE(second->append(&record, 1));
+    first.reset();
+    second.reset();
+    EXPECT_EQ(read_file(path).size(), 3 * sizeof(BinaryLogRecord));
+    std::remove(path.c_str());
+}
+
+TEST(BinaryLogWriterTest, UnwritablePathThrows) {
+    EXPECT_THROW(BinaryLogWriter("/nonexistent-directory/log.bin"), std::runtime_error);
+}
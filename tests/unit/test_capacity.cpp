@@ -0,0 +1,62 @@
+/**
+ * Unit tests for the packet train capacity estimator (capacity.h)
+ */
+
+#include <gtest/gtest.h>
+#include "capacity.h"
+
+constexpr uint32_t HEADER_BYTES = 28;
+constexpr uint16_t PAYLOAD = 1222; // 1250 bytes, 10000 bits, per packet
+
+TEST(CapacityTest, DispersionGivesCapacity) {
+    CapacityEstimator estimator(4, HEADER_BYTES);
+    // Forward: 10 us per packet is 1 Gbit/s. Backward: 100 us per packet is 100 Mbit/s.
+    for (uint32_t i = 0; i < 4; i++) {
+        estimator.add(i, PAYLOAD, 1000000 + i * 10000, 5000000 + i * 100000);
+    }
+    estimator.finish();
+    ASSERT_EQ(estimator.getForward().size(), 1u);
+    ASSERT_EQ(estimator.getBackward().size(), 1u);
+    EXPECT_DOUBLE_EQ(estimator.getForward()[0], 1e9);
+    EXPECT_DOUBLE_EQ(estimator.getBackward()[0], 1e8);
+}
+
+TEST(CapacityTest, TrainsAreSplitByPacketId) {
+    CapacityEstimator estimator(2, HEADER_BYTES);
+    estimator.add(0, PAYLOAD, 1000, 1000);
+    estimator.add(1, PAYLOAD, 11000, 11000);
+    // The gap between trains must not count as dispersion
+    estimator.add(2, PAYLOAD, 1000000, 1000000);
+    estimator.add(3, PAYLOAD, 1020000, 1020000);
+    estimator.finish();
+    ASSERT_EQ(estimator.getForward().size(), 2u);
+    EXPECT_DOUBLE_EQ(estimator.getForward()[0], 1e9);
+    EXPECT_DOUBLE_EQ(estimator.getForward()[1], 5e8);
+}
+
+TEST(CapacityTest, LostPacketsInsideATrainStillCount) {
+    CapacityEstimator estimator(4, HEADER_BYTES);
+    estimator.add(0, PAYLOAD, 1000, 0);
+    estimator.add(1, PAYLOAD, 0, 0); // Lost on the way out
+    estimator.add(2, PAYLOAD, 21000, 0);
+    estimator.add(3, PAYLOAD, 31000, 0);
+    estimator.finish();
+    ASSERT_EQ(estimator.getForward().size(), 1u);
+    EXPECT_DOUBLE_EQ(estimator.getForward()[0], 1e9);
+    // No packet came back, so there is nothing to say about the backward direction
+    EXPECT_TRUE(estimator.getBackward().empty());
+}
+
+TEST(CapacityTest, SingleArrivalGivesNoEstimate) {
+    CapacityEstimator estimator(3, HEADER_BYTES);
+    estimator.add(0, PAYLOAD, 1000, 1000);
+    estimator.add(1, PAYLOAD, 0, 0);
+    estimator.add(2, PAYLOAD, 0, 0);
+    estimator.finish();
+    EXPECT_TRUE(estimator.getForward().empty());
+    EXPECT_EQ(CapacityEstimator::median(estimator.getForward()), 0);
+}
+
+TEST(CapacityTest, MedianIgnoresOutliers) {
+    EXPECT_DOUBLE_EQ(CapacityEstimator::median({1e9, 9e9, 1.1e9, 0.2e9, 1e9}), 1e9);
+}
@@ -0,0 +1,144 @@
+/**
+ * Unit tests for the reflector metrics (metrics.h)
+ */
+
+#include <gtest/gtest.h>
+#include "metrics.h"
+#include <sstream>
+#include <thread>
+
+// ============================================================================
+// Tests for RelaxedCounter
+// ============================================================================
+
+TEST(RelaxedCounterTest, CountsAndCopies) {
+    RelaxedCounter counter;
+    counter++;
+    ++counter;
+    counter += 5;
+    EXPECT_EQ(counter.load(), 7u);
+
+    RelaxedCounter copy = counter;
+    counter++;
+    EXPECT_EQ((uint64_t) copy, 7u);
+    EXPECT_EQ((uint64_t) counter, 8u);
+}
+
+TEST(RelaxedCounterTest, ReaderSeesWriterProgress) {
+    RelaxedCounter counter;
+    constexpr uint64_t increments = 1000000;
+    std::thread writer([&counter]() {
+        for (uint64_t i = 0; i < increments; i++) {
+            counter++;
+        }
+    });
+    // Values read while the writer runs only ever grow
+    uint64_t last = 0;
+    while (last < increments) {
+        uint64_t value = counter.load();
+        ASSERT_GE(value, last);
+        last = value;
+    }
+    writer.join();
+    EXPECT_EQ(counter.load(), increments);
+}
+
+// ============================================================================
+// Tests for DelayHistogram
+// ============================================================================
+
+// ============================================================================
+// Tests for PacketSampler
+// ============================================================================
+
+TEST(PacketSamplerTest, SamplesOncePerInterval) {
+    PacketSampler sampler(4);
+    int samples = 0;
+    for (int i = 0; i < 10; i++) {
+        samples += sampler.count(1) ? 1 : 0;
+    }
+    EXPECT_EQ(samples, 2);
+    // The 2 packets left over get one more sample at the end, and only one
+    EXPECT_TRUE(sampler.finish());
+    EXPECT_FALSE(sampler.finish());
+}
+
+TEST(PacketSamplerTest, BatchCountsAsOneSample) {
+    PacketSampler sampler(4);
+    EXPECT_FALSE(sampler.count(3));
+    // A batch that crosses the interval is one sample, however many packets it holds
+    EXPECT_TRUE(sampler.count(9));
+    EXPECT_FALSE(sampler.finish());
+}
+
+TEST(PacketSamplerTest, NothingToSampleWithoutPackets) {
+    PacketSampler sampler(4);
+    EXPECT_FALSE(sampler.finish());
+    EXPECT_FALSE(sampler.count(0));
+    EXPECT_FALSE(sampler.finish());
+}
+
+TEST(DelayHistogramTest, BucketsByUpperBound) {
+    DelayHistogram histogram;
+    histogram.observe(500);      // <= 1 us
+    histogram.observe(1000);     // Bounds are inclusive
+    histogram.observe(1001);     // <= 2 us
+    histogram.observe(-20);      // Clamped to 0
+    histogram.observe(50000000); // Above the last bound
+    EXPECT_EQ(histogram.buckets[0].load(), 3u);
+    EXPECT_EQ(histogram.buckets[1].load(), 1u);
+    EXPECT_EQ(histogram.buckets.back().load(), 1u);
+    EXPECT_EQ(histogram.count(), 5u);
+    EXPECT_EQ(histogram.sum_nanoseconds.load(), 500u + 1000u + 1001u + 50000000u);
+}
+
+TEST(DelayHistogramTest, Sums) {
+    DelayHistogram first;
+    DelayHistogram second;
+    first.observe(1500);
+    second.observe(1500);
+    second.observe(3000);
+    first += second;
+    EXPECT_EQ(first.buckets[1].load(), 2u);
+    EXPECT_EQ(first.buckets[2].load(), 1u);
+    EXPECT_EQ(first.count(), 3u);
+}
+
+TEST(DelayHistogramTest, QuantileBound) {
+    DelayHistogram histogram;
+    for (int i = 0; i < 98; i++) {
+        histogram.observe(3000);
+    }
+    histogram.observe(40000);
+    histogram.observe(20000000);
+    EXPECT_EQ(histogram.quantileBound(0.5), 5000u);
+    EXPECT_EQ(histogram.quantileBound(0.99), 50000u);
+    EXPECT_EQ(histogram.quantileBound(1.0), UINT64_MAX);
+}
+
+// ============================================================================
+// Tests for the Prometheus text format
+// ============================================================================
+
+TEST(PrometheusFormatTest, Counter) {
+    std::ostringstream os;
+    write_prometheus_counter(os, "test_total", "A test.", 42);
+    EXPECT_EQ(os.str(), "# HELP test_total A test.\n# TYPE test_total counter\ntest_total 42\n");
+}
+
+TEST(PrometheusFormatTest, HistogramIsCumulative) {
+    DelayHistogram histogram;
+    histogram.observe(800);
+    histogram.observe(1500);
+    histogram.observe(20000000);
+    std::ostringstream os;
+    write_prometheus_histogram(os, "delay_seconds", "Delay.", histogram);
+    std::string text = os.str();
+    EXPECT_NE(text.find("# TYPE delay_seconds histogram\n"), std::string::npos);
+    EXPECT_NE(text.find("delay_seconds_bucket{le=\"0.000001\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("delay_seconds_bucket{le=\"0.000002\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("delay_seconds_bucket{le=\"0.010000\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("delay_seconds_bucket{le=\"+Inf\"} 3\n"), std::string::npos);
+    EXPECT_NE(text.find("delay_seconds_sum 0.020002300\n"), std::string::npos);
+    EXPECT_NE(text.find("delay_seconds_count 3\n"), std::string::npos);
+}
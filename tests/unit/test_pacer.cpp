@@ -0,0 +1,72 @@
+/**
+ * Unit tests for the absolute-deadline pacer (pacer.h)
+ */
+
+#include <gtest/gtest.h>
+#include "pacer.h"
+#include <unistd.h>
+
+constexpr uint64_t NANOSECONDS_IN_MILLISECOND = 1000000;
+
+TEST(PacerTest, WaitsForTheGap) {
+    Pacer pacer;
+    uint64_t start = monotonic_nanoseconds();
+    int64_t lateness = pacer.wait(2 * NANOSECONDS_IN_MILLISECOND);
+    uint64_t elapsed = monotonic_nanoseconds() - start;
+    EXPECT_GE(elapsed, 2 * NANOSECONDS_IN_MILLISECOND);
+    EXPECT_GE(lateness, 0);
+    EXPECT_EQ(pacer.getScheduleErrors().count(), 1u);
+}
+
+TEST(PacerTest, SlowWorkBetweenWaitsDoesNotDrift) {
+    // Each iteration spends most of its gap working; relative sleeps would add the work to every gap
+    constexpr uint64_t gap = 2 * NANOSECONDS_IN_MILLISECOND;
+    constexpr int waits = 50;
+    Pacer pacer;
+    pacer.wait(gap);
+    uint64_t start = monotonic_nanoseconds();
+    for (int i = 1; i < waits; i++) {
+        usleep(1500);
+        pacer.wait(gap);
+    }
+    uint64_t elapsed = monotonic_nanoseconds() - start;
+    // A relative sleep would take about 3.5 ms per iteration, 170 ms in all; the schedule keeps it near 98 ms
+    EXPECT_LT(elapsed, (waits - 1) * gap + 20 * NANOSECONDS_IN_MILLISECOND);
+    EXPECT_NEAR(pacer.scheduledRate(), 500.0, 0.01);
+    EXPECT_NEAR(pacer.achievedRate(), 500.0, 50.0);
+    EXPECT_EQ(pacer.getScheduleRestarts(), 0u);
+}
+
+TEST(PacerTest, LateWaitsReturnImmediately) {
+    Pacer pacer;
+    pacer.wait(0);
+    usleep(5000);
+    // The deadline passed while sleeping, so this is only bookkeeping
+    uint64_t start = monotonic_nanoseconds();
+    int64_t lateness = pacer.wait(NANOSECONDS_IN_MILLISECOND);
+    EXPECT_LT(monotonic_nanoseconds() - start, NANOSECONDS_IN_MILLISECOND);
+    EXPECT_GE(lateness, (int64_t) (3 * NANOSECONDS_IN_MILLISECOND));
+}
+
+TEST(PacerTest, RestartsScheduleWhenFarBehind) {
+    Pacer pacer;
+    pacer.wait(0);
+    usleep((PACER_MAX_LAG_NANOSECONDS + 100 * NANOSECONDS_IN_MILLISECOND) / 1000);
+    uint64_t start = monotonic_nanoseconds();
+    pacer.wait(NANOSECONDS_IN_MILLISECOND);
+    // A new schedule starts from now rather than bursting to catch up
+    EXPECT_GE(monotonic_nanoseconds() - start, NANOSECONDS_IN_MILLISECOND);
+    EXPECT_EQ(pacer.getScheduleRestarts(), 1u);
+}
+
+TEST(PacerTest, LeadWakesBeforeTheDeadline) {
+    Pacer pacer;
+    pacer.wait(0);
+    uint64_t first_deadline = pacer.getDeadline();
+    pacer.wait(5 * NANOSECONDS_IN_MILLISECOND, 3 * NANOSECONDS_IN_MILLISECOND);
+    uint64_t woke = monotonic_nanoseconds();
+    // The deadline stays where the gap put it; only the wake-up moves
+    EXPECT_EQ(pacer.getDeadline() - first_deadline, 5 * NANOSECONDS_IN_MILLISECOND);
+    EXPECT_GE(woke - first_deadline, 2 * NANOSECONDS_IN_MILLISECOND);
+    EXPECT_LT(woke, pacer.getDeadline());
+}
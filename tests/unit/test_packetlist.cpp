@@ -1,12 +1,13 @@
 /**
- * Unit tests for packetlist.h classes (QEDObservation, ObservationList)
+ * Unit tests for packetlist.h classes (QEDObservation, ObservationQueue)
  */
 
 #include <gtest/gtest.h>
 #include "packetlist.h"
+#include <atomic>
 #include <thread>
+#include <type_traits>
 #include <vector>
-#include <atomic>
 
 // ============================================================================
 // Tests for ObservationPoints enum
@@ -67,221 +68,135 @@ TEST_F(QEDObservationTest, MaxPayloadLen) {
     EXPECT_EQ(obs.getPayloadLen(), UINT16_MAX);
 }
 
+TEST_F(QEDObservationTest, DefaultConstructedIsZero) {
+    QEDObservation obs;
+    EXPECT_EQ(obs.getEpochNanoseconds(), 0U);
+    EXPECT_EQ(obs.getPacketId(), 0U);
+    EXPECT_EQ(obs.getPayloadLen(), 0U);
+}
+
+TEST_F(QEDObservationTest, IsPlainData) {
+    EXPECT_TRUE(std::is_trivially_copyable<QEDObservation>::value);
+    EXPECT_EQ(sizeof(QEDObservation), 24U);
+}
+
 // ============================================================================
-// Tests for ObservationList class
+// Tests for ObservationQueue class
 // ============================================================================
 
-class ObservationListTest : public ::testing::Test {
+class ObservationQueueTest : public ::testing::Test {
 protected:
-    ObservationList list;
-    
-    std::shared_ptr<QEDObservation> makeObs(uint32_t id) {
-        return std::make_shared<QEDObservation>(
-            ObservationPoints::CLIENT_SEND, 1000000ULL * id, id, 100);
+    ObservationQueue queue{64};
+    std::vector<QEDObservation> out = std::vector<QEDObservation>(64);
+
+    static QEDObservation makeObs(ObservationPoints point, uint32_t id) {
+        return {point, 1000000ULL * id, id, 100};
     }
 };
 
-TEST_F(ObservationListTest, InitiallyEmpty) {
-    EXPECT_TRUE(list.isEmpty());
-    EXPECT_EQ(list.getSize(), 0U);
-}
-
-TEST_F(ObservationListTest, AddObservation) {
-    auto obs = makeObs(1);
-    list.addObservation(obs);
-    
-    EXPECT_FALSE(list.isEmpty());
-    EXPECT_EQ(list.getSize(), 1U);
-}
-
-TEST_F(ObservationListTest, AddMultipleObservations) {
-    list.addObservation(makeObs(1));
-    list.addObservation(makeObs(2));
-    list.addObservation(makeObs(3));
-    
-    EXPECT_EQ(list.getSize(), 3U);
-}
-
-TEST_F(ObservationListTest, PopObservationFIFO) {
-    list.addObservation(makeObs(1));
-    list.addObservation(makeObs(2));
-    list.addObservation(makeObs(3));
-    
-    auto obs1 = list.popObservation();
-    EXPECT_EQ(obs1->getPacketId(), 1U);
-    
-    auto obs2 = list.popObservation();
-    EXPECT_EQ(obs2->getPacketId(), 2U);
-    
-    auto obs3 = list.popObservation();
-    EXPECT_EQ(obs3->getPacketId(), 3U);
-    
-    EXPECT_TRUE(list.isEmpty());
+TEST_F(ObservationQueueTest, InitiallyEmpty) {
+    EXPECT_EQ(queue.popBatch(out.data(), out.size()), 0U);
+    EXPECT_EQ(queue.capacity(), 64U);
 }
 
-TEST_F(ObservationListTest, GetOldestEntryDoesNotRemove) {
-    list.addObservation(makeObs(1));
-    list.addObservation(makeObs(2));
-    
-    auto oldest1 = list.getOldestEntry();
-    auto oldest2 = list.getOldestEntry();
-    
-    EXPECT_EQ(oldest1->getPacketId(), oldest2->getPacketId());
-    EXPECT_EQ(list.getSize(), 2U);
+TEST_F(ObservationQueueTest, EachProducerIsFIFO) {
+    for (uint32_t id = 1; id <= 3; id++) {
+        EXPECT_TRUE(queue.tryPushSent(makeObs(ObservationPoints::CLIENT_SEND, id)));
+        EXPECT_TRUE(queue.tryPushReceived(makeObs(ObservationPoints::CLIENT_RECEIVE, id)));
+    }
+    ASSERT_EQ(queue.popBatch(out.data(), out.size()), 6U);
+    for (uint32_t i = 0; i < 3; i++) {
+        EXPECT_EQ(out[i].getObservationPoint(), ObservationPoints::CLIENT_SEND);
+        EXPECT_EQ(out[i].getPacketId(), i + 1);
+        EXPECT_EQ(out[3 + i].getObservationPoint(), ObservationPoints::CLIENT_RECEIVE);
+        EXPECT_EQ(out[3 + i].getPacketId(), i + 1);
+    }
 }
 
-TEST_F(ObservationListTest, GetOldestEntryReturnsNullWhenEmpty) {
-    auto oldest = list.getOldestEntry();
-    EXPECT_EQ(oldest, nullptr);
+TEST_F(ObservationQueueTest, SendsComeBeforeReplies) {
+    // The reply was queued first, but the send of the earlier packet must reach the collator before it
+    EXPECT_TRUE(queue.tryPushReceived(makeObs(ObservationPoints::CLIENT_RECEIVE, 2)));
+    EXPECT_TRUE(queue.tryPushSent(makeObs(ObservationPoints::CLIENT_SEND, 1)));
+    ASSERT_EQ(queue.popBatch(out.data(), out.size()), 2U);
+    EXPECT_EQ(out[0].getPacketId(), 1U);
+    EXPECT_EQ(out[1].getPacketId(), 2U);
 }
 
-TEST_F(ObservationListTest, IteratorAccess) {
-    list.addObservation(makeObs(1));
-    list.addObservation(makeObs(2));
-    list.addObservation(makeObs(3));
-    
-    uint32_t expected_id = 1;
-    for (auto it = list.begin(); it != list.end(); ++it) {
-        EXPECT_EQ((*it)->getPacketId(), expected_id);
-        expected_id++;
+TEST_F(ObservationQueueTest, RepliesWaitWhileSendsFillTheBatch) {
+    EXPECT_TRUE(queue.tryPushReceived(makeObs(ObservationPoints::CLIENT_RECEIVE, 3)));
+    for (uint32_t id = 1; id <= 3; id++) {
+        EXPECT_TRUE(queue.tryPushSent(makeObs(ObservationPoints::CLIENT_SEND, id)));
     }
-}
-
-TEST_F(ObservationListTest, GetObservationsReturnsDeque) {
-    list.addObservation(makeObs(1));
-    list.addObservation(makeObs(2));
-    
-    const auto& observations = list.getObservations();
-    EXPECT_EQ(observations.size(), 2U);
+    ASSERT_EQ(queue.popBatch(out.data(), 2), 2U);
+    EXPECT_EQ(out[0].getObservationPoint(), ObservationPoints::CLIENT_SEND);
+    EXPECT_EQ(out[1].getObservationPoint(), ObservationPoints::CLIENT_SEND);
+    ASSERT_EQ(queue.popBatch(out.data(), 2), 2U);
+    EXPECT_EQ(out[0].getObservationPoint(), ObservationPoints::CLIENT_SEND);
+    EXPECT_EQ(out[0].getPacketId(), 3U);
+    EXPECT_EQ(out[1].getObservationPoint(), ObservationPoints::CLIENT_RECEIVE);
+    EXPECT_EQ(queue.popBatch(out.data(), 2), 0U);
+}
+
+TEST_F(ObservationQueueTest, RejectsPushWhenFull) {
+    for (uint32_t id = 0; id < 64; id++) {
+        EXPECT_TRUE(queue.tryPushSent(makeObs(ObservationPoints::CLIENT_SEND, id)));
+    }
+    EXPECT_FALSE(queue.tryPushSent(makeObs(ObservationPoints::CLIENT_SEND, 64)));
+    // The other producer has a ring of its own
+    EXPECT_TRUE(queue.tryPushReceived(makeObs(ObservationPoints::CLIENT_RECEIVE, 0)));
 }
 
 // ============================================================================
-// Thread safety tests for ObservationList
+// Thread safety tests for ObservationQueue
 // ============================================================================
 
-class ObservationListThreadTest : public ::testing::Test {
-protected:
-    ObservationList list;
-    std::atomic<int> added_count{0};
-    std::atomic<int> popped_count{0};
-};
-
-TEST_F(ObservationListThreadTest, ConcurrentAdditions) {
-    const int num_threads = 4;
-    const int additions_per_thread = 100;
-    std::vector<std::thread> threads;
-    
-    for (int t = 0; t < num_threads; t++) {
-        threads.emplace_back([this, t, additions_per_thread]() {
-            for (int i = 0; i < additions_per_thread; i++) {
-                auto obs = std::make_shared<QEDObservation>(
-                    ObservationPoints::CLIENT_SEND, 
-                    static_cast<uint64_t>(t * 1000 + i), 
-                    static_cast<uint32_t>(t * 1000 + i), 
-                    100);
-                list.addObservation(obs);
-                added_count++;
-            }
-        });
-    }
-    
-    for (auto& thread : threads) {
-        thread.join();
-    }
-    
-    EXPECT_EQ(list.getSize(), static_cast<size_t>(num_threads * additions_per_thread));
-    EXPECT_EQ(added_count.load(), num_threads * additions_per_thread);
-}
+TEST(ObservationQueueThreadTest, SenderReceiverAndCollator) {
+    const uint32_t num_packets = 100000;
+    ObservationQueue queue(256);
+    std::atomic<uint32_t> sent{0};
 
-TEST_F(ObservationListThreadTest, ConcurrentAddAndPop) {
-    const int num_items = 1000;
-    
-    // Pre-populate with some items
-    for (int i = 0; i < num_items; i++) {
-        auto obs = std::make_shared<QEDObservation>(
-            ObservationPoints::CLIENT_SEND, 
-            static_cast<uint64_t>(i), 
-            static_cast<uint32_t>(i), 
-            100);
-        list.addObservation(obs);
-    }
-    
-    std::atomic<bool> stop{false};
-    std::atomic<int> pop_success{0};
-    std::atomic<int> add_success{0};
-    
-    // Start popping thread
-    std::thread popper([this, &stop, &pop_success]() {
-        while (!stop.load() || !list.isEmpty()) {
-            if (!list.isEmpty()) {
-                list.popObservation();
-                pop_success++;
+    std::thread sender([&queue, &sent, num_packets]() {
+        for (uint32_t id = 0; id < num_packets; id++) {
+            while (!queue.tryPushSent({ObservationPoints::CLIENT_SEND, id, id, 100})) {
+                std::this_thread::yield();
             }
+            sent.store(id + 1, std::memory_order_release);
         }
     });
-    
-    // Start adding thread
-    std::thread adder([this, &stop, &add_success]() {
-        for (int i = 0; i < 500 && !stop.load(); i++) {
-            auto obs = std::make_shared<QEDObservation>(
-                ObservationPoints::CLIENT_SEND, 
-                static_cast<uint64_t>(i + 10000), 
-                static_cast<uint32_t>(i + 10000), 
-                100);
-            list.addObservation(obs);
-            add_success++;
+    // Replies only exist for packets that were sent, as on the wire
+    std::thread receiver([&queue, &sent, num_packets]() {
+        for (uint32_t id = 0; id < num_packets; id++) {
+            while (sent.load(std::memory_order_acquire) <= id) {
+                std::this_thread::yield();
+            }
+            while (!queue.tryPushReceived({ObservationPoints::CLIENT_RECEIVE, id, id, 100})) {
+                std::this_thread::yield();
+            }
         }
     });
-    
-    adder.join();
-    stop.store(true);
-    popper.join();
-    
-    // All items should eventually be popped
-    // Note: some timing variations may occur
-    EXPECT_GE(pop_success.load(), 0);
-    EXPECT_EQ(add_success.load(), 500);
-}
-
-// ============================================================================
-// Edge case tests
-// ============================================================================
-
-TEST(ObservationListEdgeCaseTest, AddAndPopSingleItem) {
-    ObservationList list;
-    auto obs = std::make_shared<QEDObservation>(
-        ObservationPoints::CLIENT_SEND, 12345ULL, 1, 50);
-    
-    list.addObservation(obs);
-    EXPECT_FALSE(list.isEmpty());
-    
-    auto popped = list.popObservation();
-    EXPECT_EQ(popped->getPacketId(), 1U);
-    EXPECT_TRUE(list.isEmpty());
-}
 
-TEST(ObservationListEdgeCaseTest, LargeNumberOfItems) {
-    ObservationList list;
-    const size_t num_items = 10000;
-    
-    for (size_t i = 0; i < num_items; i++) {
-        auto obs = std::make_shared<QEDObservation>(
-            ObservationPoints::CLIENT_SEND, 
-            static_cast<uint64_t>(i), 
-            static_cast<uint32_t>(i), 
-            100);
-        list.addObservation(obs);
-    }
-    
-    EXPECT_EQ(list.getSize(), num_items);
-    
-    // Pop all items and verify order
-    for (size_t i = 0; i < num_items; i++) {
-        auto obs = list.popObservation();
-        EXPECT_EQ(obs->getPacketId(), static_cast<uint32_t>(i));
+    std::vector<QEDObservation> out(64);
+    uint32_t next_send = 0;
+    uint32_t next_reply = 0;
+    bool reply_before_send = false;
+    while (next_send < num_packets || next_reply < num_packets) {
+        size_t count = queue.popBatch(out.data(), out.size());
+        for (size_t i = 0; i < count; i++) {
+            if (out[i].getObservationPoint() == ObservationPoints::CLIENT_SEND) {
+                EXPECT_EQ(out[i].getPacketId(), next_send);
+                next_send++;
+            } else {
+                EXPECT_EQ(out[i].getPacketId(), next_reply);
+                reply_before_send |= out[i].getPacketId() >= next_send;
+                next_reply++;
+            }
+        }
     }
-    
-    EXPECT_TRUE(list.isEmpty());
+    sender.join();
+    receiver.join();
+
+    EXPECT_FALSE(reply_before_send);
+    EXPECT_EQ(queue.popBatch(out.data(), out.size()), 0U);
 }
 
 // ============================================================================
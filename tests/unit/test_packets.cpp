@@ -4,6 +4,7 @@
 
 #include <gtest/gtest.h>
 #include "packets.h"
+#include "reflect.h"
 #include <cstring>
 
 // ============================================================================
@@ -206,6 +207,41 @@ TEST(MemoryLayoutTest, ReflectorPacketContiguous) {
     EXPECT_EQ(ts_ptr - base, 4);
 }
 
+// ============================================================================
+// Tests for in-place reflection (reflect.h)
+// ============================================================================
+
+TEST(ReflectInPlaceTest, OverlaysSenderFields) {
+    ClientPacket sender;
+    sender.seq_number = htonl(7);
+    sender.timestamp = {htonl(100), htonl(200)};
+    sender.timestamp_error_estimate = htons(0x8002);
+    // Whatever the sender put in its padding, the reflector's MBZ fields must still be zero
+    memset(sender.padding.data(), 0xab, sender.padding.size());
+
+    ReflectorPacket packet;
+    memcpy(static_cast<void *>(&packet), &sender, sizeof(sender));
+    Timestamp receive_timestamp = {300, 400};
+    IPHeader ip_header = {64, 0x10};
+    reflect_in_place(&packet, receive_timestamp, ip_header);
+
+    EXPECT_EQ(ntohl(packet.seq_number), 7U);
+    EXPECT_EQ(ntohl(packet.sender_seq_number), 7U);
+    EXPECT_EQ(ntohl(packet.sender_timestamp.integer), 100U);
+    EXPECT_EQ(ntohl(packet.sender_timestamp.fractional), 200U);
+    EXPECT_EQ(ntohs(packet.sender_error_estimate), 0x8002);
+    EXPECT_EQ(ntohs(packet.timestamp_error_estimate), ERROR_ESTIMATE_DEFAULT_BITMAP);
+    EXPECT_EQ(ntohl(packet.receive_timestamp.integer), 300U);
+    EXPECT_EQ(ntohl(packet.receive_timestamp.fractional), 400U);
+    EXPECT_NE(packet.timestamp.integer, 0U);
+    EXPECT_EQ(packet.sender_ttl, 64);
+    EXPECT_EQ(packet.sender_tos, 0x10);
+    EXPECT_EQ(packet.mbz1[0] | packet.mbz1[1] | packet.mbz2[0] | packet.mbz2[1], 0);
+    // The padding after the reflector header is sent back untouched
+    EXPECT_EQ(packet.padding[0], 0xab);
+    EXPECT_EQ(packet.padding.back(), 0xab);
+}
+
 // ============================================================================
 // Main
 // ============================================================================
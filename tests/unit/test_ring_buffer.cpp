@@ -0,0 +1,120 @@
+/**
+ * Unit tests for ring_buffer.h (SpscRing)
+ */
+
+#include <gtest/gtest.h>
+#include "ring_buffer.h"
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// ============================================================================
+// Single-threaded behaviour
+// ============================================================================
+
+TEST(SpscRingTest, CapacityRoundsUpToPowerOfTwo) {
+    SpscRing<int> ring(100);
+    EXPECT_EQ(ring.capacity(), 128u);
+
+    SpscRing<int> exact(64);
+    EXPECT_EQ(exact.capacity(), 64u);
+}
+
+TEST(SpscRingTest, PopFromEmptyRing) {
+    SpscRing<int> ring(8);
+    int value = 0;
+    EXPECT_FALSE(ring.tryPop(value));
+
+    std::vector<int> out(8);
+    EXPECT_EQ(ring.popBatch(out.data(), out.size()), 0u);
+}
+
+TEST(SpscRingTest, PreservesOrder) {
+    SpscRing<int> ring(8);
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(ring.tryPush(i));
+    }
+    for (int i = 0; i < 5; i++) {
+        int value = -1;
+        EXPECT_TRUE(ring.tryPop(value));
+        EXPECT_EQ(value, i);
+    }
+}
+
+TEST(SpscRingTest, RejectsPushWhenFull) {
+    SpscRing<int> ring(4);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(ring.tryPush(i));
+    }
+    EXPECT_FALSE(ring.tryPush(4));
+
+    int value = -1;
+    EXPECT_TRUE(ring.tryPop(value));
+    EXPECT_EQ(value, 0);
+    // Popping one frees exactly one slot
+    EXPECT_TRUE(ring.tryPush(4));
+    EXPECT_FALSE(ring.tryPush(5));
+}
+
+TEST(SpscRingTest, PopBatchIsLimitedByMaxItems) {
+    SpscRing<int> ring(16);
+    for (int i = 0; i < 10; i++) {
+        ring.tryPush(i);
+    }
+    std::vector<int> out(4);
+    EXPECT_EQ(ring.popBatch(out.data(), out.size()), 4u);
+    EXPECT_EQ(out[0], 0);
+    EXPECT_EQ(out[3], 3);
+
+    std::vector<int> rest(16);
+    EXPECT_EQ(ring.popBatch(rest.data(), rest.size()), 6u);
+    EXPECT_EQ(rest[0], 4);
+    EXPECT_EQ(rest[5], 9);
+}
+
+TEST(SpscRingTest, WrapsAround) {
+    SpscRing<int> ring(4);
+    int value = 0;
+    for (int i = 0; i < 100; i++) {
+        EXPECT_TRUE(ring.tryPush(i));
+        EXPECT_TRUE(ring.tryPop(value));
+        EXPECT_EQ(value, i);
+    }
+}
+
+// ============================================================================
+// Concurrent producer and consumer
+// ============================================================================
+
+TEST(SpscRingTest, ConcurrentProducerConsumer) {
+    const uint64_t num_items = 200000;
+    SpscRing<uint64_t> ring(1024);
+
+    std::thread producer([&]() {
+        for (uint64_t i = 0; i < num_items; i++) {
+            while (!ring.tryPush(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    std::vector<uint64_t> batch(64);
+    uint64_t expected = 0;
+    bool in_order = true;
+    while (expected < num_items) {
+        size_t count = ring.popBatch(batch.data(), batch.size());
+        for (size_t i = 0; i < count; i++) {
+            if (batch[i] != expected) {
+                in_order = false;
+            }
+            expected++;
+        }
+        if (count == 0) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+
+    EXPECT_TRUE(in_order);
+    EXPECT_EQ(expected, num_items);
+}
@@ -0,0 +1,70 @@
+/**
+ * Unit tests for the client's probe schedule (schedule.h)
+ */
+
+#include <gtest/gtest.h>
+#include "schedule.h"
+#include <map>
+
+constexpr uint64_t MEAN_GAP = 1000000;
+const std::vector<uint16_t> PAYLOAD_LENS = {50, 250, 1400};
+
+TEST(ScheduleTest, SameSeedGivesSameSchedule) {
+    ProbeSchedule first(MEAN_GAP, false, PAYLOAD_LENS, 42);
+    ProbeSchedule second(MEAN_GAP, false, PAYLOAD_LENS, 42);
+    ProbeSchedule other(MEAN_GAP, false, PAYLOAD_LENS, 43);
+    int differences = 0;
+    // Longer than the ring, so refills are covered too
+    for (size_t i = 0; i < 3 * SCHEDULE_RING_SIZE; i++) {
+        ScheduledProbe a = first.next();
+        ScheduledProbe b = second.next();
+        ScheduledProbe c = other.next();
+        ASSERT_EQ(a.gap_nanoseconds, b.gap_nanoseconds);
+        ASSERT_EQ(a.payload_len, b.payload_len);
+        differences += a.gap_nanoseconds != c.gap_nanoseconds ? 1 : 0;
+    }
+    EXPECT_GT(differences, 0);
+}
+
+TEST(ScheduleTest, ExponentialGapsHaveTheMean) {
+    ProbeSchedule schedule(MEAN_GAP, false, PAYLOAD_LENS, 7);
+    constexpr int draws = 100000;
+    double sum = 0;
+    int above_mean = 0;
+    for (int i = 0; i < draws; i++) {
+        uint64_t gap = schedule.next().gap_nanoseconds;
+        sum += (double) gap;
+        above_mean += gap > MEAN_GAP ? 1 : 0;
+        schedule.refill();
+    }
+    EXPECT_NEAR(sum / draws, (double) MEAN_GAP, 0.02 * MEAN_GAP);
+    // P(gap > mean) = 1/e for an exponential distribution
+    EXPECT_NEAR((double) above_mean / draws, 0.3679, 0.01);
+}
+
+TEST(ScheduleTest, ConstantGaps) {
+    ProbeSchedule schedule(MEAN_GAP, true, PAYLOAD_LENS, 0);
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(schedule.next().gap_nanoseconds, MEAN_GAP);
+    }
+}
+
+TEST(ScheduleTest, PayloadLengthsAreUniformOverTheList) {
+    ProbeSchedule schedule(MEAN_GAP, false, PAYLOAD_LENS, 11);
+    std::map<uint16_t, int> counts;
+    constexpr int draws = 30000;
+    for (int i = 0; i < draws; i++) {
+        counts[schedule.next().payload_len]++;
+    }
+    ASSERT_EQ(counts.size(), PAYLOAD_LENS.size());
+    for (uint16_t len : PAYLOAD_LENS) {
+        EXPECT_NEAR(counts[len], draws / 3, draws / 30) << "payload length " << len;
+    }
+}
+
+TEST(ScheduleTest, GeneratorMatchesReferenceOutput) {
+    // xoshiro256** seeded with splitmix64(0), as in the reference implementation
+    Xoshiro256 generator(0);
+    EXPECT_EQ(generator(), 0x99ec5f36cb75f2b4u);
+    EXPECT_EQ(generator(), 0xbf6e1f784956452au);
+}
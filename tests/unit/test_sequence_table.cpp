@@ -0,0 +1,172 @@
+/**
+ * Unit tests for sequence_table.h (SequenceTable)
+ */
+
+#include <gtest/gtest.h>
+#include "sequence_table.h"
+#include <cstdint>
+
+constexpr size_t MAX_CAPACITY = 1024;
+
+namespace {
+struct Entry {
+    uint32_t id = 0;
+    int observations = 0;
+};
+} // namespace
+
+// ============================================================================
+// Lookup and release
+// ============================================================================
+
+TEST(SequenceTableTest, CapacityRoundsUpToPowerOfTwo) {
+    SequenceTable<Entry> table(100, MAX_CAPACITY);
+    EXPECT_EQ(table.capacity(), 128u);
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(table.oldest(), nullptr);
+}
+
+TEST(SequenceTableTest, InsertThenFindSameEntry) {
+    SequenceTable<Entry> table(8, MAX_CAPACITY);
+    bool inserted = false;
+    Entry *entry = table.findOrInsert(3, inserted);
+    ASSERT_NE(entry, nullptr);
+    EXPECT_TRUE(inserted);
+    entry->observations = 1;
+
+    Entry *again = table.findOrInsert(3, inserted);
+    EXPECT_FALSE(inserted);
+    EXPECT_EQ(again, entry);
+    EXPECT_EQ(table.find(3), entry);
+    EXPECT_EQ(table.find(4), nullptr);
+    EXPECT_EQ(table.size(), 1u);
+}
+
+TEST(SequenceTableTest, ReleasesInSequenceOrder) {
+    SequenceTable<Entry> table(8, MAX_CAPACITY);
+    bool inserted = false;
+    // Replies may create an entry before the send of an earlier packet is seen
+    for (uint32_t seq : {0u, 2u, 1u, 3u}) {
+        table.findOrInsert(seq, inserted)->id = seq;
+    }
+    for (uint32_t seq = 0; seq < 4; seq++) {
+        ASSERT_NE(table.oldest(), nullptr);
+        EXPECT_EQ(table.oldest()->id, seq);
+        table.popOldest();
+    }
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(table.oldest(), nullptr);
+}
+
+TEST(SequenceTableTest, SkipsSequenceNumbersNeverAdded) {
+    SequenceTable<Entry> table(8, MAX_CAPACITY);
+    bool inserted = false;
+    table.findOrInsert(0, inserted)->id = 0;
+    table.findOrInsert(3, inserted)->id = 3;
+    table.popOldest();
+    ASSERT_NE(table.oldest(), nullptr);
+    EXPECT_EQ(table.oldest()->id, 3u);
+}
+
+TEST(SequenceTableTest, RejectsReleasedSequenceNumbers) {
+    SequenceTable<Entry> table(8, MAX_CAPACITY);
+    bool inserted = false;
+    table.findOrInsert(5, inserted);
+    table.findOrInsert(6, inserted);
+    table.popOldest();
+    // A late reply for a packet already counted must not bring it back
+    EXPECT_EQ(table.findOrInsert(5, inserted), nullptr);
+    EXPECT_FALSE(inserted);
+    EXPECT_EQ(table.size(), 1u);
+}
+
+TEST(SequenceTableTest, InsertedEntryIsReset) {
+    SequenceTable<Entry> table(4, MAX_CAPACITY);
+    bool inserted = false;
+    table.findOrInsert(0, inserted)->observations = 7;
+    table.popOldest();
+    // Sequence number 4 reuses the slot of 0
+    Entry *entry = table.findOrInsert(4, inserted);
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(entry->observations, 0);
+}
+
+// ============================================================================
+// Growth and wraparound
+// ============================================================================
+
+TEST(SequenceTableTest, GrowsInsteadOfOverwriting) {
+    SequenceTable<Entry> table(4, MAX_CAPACITY);
+    bool inserted = false;
+    for (uint32_t seq = 0; seq < 100; seq++) {
+        table.findOrInsert(seq, inserted)->id = seq;
+    }
+    EXPECT_GE(table.capacity(), 100u);
+    EXPECT_EQ(table.size(), 100u);
+    for (uint32_t seq = 0; seq < 100; seq++) {
+        ASSERT_NE(table.find(seq), nullptr);
+        EXPECT_EQ(table.find(seq)->id, seq);
+    }
+    for (uint32_t seq = 0; seq < 100; seq++) {
+        EXPECT_EQ(table.oldest()->id, seq);
+        table.popOldest();
+    }
+}
+
+TEST(SequenceTableTest, DropsSequenceNumbersBeyondMaxCapacity) {
+    SequenceTable<Entry> table(8, MAX_CAPACITY);
+    bool inserted = false;
+    table.findOrInsert(0, inserted);
+    // A stray reply far ahead must not grow the ring towards 2^31 slots
+    EXPECT_EQ(table.findOrInsert(1U << 30, inserted), nullptr);
+    EXPECT_FALSE(inserted);
+    EXPECT_EQ(table.findOrInsert(MAX_CAPACITY, inserted), nullptr);
+    EXPECT_EQ(table.capacity(), 8u);
+    EXPECT_EQ(table.size(), 1u);
+    // The last sequence number that fits is still taken
+    ASSERT_NE(table.findOrInsert(MAX_CAPACITY - 1, inserted), nullptr);
+    EXPECT_TRUE(inserted);
+    EXPECT_EQ(table.capacity(), MAX_CAPACITY);
+}
+
+TEST(SequenceTableTest, SteadyStateKeepsCapacity) {
+    SequenceTable<Entry> table(16, MAX_CAPACITY);
+    bool inserted = false;
+    // Ten packets in flight at any time, over many laps of the ring
+    for (uint32_t seq = 0; seq < 10000; seq++) {
+        table.findOrInsert(seq, inserted);
+        if (table.size() > 10) {
+            table.popOldest();
+        }
+    }
+    EXPECT_EQ(table.capacity(), 16u);
+    EXPECT_EQ(table.size(), 10u);
+}
+
+TEST(SequenceTableTest, WrapsAroundSequenceSpace) {
+    SequenceTable<Entry> table(8, MAX_CAPACITY);
+    bool inserted = false;
+    uint32_t first = UINT32_MAX - 2;
+    for (uint32_t i = 0; i < 6; i++) {
+        table.findOrInsert(first + i, inserted)->id = first + i;
+    }
+    EXPECT_EQ(table.size(), 6u);
+    ASSERT_NE(table.find(1), nullptr);
+    for (uint32_t i = 0; i < 6; i++) {
+        EXPECT_EQ(table.oldest()->id, first + i);
+        table.popOldest();
+    }
+    // UINT32_MAX is now behind the head
+    EXPECT_EQ(table.findOrInsert(UINT32_MAX, inserted), nullptr);
+}
+
+TEST(SequenceTableTest, HeadMovesUpWhenEmpty) {
+    SequenceTable<Entry> table(8, MAX_CAPACITY);
+    bool inserted = false;
+    table.findOrInsert(0, inserted);
+    table.popOldest();
+    // Packets that were never observed leave a gap the table does not grow over
+    table.findOrInsert(1000, inserted)->id = 1000;
+    EXPECT_EQ(table.capacity(), 8u);
+    EXPECT_EQ(table.oldest()->id, 1000u);
+}
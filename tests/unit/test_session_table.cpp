@@ -0,0 +1,197 @@
+/**
+ * Unit tests for the reflector session table (flat_hash_map.h, Session.h)
+ */
+
+#include <gtest/gtest.h>
+#include "Session.h"
+#include "flat_hash_map.h"
+#include <arpa/inet.h>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+
+struct IdentityHash {
+    auto operator()(uint32_t key) const -> size_t { return key; }
+};
+
+// ============================================================================
+// Tests for FlatHashMap
+// ============================================================================
+
+TEST(FlatHashMapTest, InsertAndFind) {
+    FlatHashMap<uint32_t, int, IdentityHash> map;
+    EXPECT_EQ(map.find(1), nullptr);
+
+    bool inserted = false;
+    map.findOrInsert(1, &inserted) = 10;
+    EXPECT_TRUE(inserted);
+    map.findOrInsert(1, &inserted) += 5;
+    EXPECT_FALSE(inserted);
+
+    ASSERT_NE(map.find(1), nullptr);
+    EXPECT_EQ(*map.find(1), 15);
+    EXPECT_EQ(map.size(), 1u);
+}
+
+TEST(FlatHashMapTest, GrowsAndKeepsEntries) {
+    FlatHashMap<uint32_t, uint32_t, IdentityHash> map(16);
+    for (uint32_t i = 0; i < 1000; i++) {
+        map.findOrInsert(i) = i * 2;
+    }
+    EXPECT_EQ(map.size(), 1000u);
+    EXPECT_GE(map.capacity(), 2000u);
+    for (uint32_t i = 0; i < 1000; i++) {
+        ASSERT_NE(map.find(i), nullptr);
+        EXPECT_EQ(*map.find(i), i * 2);
+    }
+}
+
+TEST(FlatHashMapTest, EraseKeepsCollidingKeysReachable) {
+    // With an identity hash, keys 0, 16 and 32 share home slot 0 in a 16 slot table
+    FlatHashMap<uint32_t, int, IdentityHash> map(16);
+    map.findOrInsert(0) = 1;
+    map.findOrInsert(16) = 2;
+    map.findOrInsert(1) = 3;
+    map.findOrInsert(32) = 4;
+
+    EXPECT_TRUE(map.erase(0));
+    EXPECT_FALSE(map.erase(0));
+    EXPECT_EQ(map.find(0), nullptr);
+    ASSERT_NE(map.find(16), nullptr);
+    EXPECT_EQ(*map.find(16), 2);
+    ASSERT_NE(map.find(1), nullptr);
+    EXPECT_EQ(*map.find(1), 3);
+    ASSERT_NE(map.find(32), nullptr);
+    EXPECT_EQ(*map.find(32), 4);
+    EXPECT_EQ(map.size(), 3u);
+}
+
+TEST(FlatHashMapTest, EraseIf) {
+    FlatHashMap<uint32_t, uint32_t, IdentityHash> map;
+    for (uint32_t i = 0; i < 100; i++) {
+        map.findOrInsert(i) = i;
+    }
+    size_t erased = map.eraseIf([](uint32_t, uint32_t value) { return value % 2 == 0; });
+    EXPECT_EQ(erased, 50u);
+    EXPECT_EQ(map.size(), 50u);
+    for (uint32_t i = 0; i < 100; i++) {
+        EXPECT_EQ(map.find(i) != nullptr, i % 2 == 1);
+    }
+}
+
+TEST(FlatHashMapTest, MatchesUnorderedMapUnderRandomOperations) {
+    FlatHashMap<uint32_t, uint32_t, IdentityHash> map;
+    std::unordered_map<uint32_t, uint32_t> reference;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<uint32_t> key_dist(0, 500);
+    for (int i = 0; i < 20000; i++) {
+        uint32_t key = key_dist(gen);
+        if (gen() % 3 == 0) {
+            EXPECT_EQ(map.erase(key), reference.erase(key) == 1);
+        } else {
+            map.findOrInsert(key) = (uint32_t) i;
+            reference[key] = (uint32_t) i;
+        }
+    }
+    EXPECT_EQ(map.size(), reference.size());
+    for (const auto &entry : reference) {
+        ASSERT_NE(map.find(entry.first), nullptr);
+        EXPECT_EQ(*map.find(entry.first), entry.second);
+    }
+}
+
+// ============================================================================
+// Tests for SessionKey
+// ============================================================================
+
+TEST(SessionKeyTest, IPv4AndIPv6KeysDiffer) {
+    // Held in sockaddr_storage, like the receive buffers, so either family fits the object make_session_key reads
+    sockaddr_storage storage4{};
+    auto &addr4 = reinterpret_cast<sockaddr_in &>(storage4);
+    addr4.sin_family = AF_INET;
+    addr4.sin_port = htons(5000);
+    inet_pton(AF_INET, "192.0.2.1", &addr4.sin_addr);
+
+    sockaddr_storage storage6{};
+    auto &addr6 = reinterpret_cast<sockaddr_in6 &>(storage6);
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_port = htons(5000);
+    inet_pton(AF_INET6, "::ffff:192.0.2.1", &addr6.sin6_addr);
+
+    SessionKey key4 = make_session_key(reinterpret_cast<sockaddr *>(&storage4), 443);
+    SessionKey key6 = make_session_key(reinterpret_cast<sockaddr *>(&storage6), 443);
+    // An IPv4 sender and its v4-mapped form are the same session
+    EXPECT_EQ(memcmp(&key4, &key6, sizeof(SessionKey)), 0);
+    EXPECT_EQ(SessionKeyHash{}(key4), SessionKeyHash{}(key6));
+
+    addr4.sin_port = htons(5001);
+    SessionKey other_port = make_session_key(reinterpret_cast<sockaddr *>(&storage4), 443);
+    EXPECT_NE(memcmp(&key4, &other_port, sizeof(SessionKey)), 0);
+}
+
+// ============================================================================
+// Tests for Session sequence accounting
+// ============================================================================
+
+TEST(SessionTest, InOrderHasNoLoss) {
+    Session session;
+    for (uint32_t seq = 5; seq < 15; seq++) {
+        session.recordSenderSeq(seq);
+    }
+    EXPECT_EQ(session.received, 10u);
+    EXPECT_EQ(session.lost, 0u);
+    EXPECT_EQ(session.reordered, 0u);
+}
+
+TEST(SessionTest, CountsGapsAndLateArrivals) {
+    Session session;
+    session.recordSenderSeq(0);
+    session.recordSenderSeq(1);
+    session.recordSenderSeq(4); // 2 and 3 missing
+    EXPECT_EQ(session.lost, 2u);
+    session.recordSenderSeq(2); // Late, not lost
+    EXPECT_EQ(session.lost, 1u);
+    EXPECT_EQ(session.reordered, 1u);
+    session.recordSenderSeq(4);
+    EXPECT_EQ(session.duplicated, 1u);
+    EXPECT_EQ(session.highest_sender_seq, 4u);
+}
+
+TEST(SessionTest, SequenceWrapAround) {
+    Session session;
+    session.recordSenderSeq(UINT32_MAX - 1);
+    session.recordSenderSeq(UINT32_MAX);
+    session.recordSenderSeq(1); // 0 missing
+    EXPECT_EQ(session.lost, 1u);
+    EXPECT_EQ(session.reordered, 0u);
+    EXPECT_EQ(session.highest_sender_seq, 1u);
+}
+
+// ============================================================================
+// Tests for TokenBucket
+// ============================================================================
+
+TEST(TokenBucketTest, AllowsBurstThenRate) {
+    TokenBucket bucket;
+    bucket.tokens = 3;
+    bucket.last_refill_usec = 1000000;
+    // 10 packets per second with a burst of 3
+    EXPECT_TRUE(bucket.tryConsume(1000000, 10, 3));
+    EXPECT_TRUE(bucket.tryConsume(1000000, 10, 3));
+    EXPECT_TRUE(bucket.tryConsume(1000000, 10, 3));
+    EXPECT_FALSE(bucket.tryConsume(1000000, 10, 3));
+    // 100 ms later exactly one token has been added
+    EXPECT_TRUE(bucket.tryConsume(1100000, 10, 3));
+    EXPECT_FALSE(bucket.tryConsume(1100000, 10, 3));
+    EXPECT_EQ(bucket.passed, 4u);
+    EXPECT_EQ(bucket.dropped, 2u);
+}
+
+TEST(TokenBucketTest, RefillIsCappedAtBurst) {
+    TokenBucket bucket;
+    bucket.last_refill_usec = 0;
+    // A long idle period refills no more than the burst
+    EXPECT_TRUE(bucket.tryConsume(60000000, 10, 2));
+    EXPECT_TRUE(bucket.tryConsume(60000000, 10, 2));
+    EXPECT_FALSE(bucket.tryConsume(60000000, 10, 2));
+}
@@ -0,0 +1,143 @@
+/**
+ * Unit tests for timer_wheel.h (TimerWheel)
+ */
+
+#include <gtest/gtest.h>
+#include "timer_wheel.h"
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+constexpr uint64_t TICK = 1000;
+
+// ============================================================================
+// Firing
+// ============================================================================
+
+TEST(TimerWheelTest, StartsEmpty) {
+    TimerWheel<int> wheel(TICK, 0);
+    EXPECT_TRUE(wheel.empty());
+    EXPECT_EQ(wheel.nextExpiry(), 0u);
+}
+
+TEST(TimerWheelTest, FiresAtExpiryNotBefore) {
+    TimerWheel<int> wheel(TICK, 0);
+    wheel.schedule(5500, 1);
+    std::vector<int> fired;
+    auto collect = [&fired](int value) { fired.push_back(value); };
+
+    wheel.advance(5499, collect);
+    EXPECT_TRUE(fired.empty());
+    // The expiry is rounded up to the next tick
+    wheel.advance(5999, collect);
+    EXPECT_TRUE(fired.empty());
+    wheel.advance(6000, collect);
+    ASSERT_EQ(fired.size(), 1u);
+    EXPECT_EQ(fired[0], 1);
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTest, FiresInOrderOfExpiry) {
+    TimerWheel<int> wheel(TICK, 0);
+    wheel.schedule(30 * TICK, 3);
+    wheel.schedule(10 * TICK, 1);
+    wheel.schedule(20 * TICK, 2);
+    std::vector<int> fired;
+    wheel.advance(100 * TICK, [&fired](int value) { fired.push_back(value); });
+    EXPECT_EQ(fired, (std::vector<int>{1, 2, 3}));
+}
+
+TEST(TimerWheelTest, ExpiredTimerFiresOnNextAdvance) {
+    TimerWheel<int> wheel(TICK, 50 * TICK);
+    wheel.schedule(10 * TICK, 7);
+    int fired = 0;
+    wheel.advance(50 * TICK, [&fired](int value) { fired = value; });
+    EXPECT_EQ(fired, 7);
+}
+
+TEST(TimerWheelTest, CallbackMaySetTimers) {
+    TimerWheel<int> wheel(TICK, 0);
+    wheel.schedule(TICK, 0);
+    std::vector<int> fired;
+    // Each timer sets the next one two ticks later
+    std::function<void(int)> chain = [&](int value) {
+        fired.push_back(value);
+        if (value < 4) {
+            wheel.schedule((uint64_t) (value + 1) * 2 * TICK + TICK, value + 1);
+        }
+    };
+    wheel.advance(100 * TICK, chain);
+    EXPECT_EQ(fired, (std::vector<int>{0, 1, 2, 3, 4}));
+}
+
+// ============================================================================
+// Higher levels
+// ============================================================================
+
+TEST(TimerWheelTest, CascadesFromHigherLevels) {
+    TimerWheel<uint64_t> wheel(1, 0);
+    std::vector<uint64_t> expiries = {255, 256, 257, 65535, 65536, 70000, 16777216, 20000000};
+    for (uint64_t expiry : expiries) {
+        wheel.schedule(expiry, expiry);
+    }
+    std::vector<uint64_t> fired;
+    for (size_t i = 0; i < expiries.size(); i++) {
+        wheel.advance(expiries[i] - 1, [&fired](uint64_t value) { fired.push_back(value); });
+        EXPECT_EQ(fired.size(), i) << "fired early before " << expiries[i];
+        wheel.advance(expiries[i], [&fired](uint64_t value) { fired.push_back(value); });
+        ASSERT_EQ(fired.size(), i + 1);
+        EXPECT_EQ(fired.back(), expiries[i]);
+    }
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTest, TimersBeyondTheWheel) {
+    TimerWheel<int> wheel(1, 0);
+    uint64_t far = (1ULL << 32) + 1000;
+    wheel.schedule(far, 1);
+    int fired = 0;
+    wheel.advance(far - 1, [&fired](int value) { fired = value; });
+    EXPECT_EQ(fired, 0);
+    wheel.advance(far, [&fired](int value) { fired = value; });
+    EXPECT_EQ(fired, 1);
+}
+
+TEST(TimerWheelTest, NextExpiryIsNeverLate) {
+    TimerWheel<int> wheel(TICK, 0);
+    wheel.schedule(300 * TICK, 1);
+    uint64_t next = wheel.nextExpiry();
+    EXPECT_GT(next, 0u);
+    EXPECT_LE(next, 300 * TICK);
+
+    wheel.schedule(12 * TICK, 2);
+    EXPECT_EQ(wheel.nextExpiry(), 12 * TICK);
+}
+
+TEST(TimerWheelTest, MatchesSortedExpiries) {
+    TimerWheel<uint32_t> wheel(TICK, 0);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint64_t> expiry(0, 10000000 * TICK);
+    const uint32_t num_timers = 100000;
+    std::vector<uint64_t> ticks(num_timers);
+    for (uint32_t i = 0; i < num_timers; i++) {
+        uint64_t at = expiry(rng);
+        ticks[i] = (at + TICK - 1) / TICK;
+        wheel.schedule(at, i);
+    }
+    EXPECT_EQ(wheel.size(), num_timers);
+
+    // Jump from one reported expiry to the next, checking each timer fires at its own tick
+    uint32_t fired = 0;
+    uint64_t previous_tick = 0;
+    while (!wheel.empty()) {
+        uint64_t now = wheel.nextExpiry();
+        ASSERT_GE(now / TICK, previous_tick);
+        wheel.advance(now, [&](uint32_t id) {
+            EXPECT_EQ(ticks[id], now / TICK);
+            fired++;
+        });
+        previous_tick = now / TICK;
+    }
+    EXPECT_EQ(fired, num_timers);
+}